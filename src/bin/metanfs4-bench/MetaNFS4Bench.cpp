@@ -0,0 +1,975 @@
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+// =============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "MetaNFS4BenchOptions.hpp"
+
+// -----------------------------------------------------------------------------
+
+// benchmarked request types
+struct SRequestType {
+    int         Type;
+    const char* Name;
+};
+
+const SRequestType RequestTypes[] = {
+    { MSG_IDMAP_REG_NAME,               "reg_name" },
+    { MSG_IDMAP_REG_GROUP,              "reg_group" },
+    { MSG_IDMAP_USER_TO_LOCAL_DOMAIN,   "user_to_local_domain" },
+    { MSG_IDMAP_GROUP_TO_LOCAL_DOMAIN,  "group_to_local_domain" },
+    { MSG_NAME_TO_ID,                   "name_to_id" },
+    { MSG_ID_TO_NAME,                   "id_to_name" },
+    { MSG_GROUP_TO_ID,                  "group_to_id" },
+    { MSG_ID_TO_GROUP,                  "id_to_group" },
+    { MSG_ENUM_NAME,                    "enum_name" },
+    { MSG_ENUM_GROUP,                   "enum_group" },
+    { MSG_IDMAP_PRINC_TO_ID,            "princ_to_id" },
+    { MSG_IDMAP_PRINC_TO_GROUPS,        "princ_to_groups" },
+    { MSG_LOOKUP_BATCH,                 "lookup_batch" },
+    { MSG_USER_TO_GROUPS,               "user_to_groups" },
+    { MSG_ENUM_USERS,                   "enum_users" },
+    { MSG_ENUM_GROUPS,                  "enum_groups" },
+    { MSG_HELLO,                        "hello" },
+    { MSG_IDMAP_UID_TO_NAME,            "uid_to_name" },
+    { MSG_IDMAP_GID_TO_NAME,            "gid_to_name" },
+    { MSG_IDMAP_NAME_TO_UID,            "name_to_uid" },
+    { MSG_IDMAP_NAME_TO_GID,            "name_to_gid" },
+    { MSG_ENUM_USERS_V2,                "enum_users_v2" },
+    { MSG_ENUM_GROUPS_V2,               "enum_groups_v2" },
+    { MSG_LOOKUP_BATCH_V2,              "lookup_batch_v2" },
+};
+
+const size_t NumOfRequestTypes = sizeof(RequestTypes)/sizeof(RequestTypes[0]);
+
+// latency histogram with buckets of relative width 1/32, values are in ns,
+// values below 64 ns have their own buckets
+#define HIST_SUB_BITS   5
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_SIZE       (64*HIST_SUB)
+
+struct SLatency {
+    std::vector<uint64_t>   Buckets;
+    uint64_t                Count;
+    uint64_t                Invalid;    // responses with MSG_INVALID type
+    uint64_t                Errors;     // failed exchanges
+    uint64_t                Max;
+};
+
+// request or response independent of the protocol version
+struct SMessage {
+    int                     Type;
+    uint32_t                ID;
+    uint32_t                Extra;
+    std::string             Name;           // names are truncated to MAX_NAME in protocol v1
+    size_t                  Len;            // data size
+    const char*             Data;           // response: data in the buffer of the worker
+};
+
+// client thread
+struct SWorker {
+    pthread_t               Thread;
+    int                     Index;
+    int                     Socket;
+    int                     Version;        // protocol version used on the connection
+    uint64_t                Tag;            // tag of the last request (v3)
+    unsigned int            Seed;
+    unsigned long           Registered;     // counter of registered names
+    unsigned int            EnumUserIndex;  // cursors of enumerations, v1 and v2 records share them
+    unsigned int            EnumGroupIndex;
+    std::vector<char>       Extra;          // extra data of the request and the response (v1)
+    std::vector<char>       Buffer;         // the last response (v2)
+    std::vector<SLatency>   Stat;           // per request type
+};
+
+// a user or group known to the daemon
+struct SAccount {
+    std::string Name;
+    uint32_t    ID;
+};
+
+// setup
+std::string             SocketName;
+std::string             Domain;
+int                     NumOfThreads    = 4;
+int                     Duration        = 10;
+int                     Rate            = 0;        // total rate, 0 - closed loop
+int                     BatchSize       = 16;
+size_t                  MaxNames        = 10000;
+int                     Protocol        = PROTOCOL_VERSION;     // the highest version used
+
+// mix of requests - indexes to RequestTypes and cumulative weights
+std::vector<size_t>     MixTypes;
+std::vector<unsigned>   MixWeights;
+unsigned                MixTotal        = 0;
+
+// data for lookups
+std::vector<SAccount>   Users;
+std::vector<SAccount>   Groups;
+uint32_t                BaseID          = 0;
+
+// human-readable output, it goes to stderr if JSON is written to stdout
+FILE*                   Report          = stdout;
+
+// measurement
+uint64_t                StartTime       = 0;
+uint64_t                EndTime         = 0;
+
+// -----------------------------------------------------------------------------
+
+uint64_t get_time_ns(void);
+bool parse_mix(const std::string& mix);
+int open_socket(void);
+bool open_connection(SWorker& worker);
+int exchange(SWorker& worker,SMessage& msg,const void* p_extra,size_t extra_len);
+int exchange_v1(SWorker& worker,SMessage& msg,const void* p_extra,size_t extra_len);
+int exchange_v2(SWorker& worker,SMessage& msg,const void* p_extra,size_t extra_len);
+bool load_accounts(void);
+bool load_account_list(int type,std::vector<SAccount>& list);
+void prepare_request(SWorker& worker,size_t ti,SMessage& msg,size_t& extra_len);
+void prepare_batch(SWorker& worker,bool full,SMessage& msg,size_t& extra_len);
+void process_response(SWorker& worker,size_t ti,const SMessage& msg);
+void* worker_main(void* p_arg);
+size_t get_bucket(uint64_t ns);
+uint64_t get_bucket_value(size_t bucket);
+uint64_t get_percentile(const SLatency& stat,double q);
+void init_latency(SLatency& stat);
+void merge_latency(SLatency& dest,const SLatency& src);
+void print_line(const char* p_name,const SLatency& stat,double elapsed);
+void print_results(const std::vector<SLatency>& stats,const SLatency& total,double elapsed);
+std::string escape_json(const std::string& str);
+void write_json_stat(FILE* p_fout,const SLatency& stat,double elapsed);
+bool write_json(const char* p_name,const std::vector<SLatency>& stats,const SLatency& total,double elapsed);
+
+// -----------------------------------------------------------------------------
+
+int main(int argc,char* argv[])
+{
+    CMetaNFS4BenchOptions options;
+
+    // encode program options
+    int result = options.ParseCmdLine(argc,argv);
+
+    // should we exit or was it error?
+    if( result == SO_EXIT ) return(0);
+    if( result != SO_CONTINUE ) return(1);
+
+    SocketName = std::string(options.GetOptSocket());
+    Domain = std::string(options.GetOptDomain());
+    NumOfThreads = options.GetOptThreads();
+    Duration = options.GetOptDuration();
+    Rate = options.GetOptRate();
+    BatchSize = options.GetOptBatch();
+    MaxNames = options.GetOptNames();
+    Protocol = options.GetOptProtocol();
+
+    if( parse_mix(std::string(options.GetOptMix())) == false ) return(1);
+
+    if( (options.GetOptJSON() != NULL) && (strcmp(options.GetOptJSON(),"-") == 0) ) Report = stderr;
+
+    if( SocketName.size() >= UNIX_PATH_MAX ){
+        fprintf(stderr,"metanfs4-bench: the socket name is too long\n");
+        return(1);
+    }
+
+    if( load_accounts() == false ){
+        fprintf(stderr,"metanfs4-bench: unable to contact the daemon on %s\n",SocketName.c_str());
+        return(1);
+    }
+
+    fprintf(Report,"# socket:   %s (protocol up to v%d)\n",SocketName.c_str(),Protocol);
+    fprintf(Report,"# accounts: %lu users, %lu groups (base id %u)\n",(unsigned long)Users.size(),(unsigned long)Groups.size(),BaseID);
+    fprintf(Report,"# load:     %d threads, %s",NumOfThreads,Rate > 0 ? "open loop" : "closed loop");
+    if( Rate > 0 ) fprintf(Report," at %d requests/s",Rate);
+    fprintf(Report,", %d s\n",Duration);
+    fflush(Report);
+
+    // run workers
+    std::vector<SWorker> workers(NumOfThreads);
+    StartTime = get_time_ns() + 10000000;   // all threads start at the same time
+    EndTime = StartTime + (uint64_t)Duration*1000000000;
+
+    int started = 0;
+    for(int i=0; i < NumOfThreads; i++){
+        SWorker& worker = workers[i];
+        worker.Index = i;
+        worker.Socket = -1;
+        worker.Version = 1;
+        worker.Tag = 0;
+        worker.Seed = time(NULL) ^ (getpid() << 8) ^ i;
+        worker.Registered = 0;
+        worker.EnumUserIndex = 1;
+        worker.EnumGroupIndex = 1;
+        worker.Stat.resize(NumOfRequestTypes);
+        for(size_t k=0; k < NumOfRequestTypes; k++) init_latency(worker.Stat[k]);
+        if( pthread_create(&worker.Thread,NULL,worker_main,&worker) != 0 ){
+            fprintf(stderr,"metanfs4-bench: unable to start thread (%s)\n",strerror(errno));
+            break;
+        }
+        started++;
+    }
+    for(int i=0; i < started; i++){
+        pthread_join(workers[i].Thread,NULL);
+    }
+    if( started != NumOfThreads ) return(1);
+
+    double elapsed = (get_time_ns() - StartTime)*1e-9;
+
+    // merge results of all threads
+    std::vector<SLatency> stats(NumOfRequestTypes);
+    SLatency total;
+    init_latency(total);
+    for(size_t k=0; k < NumOfRequestTypes; k++){
+        init_latency(stats[k]);
+        for(int i=0; i < NumOfThreads; i++){
+            merge_latency(stats[k],workers[i].Stat[k]);
+        }
+        merge_latency(total,stats[k]);
+    }
+
+    print_results(stats,total,elapsed);
+
+    if( options.GetOptJSON() != NULL ){
+        if( write_json(options.GetOptJSON(),stats,total,elapsed) == false ){
+            fprintf(stderr,"metanfs4-bench: unable to write %s (%s)\n",(const char*)options.GetOptJSON(),strerror(errno));
+            return(1);
+        }
+    }
+
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+
+// monotonic time in nanoseconds
+uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return((uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec);
+}
+
+// -----------------------------------------------------------------------------
+
+bool parse_mix(const std::string& mix)
+{
+    size_t pos = 0;
+    while( pos < mix.size() ){
+        size_t end = mix.find(',',pos);
+        if( end == std::string::npos ) end = mix.size();
+        std::string item = mix.substr(pos,end-pos);
+        pos = end + 1;
+        if( item.empty() ) continue;
+
+        // type[:weight]
+        unsigned weight = 1;
+        size_t colon = item.find(':');
+        if( colon != std::string::npos ){
+            char* p_end = NULL;
+            weight = strtoul(item.c_str() + colon + 1,&p_end,10);
+            if( (p_end == NULL) || (*p_end != '\0') || (colon + 1 == item.size()) ){
+                fprintf(stderr,"metanfs4-bench: invalid weight in '%s'\n",item.c_str());
+                return(false);
+            }
+            item = item.substr(0,colon);
+        }
+
+        size_t ti = 0;
+        while( (ti < NumOfRequestTypes) && (item != RequestTypes[ti].Name) ) ti++;
+        if( ti == NumOfRequestTypes ){
+            fprintf(stderr,"metanfs4-bench: unsupported request type '%s'\n",item.c_str());
+            return(false);
+        }
+        if( weight == 0 ) continue;
+
+        MixTotal += weight;
+        MixTypes.push_back(ti);
+        MixWeights.push_back(MixTotal);
+    }
+
+    if( MixTotal == 0 ){
+        fprintf(stderr,"metanfs4-bench: the mix of requests is empty\n");
+        return(false);
+    }
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+int open_socket(void)
+{
+    int sckt = socket(AF_UNIX,SOCK_SEQPACKET | SOCK_CLOEXEC,0);
+    if( sckt == -1 ) return(-1);
+
+    struct sockaddr_un address;
+    memset(&address,0,sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path,SocketName.c_str(),UNIX_PATH_MAX-1);
+    socklen_t addrlen = offsetof(struct sockaddr_un,sun_path) + strlen(address.sun_path) + 1;
+
+    if( connect(sckt,(struct sockaddr*)&address,addrlen) == -1 ){
+        close(sckt);
+        return(-1);
+    }
+    return(sckt);
+}
+
+// -----------------------------------------------------------------------------
+
+// connect and negotiate the protocol version in the same way as the client
+// libraries, a daemon supporting only v1 closes the connection after MSG_HELLO
+
+bool open_connection(SWorker& worker)
+{
+    worker.Socket = open_socket();
+    if( worker.Socket < 0 ) return(false);
+
+    worker.Version = 1;
+    if( Protocol < 2 ) return(true);
+
+    struct SNFS4Header hello;
+    memset(&hello,0,sizeof(hello));
+    hello.Magic = PROTOCOL_MAGIC;
+    hello.Type = MSG_HELLO;
+    hello.ID = Protocol;
+
+    if( (send(worker.Socket,&hello,sizeof(hello),MSG_NOSIGNAL) == sizeof(hello)) &&
+        (recv(worker.Socket,&hello,sizeof(hello),0) == sizeof(hello)) &&
+        (hello.Magic == PROTOCOL_MAGIC) && (hello.Type == MSG_HELLO) && (hello.ID >= 2) ){
+        worker.Version = hello.ID < (uint32_t)Protocol ? hello.ID : Protocol;
+        return(true);
+    }
+
+    close(worker.Socket);
+    worker.Socket = open_socket();
+    return(worker.Socket >= 0);
+}
+
+// -----------------------------------------------------------------------------
+
+// the same exchange as in the client libraries, the connection is reopened
+// by the next exchange if it fails
+
+int exchange(SWorker& worker,SMessage& msg,const void* p_extra,size_t extra_len)
+{
+    if( worker.Socket < 0 ){
+        if( open_connection(worker) == false ) return(-1);
+    }
+
+    int ret;
+    if( worker.Version >= 2 ){
+        ret = exchange_v2(worker,msg,p_extra,extra_len);
+    } else {
+        ret = exchange_v1(worker,msg,p_extra,extra_len);
+    }
+
+    if( ret != 0 ){
+        close(worker.Socket);
+        worker.Socket = -1;
+    }
+    return(ret);
+}
+
+// -----------------------------------------------------------------------------
+
+// SNFS4Message records, extra data of the response are received into worker.Extra
+
+int exchange_v1(SWorker& worker,SMessage& msg,const void* p_extra,size_t extra_len)
+{
+    struct SNFS4Message data;
+    memset(&data,0,sizeof(data));
+    data.Type = msg.Type;
+    data.ID.UID = msg.ID;
+    data.Extra.UID = msg.Extra;
+    data.Len = extra_len;
+    strncpy(data.Name,msg.Name.c_str(),MAX_NAME);
+
+    if( send(worker.Socket,&data,sizeof(data),MSG_NOSIGNAL) != sizeof(data) ) return(-1);
+    if( extra_len > 0 ){
+        if( send(worker.Socket,p_extra,extra_len,MSG_NOSIGNAL) != (ssize_t)extra_len ) return(-1);
+    }
+
+    memset(&data,0,sizeof(data));
+    if( recv(worker.Socket,&data,sizeof(data),0) != sizeof(data) ) return(-1);
+    if( data.Len > 0 ){
+        if( worker.Extra.size() < data.Len ) worker.Extra.resize(data.Len);
+        if( recv(worker.Socket,&worker.Extra[0],data.Len,0) != (ssize_t)data.Len ) return(-1);
+    }
+
+    data.Name[MAX_NAME] = '\0';
+    msg.Type = data.Type;
+    msg.ID = data.ID.UID;
+    msg.Extra = data.Extra.UID;
+    msg.Name = data.Name;
+    msg.Len = data.Len;
+    msg.Data = data.Len > 0 ? &worker.Extra[0] : NULL;
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+
+// one record in each direction, the response is received into worker.Buffer,
+// the request is repeated with a larger buffer if the response does not fit
+
+int exchange_v2(SWorker& worker,SMessage& msg,const void* p_extra,size_t extra_len)
+{
+    struct SNFS4TaggedHeader    tagged;
+    struct SNFS4Header&         header = tagged.Header;
+    bool                        use_tag = worker.Version >= 3;
+    size_t                      hlen = use_tag ? sizeof(tagged) : sizeof(header);
+    ssize_t                     len;
+
+    if( worker.Buffer.empty() ) worker.Buffer.resize(sizeof(tagged) + MAX_NAME_V2 + 1 + MAX_CHUNK);
+
+    for(;;){
+        memset(&tagged,0,sizeof(tagged));
+        header.Magic = use_tag ? PROTOCOL_MAGIC_TAGGED : PROTOCOL_MAGIC;
+        header.Type = msg.Type;
+        header.ID = msg.ID;
+        header.Extra = msg.Extra;
+        header.NameLen = msg.Name.empty() ? 0 : msg.Name.size() + 1;
+        header.DataLen = extra_len;
+        header.MaxLen = worker.Buffer.size() - hlen;
+        tagged.Tag = ++worker.Tag;
+
+        struct iovec iov[3];
+        iov[0].iov_base = &tagged;
+        iov[0].iov_len = hlen;
+        iov[1].iov_base = (void*)msg.Name.c_str();
+        iov[1].iov_len = header.NameLen;
+        iov[2].iov_base = (void*)p_extra;
+        iov[2].iov_len = extra_len;
+
+        struct msghdr mh;
+        memset(&mh,0,sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = 3;
+
+        len = sendmsg(worker.Socket,&mh,MSG_NOSIGNAL);
+        if( len != (ssize_t)(hlen + header.NameLen + extra_len) ) return(-1);
+
+        len = recv(worker.Socket,&worker.Buffer[0],worker.Buffer.size(),MSG_TRUNC);
+        if( (len < (ssize_t)hlen) || ((size_t)len > worker.Buffer.size()) ) return(-1);
+
+        memcpy(&tagged,&worker.Buffer[0],hlen);
+        if( header.Magic != (use_tag ? PROTOCOL_MAGIC_TAGGED : PROTOCOL_MAGIC) ) return(-1);
+        if( use_tag && (tagged.Tag != worker.Tag) ) return(-1);
+        if( header.Status != ERANGE ) break;
+
+        if( ((size_t)len != hlen) || (hlen + header.MaxLen <= worker.Buffer.size()) ) return(-1);
+        worker.Buffer.resize(hlen + header.MaxLen);
+    }
+
+    const char* p_payload = &worker.Buffer[hlen];
+    if( (size_t)len != hlen + header.NameLen + header.DataLen ) return(-1);
+    if( (header.NameLen > 0) && (p_payload[header.NameLen-1] != '\0') ) return(-1);
+
+    msg.Type = header.Type;
+    msg.ID = header.ID;
+    msg.Extra = header.Extra;
+    msg.Name.assign(p_payload,header.NameLen > 0 ? header.NameLen - 1 : 0);
+    msg.Len = header.DataLen;
+    msg.Data = p_payload + header.NameLen;
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+
+bool load_accounts(void)
+{
+    if( load_account_list(MSG_ENUM_USERS_V2,Users) == false ) return(false);
+    if( load_account_list(MSG_ENUM_GROUPS_V2,Groups) == false ) return(false);
+
+    // ids are allocated from BaseID+1 without gaps
+    BaseID = 0;
+    if( ! Users.empty() ) BaseID = Users[0].ID - 1;
+    if( ! Groups.empty() && ( Users.empty() || (Groups[0].ID - 1 < BaseID) ) ) BaseID = Groups[0].ID - 1;
+
+    // the daemon does not know any account - lookups will not be resolved
+    if( Users.empty() ){
+        SAccount account;
+        account.Name = "nobody@" + Domain;
+        account.ID = BaseID + 1;
+        Users.push_back(account);
+    }
+    if( Groups.empty() ){
+        SAccount account;
+        account.Name = "nogroup@" + Domain;
+        account.ID = BaseID + 1;
+        Groups.push_back(account);
+    }
+
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+// full names are enumerated by MSG_ENUM_USERS_V2/MSG_ENUM_GROUPS_V2,
+// older daemons are enumerated by v1 records
+
+bool load_account_list(int type,std::vector<SAccount>& list)
+{
+    SWorker worker;
+    worker.Socket = -1;
+    worker.Tag = 0;
+
+    unsigned int index = 1;
+    while( (index != 0) && (list.size() < MaxNames) ){
+        SMessage msg;
+        msg.Type = type;
+        msg.ID = index;
+        msg.Extra = 0;
+        if( exchange(worker,msg,NULL,0) != 0 ) return(false);
+        if( msg.Type != type ){
+            if( (index == 1) && (type == MSG_ENUM_USERS_V2) ){
+                type = MSG_ENUM_USERS;
+                continue;
+            }
+            if( (index == 1) && (type == MSG_ENUM_GROUPS_V2) ){
+                type = MSG_ENUM_GROUPS;
+                continue;
+            }
+            break;   // enumeration is not supported
+        }
+        bool full = (type == MSG_ENUM_USERS_V2) || (type == MSG_ENUM_GROUPS_V2);
+
+        // records, group records are followed by their members
+        size_t pos = 0;
+        for(unsigned int i=0; (i < msg.Extra) && (list.size() < MaxNames); i++){
+            SAccount account;
+            if( full ){
+                struct SNFS4EnumRecord rec;
+                if( pos + sizeof(rec) > msg.Len ) break;
+                memcpy(&rec,msg.Data + pos,sizeof(rec));
+                pos += sizeof(rec);
+                if( (rec.NameLen == 0) || (pos + rec.NameLen + rec.DataLen > msg.Len) ) break;
+                account.Name.assign(msg.Data + pos,rec.NameLen - 1);
+                account.ID = rec.ID;
+                pos += rec.NameLen + rec.DataLen;
+            } else {
+                struct SNFS4Message rec;
+                if( pos + sizeof(rec) > msg.Len ) break;
+                memcpy(&rec,msg.Data + pos,sizeof(rec));
+                rec.Name[MAX_NAME] = '\0';
+                account.Name = rec.Name;
+                account.ID = rec.ID.UID;
+                pos += sizeof(rec) + rec.Len;
+            }
+            list.push_back(account);
+        }
+        index = msg.ID;
+    }
+
+    if( worker.Socket >= 0 ) close(worker.Socket);
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+void prepare_request(SWorker& worker,size_t ti,SMessage& msg,size_t& extra_len)
+{
+    const SAccount& user = Users[rand_r(&worker.Seed) % Users.size()];
+    const SAccount& group = Groups[rand_r(&worker.Seed) % Groups.size()];
+    char name[MAX_NAME+1];
+
+    msg.Type = RequestTypes[ti].Type;
+    msg.ID = 0;
+    msg.Extra = 0;
+    msg.Name.clear();
+    extra_len = 0;
+
+    switch(msg.Type){
+        case MSG_IDMAP_REG_NAME:
+        case MSG_IDMAP_REG_GROUP:
+            // new names unique for the run
+            snprintf(name,sizeof(name),"%c%d.%d.%lu@%s",msg.Type == MSG_IDMAP_REG_NAME ? 'u' : 'g',
+                     getpid() % 100000,worker.Index,++worker.Registered,Domain.c_str());
+            msg.Name = name;
+        break;
+
+        case MSG_IDMAP_USER_TO_LOCAL_DOMAIN:
+        case MSG_NAME_TO_ID:
+        case MSG_IDMAP_PRINC_TO_ID:
+        case MSG_IDMAP_PRINC_TO_GROUPS:
+        case MSG_USER_TO_GROUPS:
+        case MSG_IDMAP_NAME_TO_UID:
+            msg.Name = user.Name;
+        break;
+
+        case MSG_IDMAP_GROUP_TO_LOCAL_DOMAIN:
+        case MSG_GROUP_TO_ID:
+        case MSG_IDMAP_NAME_TO_GID:
+            msg.Name = group.Name;
+        break;
+
+        case MSG_ID_TO_NAME:
+        case MSG_IDMAP_UID_TO_NAME:
+            msg.ID = user.ID;
+        break;
+
+        case MSG_ID_TO_GROUP:
+        case MSG_IDMAP_GID_TO_NAME:
+            msg.ID = group.ID;
+        break;
+
+        case MSG_ENUM_NAME:
+            msg.ID = user.ID - BaseID;
+        break;
+
+        case MSG_ENUM_GROUP:
+            msg.ID = group.ID - BaseID;
+        break;
+
+        case MSG_ENUM_USERS:
+        case MSG_ENUM_USERS_V2:
+            msg.ID = worker.EnumUserIndex;
+        break;
+
+        case MSG_ENUM_GROUPS:
+        case MSG_ENUM_GROUPS_V2:
+            msg.ID = worker.EnumGroupIndex;
+        break;
+
+        case MSG_HELLO:
+            msg.ID = PROTOCOL_VERSION;
+        break;
+
+        case MSG_LOOKUP_BATCH:
+        case MSG_LOOKUP_BATCH_V2:
+            prepare_batch(worker,msg.Type == MSG_LOOKUP_BATCH_V2,msg,extra_len);
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+// mix of all lookup types, full records (MSG_LOOKUP_BATCH_V2) carry names of any
+// length, the batch is shortened if the records exceed MAX_BATCH_DATA
+
+void prepare_batch(SWorker& worker,bool full,SMessage& msg,size_t& extra_len)
+{
+    if( worker.Extra.size() < MAX_BATCH_DATA ) worker.Extra.resize(MAX_BATCH_DATA);
+
+    int count = 0;
+    for(int i=0; i < BatchSize; i++){
+        const SAccount& iuser = Users[rand_r(&worker.Seed) % Users.size()];
+        const SAccount& igroup = Groups[rand_r(&worker.Seed) % Groups.size()];
+
+        int         type = MSG_INVALID;
+        uint32_t    id = 0;
+        const char* p_name = NULL;
+        switch(i % 4){
+            case 0:
+                type = MSG_ID_TO_NAME;
+                id = iuser.ID;
+            break;
+            case 1:
+                type = MSG_NAME_TO_ID;
+                p_name = iuser.Name.c_str();
+            break;
+            case 2:
+                type = MSG_ID_TO_GROUP;
+                id = igroup.ID;
+            break;
+            case 3:
+                type = MSG_GROUP_TO_ID;
+                p_name = igroup.Name.c_str();
+            break;
+        }
+
+        if( full ){
+            struct SNFS4BatchRecord rec;
+            memset(&rec,0,sizeof(rec));
+            rec.Type = type;
+            rec.ID = id;
+            rec.NameLen = p_name != NULL ? strlen(p_name) + 1 : 0;
+            if( extra_len + sizeof(rec) + rec.NameLen > MAX_BATCH_DATA ) break;
+            memcpy(&worker.Extra[extra_len],&rec,sizeof(rec));
+            if( rec.NameLen > 0 ) memcpy(&worker.Extra[extra_len + sizeof(rec)],p_name,rec.NameLen);
+            extra_len += sizeof(rec) + rec.NameLen;
+        } else {
+            struct SNFS4Message rec;
+            memset(&rec,0,sizeof(rec));
+            rec.Type = type;
+            rec.ID.UID = id;
+            if( p_name != NULL ) strncpy(rec.Name,p_name,MAX_NAME);
+            memcpy(&worker.Extra[extra_len],&rec,sizeof(rec));
+            extra_len += sizeof(rec);
+        }
+        count++;
+    }
+
+    msg.ID = count;
+}
+
+// -----------------------------------------------------------------------------
+
+void process_response(SWorker& worker,size_t ti,const SMessage& msg)
+{
+    // continue enumerations, they are restarted at the end
+    switch(RequestTypes[ti].Type){
+        case MSG_ENUM_USERS:
+        case MSG_ENUM_USERS_V2:
+            worker.EnumUserIndex = msg.ID != 0 ? msg.ID : 1;
+        break;
+        case MSG_ENUM_GROUPS:
+        case MSG_ENUM_GROUPS_V2:
+            worker.EnumGroupIndex = msg.ID != 0 ? msg.ID : 1;
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void* worker_main(void* p_arg)
+{
+    SWorker& worker = *(SWorker*)p_arg;
+
+    // open loop - requests are scheduled at regular intervals
+    uint64_t interval = 0;
+    if( Rate > 0 ) interval = (uint64_t)1000000000*NumOfThreads/Rate;
+
+    // all threads start at the same time, open loop threads are shifted
+    uint64_t scheduled = StartTime + (interval*worker.Index)/NumOfThreads;
+    struct timespec ts;
+    ts.tv_sec = scheduled / 1000000000;
+    ts.tv_nsec = scheduled % 1000000000;
+    while( clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL) == EINTR );
+
+    std::vector<char> request;
+    for(;;){
+        uint64_t now = get_time_ns();
+        if( now >= EndTime ) break;
+
+        if( interval > 0 ){
+            // wait for the scheduled time, late requests are sent immediately
+            if( now < scheduled ){
+                ts.tv_sec = scheduled / 1000000000;
+                ts.tv_nsec = scheduled % 1000000000;
+                while( clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL) == EINTR );
+            }
+        }
+
+        // select request type
+        unsigned w = rand_r(&worker.Seed) % MixTotal;
+        size_t mi = 0;
+        while( MixWeights[mi] <= w ) mi++;
+        size_t ti = MixTypes[mi];
+
+        SMessage msg;
+        size_t extra_len;
+        prepare_request(worker,ti,msg,extra_len);
+        if( extra_len > 0 ) request.assign(worker.Extra.begin(),worker.Extra.begin() + extra_len);
+
+        // latency of open loop includes the delay of late requests
+        uint64_t stime = interval > 0 ? scheduled : get_time_ns();
+        int ret = exchange(worker,msg,extra_len > 0 ? &request[0] : NULL,extra_len);
+        uint64_t etime = get_time_ns();
+        if( interval > 0 ) scheduled += interval;
+
+        SLatency& stat = worker.Stat[ti];
+        if( ret != 0 ){
+            stat.Errors++;
+            continue;
+        }
+        if( msg.Type == MSG_INVALID ) stat.Invalid++;
+        process_response(worker,ti,msg);
+
+        uint64_t latency = etime > stime ? etime - stime : 0;
+        stat.Buckets[get_bucket(latency)]++;
+        stat.Count++;
+        if( latency > stat.Max ) stat.Max = latency;
+    }
+
+    if( worker.Socket >= 0 ) close(worker.Socket);
+    return(NULL);
+}
+
+// -----------------------------------------------------------------------------
+
+size_t get_bucket(uint64_t ns)
+{
+    if( ns < 2*HIST_SUB ) return(ns);
+    int shift = 63 - __builtin_clzll(ns) - HIST_SUB_BITS;
+    size_t bucket = (size_t)shift*HIST_SUB + (ns >> shift);
+    if( bucket >= HIST_SIZE ) bucket = HIST_SIZE - 1;
+    return(bucket);
+}
+
+// -----------------------------------------------------------------------------
+
+// the middle of the bucket
+uint64_t get_bucket_value(size_t bucket)
+{
+    if( bucket < 2*HIST_SUB ) return(bucket);
+    int shift = bucket / HIST_SUB - 1;
+    uint64_t low = (uint64_t)(bucket % HIST_SUB + HIST_SUB) << shift;
+    return(low + ((uint64_t)1 << shift)/2);
+}
+
+// -----------------------------------------------------------------------------
+
+uint64_t get_percentile(const SLatency& stat,double q)
+{
+    if( stat.Count == 0 ) return(0);
+
+    uint64_t rank = (uint64_t)(q*stat.Count + 0.5);
+    if( rank < 1 ) rank = 1;
+    if( rank > stat.Count ) rank = stat.Count;
+
+    uint64_t count = 0;
+    for(size_t i=0; i < stat.Buckets.size(); i++){
+        count += stat.Buckets[i];
+        if( count >= rank ){
+            uint64_t value = get_bucket_value(i);
+            return(value < stat.Max ? value : stat.Max);
+        }
+    }
+    return(stat.Max);
+}
+
+// -----------------------------------------------------------------------------
+
+void init_latency(SLatency& stat)
+{
+    stat.Buckets.assign(HIST_SIZE,0);
+    stat.Count = 0;
+    stat.Invalid = 0;
+    stat.Errors = 0;
+    stat.Max = 0;
+}
+
+// -----------------------------------------------------------------------------
+
+void merge_latency(SLatency& dest,const SLatency& src)
+{
+    for(size_t i=0; i < HIST_SIZE; i++) dest.Buckets[i] += src.Buckets[i];
+    dest.Count += src.Count;
+    dest.Invalid += src.Invalid;
+    dest.Errors += src.Errors;
+    if( src.Max > dest.Max ) dest.Max = src.Max;
+}
+
+// -----------------------------------------------------------------------------
+
+void print_line(const char* p_name,const SLatency& stat,double elapsed)
+{
+    fprintf(Report,"%-22s %10lu %11.0f %9.1f %9.1f %9.1f %9.1f %9lu %7lu\n",p_name,
+           (unsigned long)stat.Count,stat.Count/elapsed,
+           get_percentile(stat,0.50)*1e-3,get_percentile(stat,0.99)*1e-3,
+           get_percentile(stat,0.999)*1e-3,stat.Max*1e-3,
+           (unsigned long)stat.Invalid,(unsigned long)stat.Errors);
+}
+
+// -----------------------------------------------------------------------------
+
+void print_results(const std::vector<SLatency>& stats,const SLatency& total,double elapsed)
+{
+    fprintf(Report,"# latency in us, invalid - requests rejected by the daemon, errors - failed exchanges\n");
+    fprintf(Report,"%-22s %10s %11s %9s %9s %9s %9s %9s %7s\n","# type","requests","req/s","p50","p99","p99.9","max","invalid","errors");
+    for(size_t k=0; k < NumOfRequestTypes; k++){
+        if( (stats[k].Count == 0) && (stats[k].Errors == 0) ) continue;
+        print_line(RequestTypes[k].Name,stats[k],elapsed);
+    }
+    print_line("total",total,elapsed);
+}
+
+// -----------------------------------------------------------------------------
+
+std::string escape_json(const std::string& str)
+{
+    std::string result;
+    for(size_t i=0; i < str.size(); i++){
+        unsigned char c = str[i];
+        if( (c == '"') || (c == '\\') ){
+            result += '\\';
+            result += c;
+        } else if( c < 0x20 ){
+            char buffer[8];
+            snprintf(buffer,sizeof(buffer),"\\u%04x",c);
+            result += buffer;
+        } else {
+            result += c;
+        }
+    }
+    return(result);
+}
+
+// -----------------------------------------------------------------------------
+
+void write_json_stat(FILE* p_fout,const SLatency& stat,double elapsed)
+{
+    fprintf(p_fout,"\"requests\": %lu, \"throughput\": %.1f, \"p50_us\": %.3f, \"p99_us\": %.3f, "
+            "\"p999_us\": %.3f, \"max_us\": %.3f, \"invalid\": %lu, \"errors\": %lu",
+            (unsigned long)stat.Count,stat.Count/elapsed,
+            get_percentile(stat,0.50)*1e-3,get_percentile(stat,0.99)*1e-3,
+            get_percentile(stat,0.999)*1e-3,stat.Max*1e-3,
+            (unsigned long)stat.Invalid,(unsigned long)stat.Errors);
+}
+
+// -----------------------------------------------------------------------------
+
+bool write_json(const char* p_name,const std::vector<SLatency>& stats,const SLatency& total,double elapsed)
+{
+    bool to_stdout = strcmp(p_name,"-") == 0;
+    FILE* p_fout = to_stdout ? stdout : fopen(p_name,"w");
+    if( p_fout == NULL ) return(false);
+
+    fprintf(p_fout,"{\n");
+    fprintf(p_fout,"  \"socket\": \"%s\",\n",escape_json(SocketName).c_str());
+    fprintf(p_fout,"  \"threads\": %d,\n",NumOfThreads);
+    fprintf(p_fout,"  \"mode\": \"%s\",\n",Rate > 0 ? "open" : "closed");
+    fprintf(p_fout,"  \"rate\": %d,\n",Rate);
+    fprintf(p_fout,"  \"duration\": %.3f,\n",elapsed);
+    fprintf(p_fout,"  \"types\": {\n");
+    bool first = true;
+    for(size_t k=0; k < NumOfRequestTypes; k++){
+        if( (stats[k].Count == 0) && (stats[k].Errors == 0) ) continue;
+        if( ! first ) fprintf(p_fout,",\n");
+        first = false;
+        fprintf(p_fout,"    \"%s\": { ",RequestTypes[k].Name);
+        write_json_stat(p_fout,stats[k],elapsed);
+        fprintf(p_fout," }");
+    }
+    fprintf(p_fout,"\n  },\n");
+    fprintf(p_fout,"  \"total\": { ");
+    write_json_stat(p_fout,total,elapsed);
+    fprintf(p_fout," }\n");
+    fprintf(p_fout,"}\n");
+
+    if( to_stdout ) return(fflush(stdout) == 0);
+    return(fclose(p_fout) == 0);
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,107 @@
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type 
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+// =============================================================================
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "common.h"
+#include "MetaNFS4BenchOptions.hpp"
+#include <ErrorSystem.hpp>
+
+//==============================================================================
+//------------------------------------------------------------------------------
+//==============================================================================
+
+CMetaNFS4BenchOptions::CMetaNFS4BenchOptions(void)
+{
+    SetShowMiniUsage(true);
+    IsError = false;
+}
+
+//------------------------------------------------------------------------------
+
+int CMetaNFS4BenchOptions::CheckOptions(void)
+{
+    if( GetOptThreads() <= 0 ){
+        fprintf(stderr,"metanfs4-bench: the number of threads must be greater than zero\n");
+        IsError = true;
+        return(SO_OPTS_ERROR);
+    }
+    if( GetOptDuration() <= 0 ){
+        fprintf(stderr,"metanfs4-bench: the duration must be greater than zero\n");
+        IsError = true;
+        return(SO_OPTS_ERROR);
+    }
+    if( GetOptRate() < 0 ){
+        fprintf(stderr,"metanfs4-bench: the rate must not be negative\n");
+        IsError = true;
+        return(SO_OPTS_ERROR);
+    }
+    if( (GetOptBatch() <= 0) || (GetOptBatch() > MAX_BATCH) ){
+        fprintf(stderr,"metanfs4-bench: the batch size must be in the range 1-%d\n",MAX_BATCH);
+        IsError = true;
+        return(SO_OPTS_ERROR);
+    }
+    if( GetOptNames() <= 0 ){
+        fprintf(stderr,"metanfs4-bench: the number of names must be greater than zero\n");
+        IsError = true;
+        return(SO_OPTS_ERROR);
+    }
+    if( (GetOptProtocol() < 1) || (GetOptProtocol() > PROTOCOL_VERSION) ){
+        fprintf(stderr,"metanfs4-bench: the protocol version must be in the range 1-%d\n",PROTOCOL_VERSION);
+        IsError = true;
+        return(SO_OPTS_ERROR);
+    }
+    return(SO_CONTINUE);
+}
+
+//------------------------------------------------------------------------------
+
+int CMetaNFS4BenchOptions::FinalizeOptions(void)
+{
+    bool ret_opt = false;
+
+    if( GetOptHelp() == true ) {
+        PrintUsage();
+        ret_opt = true;
+    }
+
+    if( GetOptVersion() == true ) {
+        PrintVersion();
+        ret_opt = true;
+    }
+
+    if( ret_opt == true ) {
+        printf("\n");
+        return(SO_EXIT);
+    }
+
+    return(SO_CONTINUE);
+}
+
+//------------------------------------------------------------------------------
+
+int CMetaNFS4BenchOptions::CheckArguments(void)
+{
+    return(SO_CONTINUE);
+}
+
+//==============================================================================
+//------------------------------------------------------------------------------
+//==============================================================================
@@ -0,0 +1,200 @@
+#ifndef MetaNFS4BenchOptionsH
+#define MetaNFS4BenchOptionsH
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include <SimpleOptions.hpp>
+
+//------------------------------------------------------------------------------
+
+class CMetaNFS4BenchOptions : public CSimpleOptions {
+public:
+    // constructor - tune option setup
+    CMetaNFS4BenchOptions(void);
+
+    CSO_PROG_NAME_BEGIN
+    "metanfs4-bench"
+    CSO_PROG_NAME_END
+
+    CSO_PROG_DESC_BEGIN
+    "Generate load on the metanfs4d daemon and measure throughput and latency\n"
+    "of individual requests. Each thread uses its own connection. Requests are\n"
+    "sent back-to-back (closed loop) or at the given total rate (open loop), in\n"
+    "which case the latency is measured from the scheduled send time.\n"
+    "\n"
+    "The mix is a comma separated list of type:weight items, supported types are\n"
+    "reg_name, reg_group, user_to_local_domain, group_to_local_domain, name_to_id,\n"
+    "id_to_name, group_to_id, id_to_group, enum_name, enum_group, princ_to_id,\n"
+    "princ_to_groups, lookup_batch, user_to_groups, enum_users, enum_groups, hello,\n"
+    "uid_to_name, gid_to_name, name_to_uid, name_to_gid, enum_users_v2,\n"
+    "enum_groups_v2, and lookup_batch_v2. Lookups use names and ids enumerated\n"
+    "from the daemon at the start. Each connection negotiates the protocol version\n"
+    "by MSG_HELLO, v1 framing is used with daemons that do not support it.\n"
+    "Note that reg_name and reg_group permanently register new names and\n"
+    "require root."
+    CSO_PROG_DESC_END
+
+    CSO_PROG_ARGS_SHORT_DESC_BEGIN
+    ""
+    CSO_PROG_ARGS_SHORT_DESC_END
+
+    CSO_PROG_ARGS_LONG_DESC_BEGIN
+    ""
+    CSO_PROG_ARGS_LONG_DESC_END
+
+    CSO_PROG_VERS_BEGIN
+    "2.0"
+    CSO_PROG_VERS_END
+
+    CSO_LIST_BEGIN
+    // options ------------------------------
+    CSO_OPT(CSmallString,Socket)
+    CSO_OPT(CSmallString,Mix)
+    CSO_OPT(int,Threads)
+    CSO_OPT(int,Duration)
+    CSO_OPT(int,Rate)
+    CSO_OPT(int,Batch)
+    CSO_OPT(int,Names)
+    CSO_OPT(int,Protocol)
+    CSO_OPT(CSmallString,Domain)
+    CSO_OPT(CSmallString,JSON)
+    CSO_OPT(bool,Help)
+    CSO_OPT(bool,Version)
+    CSO_LIST_END
+
+    CSO_MAP_BEGIN
+    CSO_MAP_OPT(CSmallString,                   /* option type */
+                Socket,                         /* option name */
+                "/var/run/metanfs4/metanfs4d.sock", /* default value */
+                false,                          /* is option mandatory */
+                's',                           /* short option name */
+                "socket",                       /* long option name */
+                "PATH",                         /* parametr name */
+                "socket of the daemon")         /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(CSmallString,                   /* option type */
+                Mix,                            /* option name */
+                "id_to_name:25,name_to_id:25,id_to_group:25,group_to_id:25", /* default value */
+                false,                          /* is option mandatory */
+                'm',                           /* short option name */
+                "mix",                          /* long option name */
+                "MIX",                          /* parametr name */
+                "mix of request types in the form type:weight,...")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(int,                            /* option type */
+                Threads,                        /* option name */
+                4,                              /* default value */
+                false,                          /* is option mandatory */
+                't',                           /* short option name */
+                "threads",                      /* long option name */
+                "NUMBER",                       /* parametr name */
+                "number of concurrent client threads")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(int,                            /* option type */
+                Duration,                       /* option name */
+                10,                             /* default value */
+                false,                          /* is option mandatory */
+                'd',                           /* short option name */
+                "duration",                     /* long option name */
+                "SECONDS",                      /* parametr name */
+                "duration of the measurement")  /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(int,                            /* option type */
+                Rate,                           /* option name */
+                0,                              /* default value */
+                false,                          /* is option mandatory */
+                'r',                           /* short option name */
+                "rate",                         /* long option name */
+                "NUMBER",                       /* parametr name */
+                "total number of requests per second (open loop), 0 - closed loop")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(int,                            /* option type */
+                Batch,                          /* option name */
+                16,                             /* default value */
+                false,                          /* is option mandatory */
+                'b',                           /* short option name */
+                "batch",                        /* long option name */
+                "NUMBER",                       /* parametr name */
+                "number of queries in one lookup_batch request")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(int,                            /* option type */
+                Names,                          /* option name */
+                10000,                          /* default value */
+                false,                          /* is option mandatory */
+                'n',                           /* short option name */
+                "names",                        /* long option name */
+                "NUMBER",                       /* parametr name */
+                "max number of users and groups enumerated for lookups")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(int,                            /* option type */
+                Protocol,                       /* option name */
+                3,                              /* default value */
+                false,                          /* is option mandatory */
+                'p',                           /* short option name */
+                "protocol",                     /* long option name */
+                "NUMBER",                       /* parametr name */
+                "the highest protocol version used (1-3)")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(CSmallString,                   /* option type */
+                Domain,                         /* option name */
+                "BENCH",                        /* default value */
+                false,                          /* is option mandatory */
+                '\0',                           /* short option name */
+                "domain",                       /* long option name */
+                "NAME",                         /* parametr name */
+                "domain of names registered by reg_name and reg_group")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(CSmallString,                   /* option type */
+                JSON,                           /* option name */
+                NULL,                           /* default value */
+                false,                          /* is option mandatory */
+                'j',                           /* short option name */
+                "json",                         /* long option name */
+                "FILE",                         /* parametr name */
+                "write results also in the JSON format into the file, - is the standard output")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(bool,                           /* option type */
+                Version,                        /* option name */
+                false,                          /* default value */
+                false,                          /* is option mandatory */
+                '\0',                           /* short option name */
+                "version",                      /* long option name */
+                NULL,                           /* parametr name */
+                "output version information and exit")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(bool,                           /* option type */
+                Help,                        /* option name */
+                false,                          /* default value */
+                false,                          /* is option mandatory */
+                'h',                           /* short option name */
+                "help",                      /* long option name */
+                NULL,                           /* parametr name */
+                "display this help and exit")   /* option description */
+    CSO_MAP_END
+
+private:
+    virtual int CheckOptions(void);
+    virtual int FinalizeOptions(void);
+    virtual int CheckArguments(void);
+    bool    IsError;
+};
+
+//------------------------------------------------------------------------------
+
+#endif
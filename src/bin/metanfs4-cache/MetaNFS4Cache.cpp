@@ -0,0 +1,86 @@
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type 
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+// =============================================================================
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <string>
+#include "CacheFile.hpp"
+#include "MetaNFS4CacheOptions.hpp"
+
+// -----------------------------------------------------------------------------
+
+// monotonic time in seconds
+double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec + ts.tv_nsec*1e-9);
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc,char* argv[])
+{
+    CMetaNFS4CacheOptions options;
+
+    // encode program options
+    int result = options.ParseCmdLine(argc,argv);
+
+    // should we exit or was it error?
+    if( result == SO_EXIT ) return(0);
+    if( result != SO_CONTINUE ) return(1);
+
+    CNameTable      users;
+    CNameTable      groups;
+    ECacheFormat    format;
+
+    double stime = get_time();
+    if( LoadCacheFile(options.GetArgInput(),users,groups,format) == false ){
+        fprintf(stderr,"metanfs4-cache: unable to read the cache %s (%s)\n",(const char*)options.GetArgInput(),strerror(errno));
+        return(1);
+    }
+    double etime = get_time();
+
+    if( options.GetOptInfo() ){
+        printf("format:     %s\n",format == CACHE_BINARY ? "binary" : "text");
+        printf("users:      %lu (top id %u)\n",(unsigned long)users.GetNumOfItems(),users.GetTopID());
+        printf("groups:     %lu (top id %u)\n",(unsigned long)groups.GetNumOfItems(),groups.GetTopID());
+        printf("load time:  %.3f s\n",etime-stime);
+        return(0);
+    }
+
+    std::string image;
+    if( options.GetOptText() ){
+        WriteTextCache(image,users,groups);
+    } else {
+        WriteBinaryCache(image,users,groups);
+    }
+
+    if( SaveCacheFile(options.GetArgOutput(),image) == false ){
+        fprintf(stderr,"metanfs4-cache: unable to write the cache %s (%s)\n",(const char*)options.GetArgOutput(),strerror(errno));
+        return(1);
+    }
+
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,132 @@
+#ifndef MetaNFS4CacheOptionsH
+#define MetaNFS4CacheOptionsH
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type 
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include <SimpleOptions.hpp>
+
+//------------------------------------------------------------------------------
+
+class CMetaNFS4CacheOptions : public CSimpleOptions {
+public:
+    // constructor - tune option setup
+    CMetaNFS4CacheOptions(void);
+
+// program name and description -----------------------------------------------
+    CSO_PROG_NAME_BEGIN
+    "metanfs4-cache"
+    CSO_PROG_NAME_END
+
+    CSO_PROG_DESC_BEGIN
+    "Convert the metanfs4d cache between the text and binary formats.\n"
+    "The input format is detected automatically. The output is written into\n"
+    "a temporary file, which is then renamed to the output name."
+    CSO_PROG_DESC_END
+
+    CSO_PROG_ARGS_SHORT_DESC_BEGIN
+    "input [output]"
+    CSO_PROG_ARGS_SHORT_DESC_END
+
+    CSO_PROG_ARGS_LONG_DESC_BEGIN
+    "Arguments:\n"
+    "   input       the cache to read\n"
+    "   output      the converted cache, it is not required with --info"
+    CSO_PROG_ARGS_LONG_DESC_END
+
+    CSO_PROG_VERS_BEGIN
+    "2.0"
+    CSO_PROG_VERS_END
+
+// list of all options and arguments ------------------------------------------
+    CSO_LIST_BEGIN
+    // arguments ----------------------------
+    CSO_ARG(CSmallString,Input)
+    CSO_ARG(CSmallString,Output)
+    // options ------------------------------
+    CSO_OPT(bool,Text)
+    CSO_OPT(bool,Info)
+    CSO_OPT(bool,Help)
+    CSO_OPT(bool,Version)
+    CSO_LIST_END
+
+    CSO_MAP_BEGIN
+// description of arguments ---------------------------------------------------
+    CSO_MAP_ARG(CSmallString,                   /* argument type */
+                Input,                          /* argument name */
+                NULL,                           /* default value */
+                true,                           /* is argument mandatory */
+                "input",                        /* parametr name */
+                "the cache to read")            /* argument description */
+    //----------------------------------------------------------------------
+    CSO_MAP_ARG(CSmallString,                   /* argument type */
+                Output,                         /* argument name */
+                NULL,                           /* default value */
+                false,                          /* is argument mandatory */
+                "output",                       /* parametr name */
+                "the converted cache")          /* argument description */
+// description of options -----------------------------------------------------
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(bool,                           /* option type */
+                Text,                           /* option name */
+                false,                          /* default value */
+                false,                          /* is option mandatory */
+                't',                           /* short option name */
+                "text",                         /* long option name */
+                NULL,                           /* parametr name */
+                "write the output in the text format instead of the binary format")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(bool,                           /* option type */
+                Info,                           /* option name */
+                false,                          /* default value */
+                false,                          /* is option mandatory */
+                'i',                           /* short option name */
+                "info",                         /* long option name */
+                NULL,                           /* parametr name */
+                "print the format, number of records and load time of the input")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(bool,                           /* option type */
+                Version,                        /* option name */
+                false,                          /* default value */
+                false,                          /* is option mandatory */
+                '\0',                           /* short option name */
+                "version",                      /* long option name */
+                NULL,                           /* parametr name */
+                "output version information and exit")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(bool,                           /* option type */
+                Help,                        /* option name */
+                false,                          /* default value */
+                false,                          /* is option mandatory */
+                'h',                           /* short option name */
+                "help",                      /* long option name */
+                NULL,                           /* parametr name */
+                "display this help and exit")   /* option description */
+    CSO_MAP_END
+
+// final operation with options ------------------------------------------------
+private:
+    virtual int CheckOptions(void);
+    virtual int FinalizeOptions(void);
+    virtual int CheckArguments(void);
+    bool    IsError;
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,196 @@
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+// =============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <metanfs4client.hpp>
+#include "MetaNFS4ClientBenchOptions.hpp"
+
+// -----------------------------------------------------------------------------
+
+// setup
+uid_t   FirstUID    = 5000001;
+int     Range       = 1000;
+int     Lookups     = 100000;
+int     Depth       = 256;
+
+// names found by getpwuid_r(), they are compared with results of the client
+std::vector<std::string>    Names;
+
+// -----------------------------------------------------------------------------
+
+uint64_t get_time_ns(void);
+bool run_getpwuid(uint64_t& time,int& found);
+bool run_client(uint64_t& time,int& found,int& mismatches);
+void print_result(const char* p_method,uint64_t time,int found);
+
+// -----------------------------------------------------------------------------
+
+int main(int argc,char* argv[])
+{
+    CMetaNFS4ClientBenchOptions options;
+
+    // encode program options
+    int result = options.ParseCmdLine(argc,argv);
+
+    // should we exit or was it error?
+    if( result == SO_EXIT ) return(0);
+    if( result != SO_CONTINUE ) return(1);
+
+    FirstUID = options.GetOptFirst();
+    Range = options.GetOptRange();
+    Lookups = options.GetOptLookups();
+    Depth = options.GetOptDepth();
+
+    printf("# uids:     %u-%u\n",FirstUID,FirstUID + Range - 1);
+    printf("# lookups:  %d per method, %d requests in flight\n",Lookups,Depth);
+    fflush(stdout);
+
+    uint64_t seq_time;
+    int      seq_found;
+    if( run_getpwuid(seq_time,seq_found) == false ) return(1);
+
+    uint64_t async_time;
+    int      async_found;
+    int      mismatches;
+    if( run_client(async_time,async_found,mismatches) == false ) return(1);
+
+    print_result("getpwuid_r",seq_time,seq_found);
+    print_result("metanfs4client",async_time,async_found);
+    if( async_time > 0 ) printf("# speedup:  %.2f\n",(double)seq_time/(double)async_time);
+    if( mismatches > 0 ){
+        printf("# WARNING: %d results differ from getpwuid_r\n",mismatches);
+        return(1);
+    }
+
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+
+uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return((uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec);
+}
+
+// -----------------------------------------------------------------------------
+
+bool run_getpwuid(uint64_t& time,int& found)
+{
+    std::vector<char> buffer(16384);
+    struct passwd     pwd;
+    struct passwd*    p_pwd;
+
+    Names.assign(Range,std::string());
+    found = 0;
+
+    uint64_t start = get_time_ns();
+    for(int i=0; i < Lookups; i++){
+        int index = i % Range;
+        int ret = getpwuid_r(FirstUID + index,&pwd,&buffer[0],buffer.size(),&p_pwd);
+        if( ret == ERANGE ){
+            buffer.resize(2*buffer.size());
+            i--;
+            continue;
+        }
+        if( (ret == 0) && (p_pwd != NULL) ){
+            found++;
+            if( i < Range ) Names[index] = p_pwd->pw_name;
+        }
+    }
+    time = get_time_ns() - start;
+
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+bool run_client(uint64_t& time,int& found,int& mismatches)
+{
+    CMetaNFS4Client client;
+
+    if( client.Open(Depth) == false ){
+        fprintf(stderr,"metanfs4-client-bench: unable to contact the daemon (%s)\n",strerror(errno));
+        return(false);
+    }
+
+    found = 0;
+    mismatches = 0;
+
+    uint64_t start = get_time_ns();
+    int submitted = 0;
+    int completed = 0;
+    while( completed < Lookups ){
+        // keep the pipeline full, the tag is the index of the lookup
+        while( (submitted < Lookups) && (client.GetNumOfPending() < (size_t)Depth) ){
+            if( client.GetPwUID(submitted,FirstUID + submitted % Range) != 0 ){
+                fprintf(stderr,"metanfs4-client-bench: unable to submit request\n");
+                return(false);
+            }
+            submitted++;
+        }
+
+        struct SNFS4Completion comp;
+        bool any = false;
+        while( client.Next(comp) ){
+            any = true;
+            completed++;
+            if( comp.Status == EIO ){
+                fprintf(stderr,"metanfs4-client-bench: connection to the daemon failed\n");
+                return(false);
+            }
+            std::string name;
+            if( comp.Status == 0 ){
+                found++;
+                name = comp.Name;
+            }
+            if( name != Names[comp.Tag % Range] ) mismatches++;
+        }
+        if( (any == false) && (client.Wait(1000) < 0) ){
+            fprintf(stderr,"metanfs4-client-bench: unable to wait for responses (%s)\n",strerror(errno));
+            return(false);
+        }
+    }
+    time = get_time_ns() - start;
+
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+void print_result(const char* p_method,uint64_t time,int found)
+{
+    double seconds = (double)time/1e9;
+    printf("%-16s %10d lookups %10d found %10.3f s %12.0f lookups/s %8.2f us/lookup\n",
+           p_method,Lookups,found,seconds,seconds > 0 ? Lookups/seconds : 0.0,
+           (double)time/1e3/Lookups);
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,130 @@
+#ifndef MetaNFS4ClientBenchOptionsH
+#define MetaNFS4ClientBenchOptionsH
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include <SimpleOptions.hpp>
+
+//------------------------------------------------------------------------------
+
+class CMetaNFS4ClientBenchOptions : public CSimpleOptions {
+public:
+    // constructor - tune option setup
+    CMetaNFS4ClientBenchOptions(void);
+
+    CSO_PROG_NAME_BEGIN
+    "metanfs4-client-bench"
+    CSO_PROG_NAME_END
+
+    CSO_PROG_DESC_BEGIN
+    "Compare throughput of uid lookups done by sequential getpwuid_r() calls and\n"
+    "by the asynchronous client library (libmetanfs4client) with many requests\n"
+    "in flight over one connection. Uids are taken cyclically from the range\n"
+    "starting at the first uid. getpwuid_r() resolves them through nsswitch,\n"
+    "thus metanfs4 must be configured in /etc/nsswitch.conf."
+    CSO_PROG_DESC_END
+
+    CSO_PROG_ARGS_SHORT_DESC_BEGIN
+    ""
+    CSO_PROG_ARGS_SHORT_DESC_END
+
+    CSO_PROG_ARGS_LONG_DESC_BEGIN
+    ""
+    CSO_PROG_ARGS_LONG_DESC_END
+
+    CSO_PROG_VERS_BEGIN
+    "2.0"
+    CSO_PROG_VERS_END
+
+    CSO_LIST_BEGIN
+    // options ------------------------------
+    CSO_OPT(int,First)
+    CSO_OPT(int,Range)
+    CSO_OPT(int,Lookups)
+    CSO_OPT(int,Depth)
+    CSO_OPT(bool,Help)
+    CSO_OPT(bool,Version)
+    CSO_LIST_END
+
+    CSO_MAP_BEGIN
+    CSO_MAP_OPT(int,                            /* option type */
+                First,                          /* option name */
+                5000001,                        /* default value */
+                false,                          /* is option mandatory */
+                'f',                           /* short option name */
+                "first",                        /* long option name */
+                "UID",                          /* parametr name */
+                "the first looked up uid")      /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(int,                            /* option type */
+                Range,                          /* option name */
+                1000,                           /* default value */
+                false,                          /* is option mandatory */
+                'r',                           /* short option name */
+                "range",                        /* long option name */
+                "NUMBER",                       /* parametr name */
+                "number of distinct uids")      /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(int,                            /* option type */
+                Lookups,                        /* option name */
+                100000,                         /* default value */
+                false,                          /* is option mandatory */
+                'n',                           /* short option name */
+                "lookups",                      /* long option name */
+                "NUMBER",                       /* parametr name */
+                "number of lookups done by each method")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(int,                            /* option type */
+                Depth,                          /* option name */
+                256,                            /* default value */
+                false,                          /* is option mandatory */
+                'd',                           /* short option name */
+                "depth",                        /* long option name */
+                "NUMBER",                       /* parametr name */
+                "max number of requests in flight")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(bool,                           /* option type */
+                Version,                        /* option name */
+                false,                          /* default value */
+                false,                          /* is option mandatory */
+                '\0',                           /* short option name */
+                "version",                      /* long option name */
+                NULL,                           /* parametr name */
+                "output version information and exit")   /* option description */
+    //----------------------------------------------------------------------
+    CSO_MAP_OPT(bool,                           /* option type */
+                Help,                        /* option name */
+                false,                          /* default value */
+                false,                          /* is option mandatory */
+                'h',                           /* short option name */
+                "help",                      /* long option name */
+                NULL,                           /* parametr name */
+                "display this help and exit")   /* option description */
+    CSO_MAP_END
+
+private:
+    virtual int CheckOptions(void);
+    virtual int FinalizeOptions(void);
+    virtual int CheckArguments(void);
+    bool    IsError;
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -1,10 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 extern "C" {
+#include <common.h>
 #include <metanfs4_nsswitch.h>
 #include <metanfs4_idmap.h>
+#include <metanfs4client.h>
 }
 
 // -----------------------------------------------------------------------------
@@ -143,10 +146,83 @@ void test_getgrgid(gid_t gid,size_t buflen)
 
 // -----------------------------------------------------------------------------
 
+void test_lookup_batch(void)
+{
+    struct SNFS4BatchItem   items[2*MAX_BATCH+3];
+    size_t                  count = sizeof(items)/sizeof(items[0]);
+
+    struct SNFS4Client* p_client = metanfs4_client_open(0);
+    if( p_client == NULL ){
+        printf("batch: unable to connect (%s)\n",strerror(errno));
+        return;
+    }
+
+    memset(items,0,sizeof(items));
+    for(size_t i=0; i < count; i++){
+        switch(i % 4){
+            case 0:
+                items[i].Type = METANFS4_GETPWUID;
+                items[i].ID = 5000000 + i;
+            break;
+            case 1:
+                items[i].Type = METANFS4_GETPWNAM;
+                items[i].Name = "kulhanek@META";
+            break;
+            case 2:
+                items[i].Type = METANFS4_GETGRGID;
+                items[i].ID = 5000000 + i;
+            break;
+            case 3:
+                items[i].Type = METANFS4_GETGRNAM;
+                items[i].Name = "kulhanek@META";
+            break;
+        }
+    }
+
+    int resolved = metanfs4_client_lookup_batch(p_client,items,count);
+    printf("batch: %d of %d resolved\n",resolved,(int)count);
+    for(size_t i=0; i < count; i++){
+        if( items[i].Status == 0 ){
+            printf("%d %s %d %d\n",items[i].Type,items[i].Name,items[i].ID,items[i].GID);
+        }
+    }
+
+    metanfs4_client_close(p_client);
+}
+
+// -----------------------------------------------------------------------------
+
+void test_initgroups(const char* name,gid_t group,long int limit)
+{
+    long int    start = 1;
+    long int    size = 1;
+    int         errnop;
+    gid_t*      groups;
+    NSS_STATUS  ret;
+
+    groups = (gid_t*)malloc(size*sizeof(gid_t));
+    if( groups == NULL ) return;
+    groups[0] = group;
+
+    ret = _nss_metanfs4_initgroups_dyn(name,group,&start,&size,&groups,limit,&errnop);
+    printf("initgroups: %s (%d):",name,ret);
+    for(long int i=0; i < start; i++){
+        printf(" %d",groups[i]);
+    }
+    printf("\n");
+
+    free(groups);
+}
+
+// -----------------------------------------------------------------------------
+
 int main(int argc, char* argv[])
 {
     test_pwent();
     test_grent();
+    test_lookup_batch();
+    test_initgroups("kulhanek@META",5000001,0);
+    test_initgroups("kulhanek@META",5000001,2);
 
     for(size_t buflen = 0; buflen < 100000; buflen+=1024){
         test_getpwnam("kulhanek@META",buflen);
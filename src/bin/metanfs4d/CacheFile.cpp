@@ -0,0 +1,251 @@
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type 
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+// =============================================================================
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <ctype.h>
+#include "CacheFile.hpp"
+
+//==============================================================================
+//------------------------------------------------------------------------------
+//==============================================================================
+
+bool LoadCacheFile(const char* p_name,CNameTable& users,CNameTable& groups,ECacheFormat& format)
+{
+    users.Clear();
+    groups.Clear();
+    format = CACHE_TEXT;
+
+    int fd = open(p_name,O_RDONLY | O_CLOEXEC);
+    if( fd < 0 ) return(false);
+
+    struct stat my_stat;
+    if( fstat(fd,&my_stat) != 0 ){
+        int err = errno;
+        close(fd);
+        errno = err;
+        return(false);
+    }
+    if( my_stat.st_size == 0 ){
+        close(fd);
+        return(true);
+    }
+
+    // the cache is not copied, tables are built directly from the mapping
+    size_t size = my_stat.st_size;
+    void* p_data = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+    int err = errno;
+    close(fd);
+    if( p_data == MAP_FAILED ){
+        errno = err;
+        return(false);
+    }
+    madvise(p_data,size,MADV_SEQUENTIAL);
+
+    bool result;
+    if( (size >= sizeof(struct SCacheHeader)) && (memcmp(p_data,CACHE_MAGIC,sizeof(CACHE_MAGIC)) == 0) ){
+        format = CACHE_BINARY;
+        result = ReadBinaryCache((const char*)p_data,size,users,groups);
+    } else {
+        result = ReadTextCache((const char*)p_data,size,users,groups);
+    }
+
+    munmap(p_data,size);
+
+    if( result == false ) errno = EINVAL;
+    return(result);
+}
+
+//------------------------------------------------------------------------------
+
+bool ReadTextCache(const char* p_data,size_t size,CNameTable& users,CNameTable& groups)
+{
+    const char* p_end = p_data + size;
+
+    // records are whitespace separated triplets: type name id,
+    // reading is stopped by the first malformed record
+    for(;;){
+        while( (p_data < p_end) && isspace(*p_data) ) p_data++;
+        if( p_data == p_end ) break;
+        char type = *p_data++;
+
+        while( (p_data < p_end) && isspace(*p_data) ) p_data++;
+        const char* p_name = p_data;
+        while( (p_data < p_end) && ! isspace(*p_data) ) p_data++;
+        if( p_name == p_data ) break;
+        std::string name(p_name,p_data);
+
+        while( (p_data < p_end) && isspace(*p_data) ) p_data++;
+        if( (p_data == p_end) || ! isdigit(*p_data) ) break;
+        uint64_t nid = 0;
+        while( (p_data < p_end) && isdigit(*p_data) ){
+            nid = 10*nid + (*p_data - '0');
+            if( nid > 0xFFFFFFFFUL ) return(true);
+            p_data++;
+        }
+
+        if( (type == 'n') && (nid > 0) ) users.Add(name,nid);
+        if( (type == 'g') && (nid > 0) ) groups.Add(name,nid);
+    }
+
+    return(true);
+}
+
+//------------------------------------------------------------------------------
+
+bool ReadBinaryCache(const char* p_data,size_t size,CNameTable& users,CNameTable& groups)
+{
+    if( size < sizeof(struct SCacheHeader) ) return(false);
+
+    struct SCacheHeader header;
+    memcpy(&header,p_data,sizeof(header));
+
+    if( memcmp(header.Magic,CACHE_MAGIC,sizeof(CACHE_MAGIC)) != 0 ) return(false);
+    if( header.Version != CACHE_VERSION ) return(false);
+    if( header.Size > size ) return(false);
+
+    // images must be aligned and inside the cache
+    if( (header.Users % 8 != 0) || (header.Groups % 8 != 0) ) return(false);
+    if( (header.Users > header.Size) || (header.UsersSize > header.Size - header.Users) ) return(false);
+    if( (header.Groups > header.Size) || (header.GroupsSize > header.Size - header.Groups) ) return(false);
+
+    if( (users.LoadImage(p_data + header.Users,header.UsersSize) == false) ||
+        (groups.LoadImage(p_data + header.Groups,header.GroupsSize) == false) ){
+        users.Clear();
+        groups.Clear();
+        return(false);
+    }
+
+    return(true);
+}
+
+//==============================================================================
+//------------------------------------------------------------------------------
+//==============================================================================
+
+void WriteTextCache(std::string& image,const CNameTable& users,const CNameTable& groups)
+{
+    char buffer[32];
+
+    for(unsigned int id=1; id <= users.GetTopID(); id++){
+        const char* p_name = users.FindName(id);
+        if( p_name == NULL ) continue;
+        snprintf(buffer,sizeof(buffer)," %u\n",id);
+        image.append("n ");
+        image.append(p_name);
+        image.append(buffer);
+    }
+
+    for(unsigned int id=1; id <= groups.GetTopID(); id++){
+        const char* p_name = groups.FindName(id);
+        if( p_name == NULL ) continue;
+        snprintf(buffer,sizeof(buffer)," %u\n",id);
+        image.append("g ");
+        image.append(p_name);
+        image.append(buffer);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void WriteBinaryCache(std::string& image,const CNameTable& users,const CNameTable& groups)
+{
+    struct SCacheHeader header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.Magic,CACHE_MAGIC,sizeof(CACHE_MAGIC));
+    header.Version = CACHE_VERSION;
+
+    size_t start = image.size();
+    image.append((const char*)&header,sizeof(header));
+
+    header.Users = image.size() - start;
+    users.SaveImage(image);
+    header.UsersSize = image.size() - start - header.Users;
+
+    header.Groups = image.size() - start;
+    groups.SaveImage(image);
+    header.GroupsSize = image.size() - start - header.Groups;
+
+    header.Size = image.size() - start;
+    image.replace(start,sizeof(header),(const char*)&header,sizeof(header));
+}
+
+//------------------------------------------------------------------------------
+
+bool SaveCacheFile(const char* p_name,const std::string& image)
+{
+    std::string tmpname = std::string(p_name) + ".new";
+    int fd = open(tmpname.c_str(),O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if( fd < 0 ) return(false);
+    fchmod(fd,S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    size_t written = 0;
+    while( written < image.size() ){
+        ssize_t ret = write(fd,image.c_str() + written,image.size() - written);
+        if( ret < 0 ){
+            if( errno == EINTR ) continue;
+            break;
+        }
+        written += ret;
+    }
+
+    bool result = (written == image.size()) && (fsync(fd) == 0);
+    if( close(fd) != 0 ) result = false;
+    if( result && (rename(tmpname.c_str(),p_name) != 0) ) result = false;
+    if( result == false ){
+        int err = errno;
+        unlink(tmpname.c_str());
+        errno = err;
+        return(false);
+    }
+
+    // make the rename persistent
+    SyncFileDirectory(p_name);
+
+    return(true);
+}
+
+//------------------------------------------------------------------------------
+
+void SyncFileDirectory(const char* p_name)
+{
+    std::string dir(p_name);
+    size_t pos = dir.rfind('/');
+    if( pos == std::string::npos ){
+        dir = ".";
+    } else {
+        dir = pos == 0 ? "/" : dir.substr(0,pos);
+    }
+    int dfd = open(dir.c_str(),O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if( dfd >= 0 ){
+        fsync(dfd);
+        close(dfd);
+    }
+}
+
+//==============================================================================
+//------------------------------------------------------------------------------
+//==============================================================================
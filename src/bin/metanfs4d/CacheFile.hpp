@@ -0,0 +1,76 @@
+#ifndef CacheFileH
+#define CacheFileH
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type 
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+// =============================================================================
+
+#include <stdint.h>
+#include <string>
+#include "NameTable.hpp"
+
+//------------------------------------------------------------------------------
+
+// the cache keeps user/id and group/id mappings, it is stored either in
+// the text format (lines "n name id" and "g name id") or in the binary format:
+// SCacheHeader followed by images of the user and group tables (CNameTable),
+// the binary format uses the native byte order as the cache is local
+
+#define CACHE_MAGIC     "MNFS4CB"
+#define CACHE_VERSION   1
+
+struct SCacheHeader {
+    char        Magic[8];
+    uint32_t    Version;
+    uint32_t    Reserved;
+    uint64_t    Size;           // size of the whole cache
+    uint64_t    Users;          // offset of the user table image
+    uint64_t    UsersSize;
+    uint64_t    Groups;         // offset of the group table image
+    uint64_t    GroupsSize;
+};
+
+enum ECacheFormat {
+    CACHE_TEXT,
+    CACHE_BINARY
+};
+
+//------------------------------------------------------------------------------
+
+// load the cache, the format is detected, tables are cleared on failure,
+// it returns false and sets errno if the file cannot be read
+bool LoadCacheFile(const char* p_name,CNameTable& users,CNameTable& groups,ECacheFormat& format);
+
+// read the cache from the buffer
+bool ReadTextCache(const char* p_data,size_t size,CNameTable& users,CNameTable& groups);
+bool ReadBinaryCache(const char* p_data,size_t size,CNameTable& users,CNameTable& groups);
+
+// serialize tables
+void WriteTextCache(std::string& image,const CNameTable& users,const CNameTable& groups);
+void WriteBinaryCache(std::string& image,const CNameTable& users,const CNameTable& groups);
+
+// write the cache into a temporary file and rename it over the old one,
+// thus the cache is always complete, it returns false and sets errno on failure
+bool SaveCacheFile(const char* p_name,const std::string& image);
+
+// flush the directory entry of the file, e.g. after rename
+void SyncFileDirectory(const char* p_name);
+
+//------------------------------------------------------------------------------
+
+#endif
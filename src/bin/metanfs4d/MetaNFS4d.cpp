@@ -24,13 +24,25 @@
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 #include <signal.h>
+#include <pthread.h>
+#include <errno.h>
 #include <map>
 #include <vector>
 #include <set>
+#include <deque>
 #include <string>
 #include <fstream>
+#include <sstream>
 #include <grp.h>
 #include <pwd.h>
 #include <iostream>
@@ -44,14 +56,30 @@
 
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "common.h"
+#include "snapshot.h"
+#include "NameTable.hpp"
+#include "CacheFile.hpp"
 #include "MetaNFS4dOptions.hpp"
 
 // -----------------------------------------------------------------------------
 
 #define CONFIG  "/etc/metanfs4.conf"
 
+// group membership is split into shards, which are shared by memberships of
+// consecutive loads of the group file, thus a load copies only shards of changed
+// groups and their members
+#define GROUP_SHARD_SIZE    1024    // group records per shard, shards are indexed by gid
+#define MEMBER_SHARDS       4096    // shards of the member index, indexed by hash of the name
+
+// the journal is folded into the cache when it exceeds this size
+#define JOURNAL_LIMIT   (64*1024*1024)
+
+// failed journal writes are repeated after this interval (in seconds)
+#define JOURNAL_RETRY   1
+
 // -----------------------------------------------------------------------------
 // global data
 unsigned int            BaseID          = 5000000;
@@ -59,9 +87,14 @@ uid_t                   TopUserID       = 0;
 gid_t                   TopGroupID      = 0;
 int                     ServerSocket    = -1;
 bool                    Verbose = false;
+bool                    Terminated      = false;
 
 // [setup]
 int                     QueueLen        = 65535;
+int                     Workers         = 8;
+int                     IdleTimeout     = 30;
+int                     MaxPipelined    = 64;       // max pending tagged requests of one connection
+bool                    Snapshot        = true;
 std::string             NoBody          = "nobody";
 int                     NobodyID        = -1;
 std::string             NoGroup         = "nogroup";
@@ -78,6 +111,9 @@ CSmallString            LocalDomain;
 CSmallString            PrincipalMapFileName;
 std::set<std::string>   LocalRealms;
 struct stat             LastPrincMapStat;
+int                     LocalCacheSize  = 16384;    // max number of cached local users or groups, 0 - disabled
+int                     LocalCacheTTL   = 300;      // in seconds
+int                     LocalNegativeTTL = 60;      // in seconds, for names, which are not local
 
 // [group]
 CSmallString            GroupFileName;
@@ -87,18 +123,281 @@ bool                    IgnoreIfNotExist = false;
 
 // [cache]
 CSmallString            CacheFileName;
+bool                    BinaryCache     = true;
+bool                    Journal         = true;
+int                     CheckpointInterval = 300;   // in seconds, 0 - only when the journal is too large
 
 // data storages
-std::map<std::string,uid_t> UserToID;
-std::map<uid_t,std::string> IDToUser;
-std::map<std::string,gid_t> GroupToID;
-std::map<gid_t,std::string> IDToGroup;
+CNameTable              Users;      // ids are without BaseID
+CNameTable              Groups;
 
 // principal mappings
 std::map<std::string,std::string>               PrincipalMap;
 
-// group members
-std::map<std::string, std::set<std::string> >   GroupMembers;
+// pre-serialized group - response header and members (\0 terminated names)
+struct SGroupRecord {
+    struct SNFS4Message                     Header;     // Type is set by the request
+    boost::shared_ptr<const std::string>    Members;    // NULL if the group has no members
+};
+
+typedef std::vector<SGroupRecord>                       SGroupShard;    // GROUP_SHARD_SIZE records
+typedef std::map<std::string, std::set<gid_t> >         SMemberShard;   // groups of members (ids without BaseID)
+
+// group membership from the group file, it is built by load_group() aside
+// and then replaced as a whole, it is never modified once published,
+// shards are NULL if they do not contain any group or member
+struct SMembership {
+    SMembership(void) : MemberShards(MEMBER_SHARDS) {}
+    std::vector<boost::shared_ptr<const SGroupShard> >  GroupShards;    // by gid without BaseID
+    std::vector<boost::shared_ptr<const SMemberShard> > MemberShards;   // by get_member_shard()
+};
+
+// shards of the membership being built, which were already copied by the load
+// and thus can be modified, it is used only by load_group()
+struct SMembershipChange {
+    std::vector<SGroupShard*>   GroupShards;
+    std::vector<SMemberShard*>  MemberShards;
+};
+
+// generation of data provided to clients, it is changed after any change
+// of data (__atomic builtins), clients compare generations only within
+// the same instance of the daemon
+unsigned int            DataInstance    = 0;
+unsigned int            DataGeneration  = 0;
+
+// all above data storages except Membership are protected by DataLock
+pthread_rwlock_t        DataLock        = PTHREAD_RWLOCK_INITIALIZER;
+
+// current membership, it must be accessed by get_membership() and set_membership()
+boost::shared_ptr<const SMembership>    Membership(new SMembership);
+
+// groups from the last load, only changed groups are processed by the next load,
+// a group is changed also if any of its members gained or lost the local account,
+// it is used only by load_group()
+struct SGroupState {
+    SGroupState(void) : Hash(0) {}
+    uint64_t                                        Hash;           // hash of group lines
+    std::vector<std::pair<std::string,bool> >       LocalMembers;   // members from LocalDomains and if they
+                                                                    // were mapped to local accounts
+};
+std::map<std::string,SGroupState>       GroupStates;
+
+// results of local passwd/group queries, which can be served by LDAP,
+// the oldest item is evicted when the cache is full
+struct SLocalAccount {
+    SLocalAccount(void) : Found(false), UID(0), GID(0), Expires(0), Serial(0) {}
+    bool        Found;      // the name (or id) is not local if false
+    uid_t       UID;        // only for users
+    gid_t       GID;
+    std::string Name;
+    double      Expires;    // get_time()
+    uint64_t    Serial;     // insertion order
+};
+
+// keys are names or ids
+template<class Key>
+struct SLocalCache {
+    SLocalCache(void) : Serial(0) {}
+    std::map<Key,SLocalAccount>                 Items;
+    std::deque<std::pair<Key,uint64_t> >        Order;  // key and serial, items can be inserted repeatedly
+    uint64_t                                    Serial;
+};
+
+// local account caches and their statistics are protected by LocalCacheLock
+SLocalCache<std::string>    LocalUserCache;
+SLocalCache<std::string>    LocalGroupCache;
+SLocalCache<uid_t>          LocalUserIDCache;
+SLocalCache<gid_t>          LocalGroupIDCache;
+unsigned long           LocalCacheHits          = 0;
+unsigned long           LocalCacheNegativeHits  = 0;
+unsigned long           LocalCacheMisses        = 0;
+unsigned long           LocalCacheEvictions     = 0;
+pthread_mutex_t         LocalCacheLock  = PTHREAD_MUTEX_INITIALIZER;
+
+// complete results of principal mappings for krb5 upcalls, they are dropped
+// when the principal map or the group membership is changed
+struct SPrincRecord {
+    struct SNFS4Message                     Header;     // response without Type
+    boost::shared_ptr<const std::string>    Groups;     // gid_t items, the primary group is the first one
+    double                                  Expires;    // get_time()
+};
+
+// principal cache and its statistics are protected by PrincCacheLock,
+// records computed before the invalidation are not inserted (Generation)
+std::map<std::string,SPrincRecord>  PrincCache;
+unsigned long           PrincCacheGeneration    = 0;
+unsigned long           PrincCacheHits          = 0;
+unsigned long           PrincCacheMisses        = 0;
+unsigned long           PrincCacheInvalidations = 0;
+pthread_mutex_t         PrincCacheLock  = PTHREAD_MUTEX_INITIALIZER;
+
+// client connection, it is owned by the event loop, its requests are owned
+// by workers during processing, responses to untagged requests are sent
+// in order, thus the next request is read after the previous response is sent,
+// tagged requests are read until MaxPipelined requests are pending and
+// their responses are sent in the order in which workers finish them
+enum EConnState {
+    CONN_READ,          // waiting for request
+    CONN_READ_EXTRA,    // waiting for extra data of request
+    CONN_CLOSED         // closed, it is deleted when none of its requests is pending
+};
+
+struct SRequest;
+
+struct SConnection {
+    int                 Socket;         // kept open until all requests are returned by workers
+    EConnState          State;
+    time_t              LastActivity;
+    int                 Armed;          // events armed in the event loop, 0 - disarmed
+    bool                WaitWrite;      // the client does not drain the socket
+    bool                Serial;         // the last request was untagged
+    int                 NumOfPending;   // requests received and not sent yet
+    SRequest*           Request;        // request waiting for extra data
+    std::deque<SRequest*> SendQueue;    // processed requests, the first one can be partially sent
+    boost::shared_ptr<const std::vector<char> > EnumImage; // data of enumeration in progress, snapshot format
+    pthread_mutex_t     EnumLock;       // tagged enumerations can be processed concurrently
+    std::vector<char>   RecvBuffer;     // v2: received record
+};
+
+// request of the connection
+struct SRequest {
+    SConnection*        Connection;
+    bool                V2;             // the request was received in protocol v2
+    bool                Tagged;         // v2: the request has the tagged header (v3)
+    uint64_t            Tag;            // tag of the request, it is returned in the response
+    struct SNFS4Message Data;           // request, it is replaced by response
+    std::string         Name;           // full name of the request (Data.Name can be truncated)
+    std::string         ResponseName;   // full name of the response, empty - Data.Name is used
+    uint32_t            MaxLen;         // v2: max size of the response payload
+    std::string         RequestData;    // supplementary request data
+    std::string         ExtraData;      // supplementary response data
+    boost::shared_ptr<const std::string> ExtraBlob; // shared supplementary response data, used instead of ExtraData
+    int                 SentParts;      // number of already sent parts of response
+};
+
+// event loop
+int                             EpollFD         = -1;
+int                             SignalFD        = -1;
+std::map<int,SConnection*>      Connections;
+std::vector<SConnection*>       ClosedConnections;  // waiting for their pending requests
+
+// worker pool
+std::vector<pthread_t>      WorkerThreads;
+std::deque<SRequest*>       WorkQueue;
+bool                        StopWorkers     = false;
+pthread_mutex_t             QueueLock       = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t              QueueCond       = PTHREAD_COND_INITIALIZER;
+
+// processed requests returned to the event loop
+std::deque<SRequest*>       DoneQueue;
+pthread_mutex_t             DoneLock        = PTHREAD_MUTEX_INITIALIZER;
+int                         DoneEventFD     = -1;
+
+// watched file, its directory is watched to catch replacement by rename
+struct SFileWatch {
+    std::string         Directory;
+    std::string         Name;
+    int                 WD;             // watch of the directory, -1 if not watched
+    bool                Changed;        // reload is pending
+};
+
+// changes of the group and principalmap files, handled by the event loop
+int                         InotifyFD       = -1;
+SFileWatch                  GroupWatch;
+SFileWatch                  PrincMapWatch;
+
+// journal of id allocations, records have the cache format,
+// counters are updated under JournalLock and can be read by __atomic_load_n
+std::string                 JournalFileName;
+int                         JournalFD       = -1;
+std::string                 JournalBuffer;          // records not written yet
+uint64_t                    JournalAppended = 0;    // number of appended records
+uint64_t                    JournalSynced   = 0;    // number of records safely on the disk
+uint64_t                    JournalFailed   = 0;    // number of records taken by the last failed write
+size_t                      JournalSize     = 0;    // used only by the journal thread
+// records, which were not written, they are written again before new records,
+// the journal is broken if an incomplete record cannot be removed, then only
+// the journal replacement can store records, used only by the journal thread
+std::string                 JournalUnsynced;
+uint64_t                    JournalFlushed  = 0;    // number of records taken by flush_journal()
+bool                        JournalBroken   = false;
+pthread_t                   JournalThread;
+bool                        JournalStarted  = false;
+bool                        StopJournal     = false;
+pthread_mutex_t             JournalLock     = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t              JournalCond     = PTHREAD_COND_INITIALIZER;     // new records
+pthread_cond_t              JournalSyncCond = PTHREAD_COND_INITIALIZER;     // records synced or journal truncated
+
+// records appended after the cache was copied by save_cache() are kept
+// by the journal thread, the journal is then replaced by them
+bool                        JournalKeep     = false;
+size_t                      JournalKeepFrom = 0;    // offset in JournalBuffer
+std::string                 JournalKept;
+bool                        JournalTruncate = false;    // replacement requested by save_cache()
+
+// cache writes are serialized by CacheLock, top ids of the last written cache
+// are protected by CacheLock as well
+pthread_mutex_t             CacheLock       = PTHREAD_MUTEX_INITIALIZER;
+uid_t                       SavedTopUserID  = 0;
+gid_t                       SavedTopGroupID = 0;
+
+// periodic checkpoints of the cache
+pthread_t                   CheckpointThread;
+bool                        CheckpointStarted   = false;
+bool                        CheckpointRequested = false;
+bool                        StopCheckpoint  = false;
+pthread_mutex_t             CheckpointLock  = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t              CheckpointCond  = PTHREAD_COND_INITIALIZER;
+
+// background reload of the group and principalmap files
+pthread_t                   ReloaderThread;
+bool                        ReloaderStarted = false;
+bool                        GroupReloadRequested    = false;
+bool                        PrincMapReloadRequested = false;
+bool                        StopReloader    = false;    // also read by __atomic_load_n from load_group()
+pthread_mutex_t             ReloadLock      = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t              ReloadCond      = PTHREAD_COND_INITIALIZER;
+
+// requests processed during the reload, updated by __atomic builtins
+bool                        ReloadInProgress    = false;
+unsigned long               ReloadNumOfRequests = 0;
+unsigned long               ReloadMaxLatency    = 0;    // in microseconds
+
+// snapshot publisher
+struct SNFS4State*          SharedState     = NULL;
+bool                        StateNames      = false;    // names are published in the state
+pthread_t                   PublisherThread;
+bool                        PublisherStarted = false;
+bool                        PublishRequested = false;
+bool                        StopPublisher   = false;
+pthread_mutex_t             PublishLock     = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t              PublishCond     = PTHREAD_COND_INITIALIZER;
+
+// data image shared by all enumerations, it is rebuilt only when DataGeneration
+// is changed, enumerations in progress keep their image until they are finished,
+// it is protected by EnumImageLock
+boost::shared_ptr<const std::vector<char> > SharedEnumImage;
+unsigned int                EnumImageGeneration = 0;
+pthread_mutex_t             EnumImageLock   = PTHREAD_MUTEX_INITIALIZER;
+
+// -----------------------------------------------------------------------------
+
+// scoped locks for DataLock
+class CReadLock {
+public:
+    CReadLock(pthread_rwlock_t* p_lock) : Lock(p_lock) { pthread_rwlock_rdlock(Lock); }
+    ~CReadLock(void) { pthread_rwlock_unlock(Lock); }
+private:
+    pthread_rwlock_t*   Lock;
+};
+
+class CWriteLock {
+public:
+    CWriteLock(pthread_rwlock_t* p_lock) : Lock(p_lock) { pthread_rwlock_wrlock(Lock); }
+    ~CWriteLock(void) { pthread_rwlock_unlock(Lock); }
+private:
+    pthread_rwlock_t*   Lock;
+};
 
 
 // -----------------------------------------------------------------------------
@@ -111,16 +410,132 @@ void finalize_server(void);
 // start server loop
 void start_main_loop(void);
 
-// signal handler
-void catch_signals(int signo);
+// event loop
+void accept_connections(void);
+bool can_receive(SConnection* p_conn);
+void receive_request(SConnection* p_conn);
+void send_responses(SConnection* p_conn);
+bool send_response(SRequest* p_req);
+bool send_response_v2(SRequest* p_req);
+void close_connection(SConnection* p_conn);
+void delete_closed_connections(void);
+void update_connection(SConnection* p_conn);
+void finish_requests(void);
+void close_idle_connections(void);
+
+// watch the group and principalmap files
+bool init_file_watches(void);
+void setup_file_watch(SFileWatch& watch,const char* p_file);
+bool add_file_watch(SFileWatch& watch);
+void read_file_events(void);
+void check_files(void);
+
+// background reload of the group and principalmap files
+bool start_reloader(void);
+void stop_reloader(void);
+void request_reload(bool group,bool princ_map);
+void* reloader_main(void* p_arg);
+bool is_reload_cancelled(void);
+void record_reload_latency(double start);
+
+// atomic access to the group membership
+boost::shared_ptr<const SMembership> get_membership(void);
+boost::shared_ptr<const SMembership> set_membership(const boost::shared_ptr<const SMembership>& p_membership);
+
+// monotonic time in seconds
+double get_time(void);
+
+// worker pool
+bool start_workers(void);
+void stop_workers(void);
+void* worker_main(void* p_arg);
+
+// snapshot for direct lookups by clients
+bool init_snapshot(void);
+void finalize_snapshot(void);
+bool publish_snapshot(void);
+void publish_range(void);
+void publish_names(void);
+void publish_generation(unsigned int generation);
+bool build_snapshot(std::vector<char>& image,uint64_t generation,unsigned int data_generation);
+uint32_t get_hash_size(size_t items);
+uint32_t add_snapshot_string(std::string& strings,const std::string& str);
+void request_snapshot(void);
+bool start_publisher(void);
+void stop_publisher(void);
+void* publisher_main(void* p_arg);
+
+// data image for enumerations, it is shared by all connections
+boost::shared_ptr<const std::vector<char> > get_enum_image(void);
+void offer_enum_image(const boost::shared_ptr<const std::vector<char> >& p_image,unsigned int generation);
+
+// process request received by the connection
+void process_request(SRequest* p_req);
+
+// process simple queries, group members are provided only if p_members is not NULL,
+// name is the full name of the request and it is replaced by the full name of the response
+void process_lookup(struct SNFS4Message& data,std::string& name,boost::shared_ptr<const std::string>* p_members);
+
+// process chunk of enumeration, data are kept in image during the enumeration
+void process_enum(struct SNFS4Message& data,boost::shared_ptr<const std::vector<char> >& p_image,std::string& extra_data);
+
+// records of enumeration chunks, full records (MSG_ENUM_USERS_V2/MSG_ENUM_GROUPS_V2)
+// are SNFS4EnumRecord with names of any length, otherwise SNFS4Message
+size_t get_enum_record_size(bool full,const char* p_name,uint32_t members_len);
+void append_enum_record(std::string& extra_data,bool full,int type,uint32_t id,uint32_t extra,
+                        const char* p_name,const char* p_members,uint32_t members_len);
+
+// process batch of simple queries, full records (MSG_LOOKUP_BATCH_V2)
+// are SNFS4BatchRecord with names of any length, otherwise SNFS4Message
+void process_batch(struct SNFS4Message& data,bool full,const std::string& request_data,std::string& extra_data);
+bool parse_batch(bool full,size_t count,const std::string& request_data,
+                 std::vector<struct SNFS4Message>& items,std::vector<std::string>& names);
+
+// signals received by the event loop
+void read_signals(void);
+
+// save cache
+bool save_cache(void);
+bool is_cache_changed(void);
+bool write_data(int fd,const char* p_data,size_t len);
+
+// periodic checkpoints of the cache
+bool start_checkpointer(void);
+void stop_checkpointer(void);
+void request_checkpoint(void);
+void* checkpoint_main(void* p_arg);
+
+// journal of id allocations
+bool init_journal(void);
+void finalize_journal(void);
+bool load_journal(void);
+void append_journal(char type,const std::string& name,unsigned int id);
+bool sync_journal(void);
+void flush_journal(void);
+void mark_journal(void);
+void truncate_journal(bool saved);
+void replace_journal(void);
+void* journal_main(void* p_arg);
 
 // load config and files
 bool load_config(void);
 bool load_cache(bool skip);
+bool add_cache_record(char type,const std::string& name,unsigned int nid);
 bool load_group(void);
 bool reload_group(void);
 bool load_principal_map(void);
 bool reload_principal_map(void);
+bool is_file_changed(const struct stat& current,const struct stat& last);
+uint64_t get_line_hash(const std::string& line);
+void remove_group_members(SMembership& membership,SMembershipChange& change,gid_t gid);
+size_t get_member_shard(const std::string& member);
+const SGroupRecord* find_group_record(const SMembership& membership,gid_t gid);
+const std::set<gid_t>* find_member_groups(const SMembership& membership,const std::string& member);
+SGroupRecord& change_group_record(SMembership& membership,SMembershipChange& change,gid_t gid);
+SMemberShard& change_member_shard(SMembership& membership,SMembershipChange& change,const std::string& member);
+bool is_local_domain_member(const std::string& name);
+const std::string& get_member_alias(const std::string& name,std::map<std::string,std::string>& aliases);
+bool is_local_mapping_changed(const SGroupState& state,std::map<std::string,std::string>& aliases);
 
 // -----------------------------------------------------------------------------
 
@@ -136,12 +551,56 @@ const std::string is_princ_local(const std::string &princ);
 // conditional mapping of user to local account
 const std::string can_user_be_local(const std::string &name);
 
-// get or register user or group
+// get or register user or group - DataLock must be held for writing
 int GetOrRegisterUser(const std::string& name);
 int GetOrRegisterGroup(const std::string& name);
 
-// generate group list
-void generate_group_list(const std::string& gname,std::string& extra_data,size_t& len,gid_t& num);
+// register metanfs4 user or group if it is not known yet, it returns id without BaseID
+uid_t register_user(const std::string& name);
+gid_t register_group(const std::string& name);
+
+// allocate new id and journal it - DataLock must be held for writing
+uid_t allocate_user(const std::string& name);
+gid_t allocate_group(const std::string& name);
+
+// data provided to clients were changed
+void change_generation(void);
+
+// thread-safe queries for local accounts, results are cached,
+// errno is zero if false is returned because the account does not exist
+bool get_local_user(const std::string& name,uid_t& uid,gid_t& gid);
+bool get_local_group(const std::string& name,gid_t& gid);
+bool get_local_user_name(uid_t uid,std::string& name);
+bool get_local_group_name(gid_t gid,std::string& name);
+void log_local_cache_stat(void);
+
+// cached query for a local account, the query calls get*_r(), fills the account
+// if it is found and returns the result of get*_r()
+template<class Key>
+bool get_local_account(SLocalCache<Key>& cache,const Key& key,
+                       int (*query)(const Key& key,std::vector<char>& buffer,SLocalAccount& account),
+                       SLocalAccount& account);
+template<class Key>
+bool find_local_account(SLocalCache<Key>& cache,const Key& key,SLocalAccount& account);
+template<class Key>
+void add_local_account(SLocalCache<Key>& cache,const Key& key,const SLocalAccount& account);
+
+// queries for get_local_account()
+int query_user_by_name(const std::string& name,std::vector<char>& buffer,SLocalAccount& account);
+int query_group_by_name(const std::string& name,std::vector<char>& buffer,SLocalAccount& account);
+int query_user_by_id(const uid_t& uid,std::vector<char>& buffer,SLocalAccount& account);
+int query_group_by_id(const gid_t& gid,std::vector<char>& buffer,SLocalAccount& account);
+void set_local_user(SLocalAccount& account,const struct passwd* p_pwd);
+void set_local_group(SLocalAccount& account,const struct group* p_grp);
+
+// map principal to local account including supplementary groups, results are cached
+void get_princ_record(const std::string& princ,SPrincRecord& record);
+void get_supplementary_groups(const std::string& lname,gid_t gid,std::vector<gid_t>& groups);
+void clear_princ_cache(void);
+
+// setup group response from the pre-serialized record - DataLock must be held
+void setup_group_response(int type,gid_t gid,const char* p_name,struct SNFS4Message& data,
+                          boost::shared_ptr<const std::string>* p_members);
 
 // -----------------------------------------------------------------------------
 
@@ -156,6 +615,10 @@ int main(int argc,char* argv[])
     // process incomming requests
     start_main_loop();
 
+    // save cache if the server was terminated by a signal and the last
+    // checkpoint does not contain all ids
+    if( Terminated && is_cache_changed() ) save_cache();
+
     // finalize server
     finalize_server();
 
@@ -185,13 +648,30 @@ bool init_server(int argc,char* argv[])
     
     Verbose = options.GetOptVerbose();
 
-    // handle signals
-    signal(SIGINT, catch_signals);
-    signal(SIGTERM, catch_signals);
+    // local queries of the daemon must not be sent to the daemon by its own nsswitch module
+    setenv(NO_DAEMON_ENV,"1",1);
+
+    // generations of the previous instance are not valid
+    DataInstance = (unsigned int)time(NULL) ^ ((unsigned int)getpid() << 16);
+    if( DataInstance == 0 ) DataInstance = 1;
+
+    // signals are received by the event loop, they are blocked before
+    // any thread is started, thus all threads inherit the mask
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs,SIGINT);
+    sigaddset(&sigs,SIGTERM);
+    pthread_sigmask(SIG_BLOCK,&sigs,NULL);
+    SignalFD = signalfd(-1,&sigs,SFD_NONBLOCK | SFD_CLOEXEC);
+    if( SignalFD < 0 ){
+        syslog(LOG_ERR,"unable to create signal descriptor (%s)",strerror(errno));
+        return(false);
+    }
     
 // load configuration and data -------------------
     if( load_config() == false ) return(false);
     if( load_cache(options.GetOptSkipCache()) == false ) return(false);
+    if( init_journal() == false ) return(false);
     if( load_group() == false ) return(false);
     if( load_principal_map() == false ) return(false);
     
@@ -202,9 +682,13 @@ bool init_server(int argc,char* argv[])
     syslog(LOG_INFO,"%s id is %d",NoGroup.c_str(),NoGroupID);
     PrimaryGroupID = GetOrRegisterGroup(PrimaryGroup);
     syslog(LOG_INFO,"%s id is %d",PrimaryGroup.c_str(),PrimaryGroupID);
+    if( sync_journal() == false ){
+        syslog(LOG_ERR,"unable to store ids in the journal %s",JournalFileName.c_str());
+        return(false);
+    }
 
     // create server socket
-    ServerSocket = socket(AF_UNIX,SOCK_SEQPACKET,0);
+    ServerSocket = socket(AF_UNIX,SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
     if( ServerSocket < 0 ){
         syslog(LOG_ERR,"unable to create socket");
         return(false);
@@ -236,6 +720,39 @@ bool init_server(int argc,char* argv[])
         return(false);
     }
 
+    // event loop
+    EpollFD = epoll_create1(EPOLL_CLOEXEC);
+    DoneEventFD = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+    if( (EpollFD < 0) || (DoneEventFD < 0) ){
+        syslog(LOG_ERR,"unable to create event loop");
+        return(false);
+    }
+
+    struct epoll_event event;
+    memset(&event,0,sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;          // NULL is server socket
+    if( epoll_ctl(EpollFD,EPOLL_CTL_ADD,ServerSocket,&event) != 0 ){
+        syslog(LOG_ERR,"unable to register server socket in the event loop");
+        return(false);
+    }
+    event.data.ptr = &DoneEventFD;  // pointer to DoneEventFD is worker notification
+    if( epoll_ctl(EpollFD,EPOLL_CTL_ADD,DoneEventFD,&event) != 0 ){
+        syslog(LOG_ERR,"unable to register worker notification in the event loop");
+        return(false);
+    }
+    event.data.ptr = &SignalFD;     // pointer to SignalFD is signal
+    if( epoll_ctl(EpollFD,EPOLL_CTL_ADD,SignalFD,&event) != 0 ){
+        syslog(LOG_ERR,"unable to register signals in the event loop");
+        return(false);
+    }
+
+    // changes of the group and principalmap files
+    init_file_watches();
+
+    // snapshot for direct lookups
+    if( init_snapshot() == false ) return(false);
+
     return(true);
 }
 
@@ -265,6 +782,10 @@ bool load_config(void)
         config.GetIntegerByKey("BaseID",bi);
         BaseID = bi;
         config.GetIntegerByKey("QueueLen",QueueLen);
+        config.GetIntegerByKey("Workers",Workers);
+        config.GetIntegerByKey("IdleTimeout",IdleTimeout);
+        config.GetIntegerByKey("MaxPipelined",MaxPipelined);
+        config.GetLogicalByKey("Snapshot",Snapshot);
         config.GetStringByKey("NoBody",NoBody);
         config.GetStringByKey("NoGroup",NoGroup);
         config.GetStringByKey("PrimaryGroup",PrimaryGroup);
@@ -272,6 +793,12 @@ bool load_config(void)
 
     syslog(LOG_INFO,"base ID (BaseID): %d",BaseID);
     syslog(LOG_INFO,"queue length (QueueLen): %d",QueueLen);
+    if( Workers < 1 ) Workers = 1;
+    syslog(LOG_INFO,"number of worker threads (Workers): %d",Workers);
+    syslog(LOG_INFO,"idle connection timeout (IdleTimeout): %d s",IdleTimeout);
+    if( MaxPipelined < 1 ) MaxPipelined = 1;
+    syslog(LOG_INFO,"max pipelined requests per connection (MaxPipelined): %d",MaxPipelined);
+    syslog(LOG_INFO,"publish snapshot (Snapshot): %s",(const char*)PrmFileOnOff(Snapshot));
     syslog(LOG_INFO,"nobody (NoBody): %s",NoBody.c_str());
     syslog(LOG_INFO,"nogroup (NoGroup): %s",NoGroup.c_str());
     syslog(LOG_INFO,"primary group (PrimaryGroup): %s",PrimaryGroup.c_str());
@@ -308,6 +835,18 @@ bool load_config(void)
         syslog(LOG_INFO,"local realms (LocalRealms): -disabled-");
     }
 
+    config.GetIntegerByKey("LocalCacheSize",LocalCacheSize);
+    config.GetIntegerByKey("LocalCacheTTL",LocalCacheTTL);
+    config.GetIntegerByKey("LocalNegativeTTL",LocalNegativeTTL);
+    if( LocalCacheSize > 0 ){
+        syslog(LOG_INFO,"local account cache size (LocalCacheSize): %d",LocalCacheSize);
+        syslog(LOG_INFO,"local account cache TTL (LocalCacheTTL): %d s",LocalCacheTTL);
+        syslog(LOG_INFO,"local account negative cache TTL (LocalNegativeTTL): %d s",LocalNegativeTTL);
+    } else {
+        LocalCacheSize = 0;
+        syslog(LOG_INFO,"local account cache size (LocalCacheSize): -disabled-");
+    }
+
 // [group]
     syslog(LOG_INFO,"[group]");
 
@@ -340,9 +879,20 @@ bool load_config(void)
 
     if( config.OpenSection("cache") == true ){
         config.GetStringByKey("Name",CacheFileName);
+        config.GetLogicalByKey("Binary",BinaryCache);
+        config.GetLogicalByKey("Journal",Journal);
+        config.GetIntegerByKey("Checkpoint",CheckpointInterval);
     }
 
     syslog(LOG_INFO,"cache file name (Name): %s",(const char*)CacheFileName);
+    syslog(LOG_INFO,"binary cache format (Binary): %s",(const char*)PrmFileOnOff(BinaryCache));
+    syslog(LOG_INFO,"journal of new ids (Journal): %s",(const char*)PrmFileOnOff(Journal));
+    if( CheckpointInterval > 0 ){
+        syslog(LOG_INFO,"checkpoint interval (Checkpoint): %d s",CheckpointInterval);
+    } else {
+        CheckpointInterval = 0;
+        syslog(LOG_INFO,"checkpoint interval (Checkpoint): -disabled-");
+    }
 
     syslog(LOG_INFO,"-------------------------------------------------------------------------------");
 
@@ -375,43 +925,53 @@ bool load_cache(bool skip)
         return(false);
     }
 
-    std::ifstream fin;
-    fin.open(CacheFileName);
-    int num = 0;
-    while( fin ){
-        char        type = '-';
-        std::string name;
-        unsigned int nid = 0;
-        fin >> type >> name >> nid;
-        if( (fin) && (type == 'n') && (nid > 0) ){
-            UserToID[name] = nid;
-            IDToUser[nid] = name;
-            if( TopUserID < nid ){
-                TopUserID = nid;
-            }
-            num++;
-        }
-        if( (fin) && (type == 'g') && (nid > 0) ){
-            GroupToID[name] = nid;
-            IDToGroup[nid] = name;
-            if( TopGroupID < nid ){
-                TopGroupID = nid;
-            }
-            num++;
-        }
+    // both formats are accepted, the cache is written in the configured format
+    double stime = get_time();
+    ECacheFormat format;
+    if( LoadCacheFile(CacheFileName,Users,Groups,format) == false ){
+        syslog(LOG_INFO,"unable to read the cache file %s (%s)",(const char*)CacheFileName,strerror(errno));
+        return(false);
     }
-    syslog(LOG_INFO,"cached items: %d",num);
-    fin.close();
+    TopUserID = Users.GetTopID();
+    TopGroupID = Groups.GetTopID();
+    SavedTopUserID = TopUserID;
+    SavedTopGroupID = TopGroupID;
+    double etime = get_time();
+
+    syslog(LOG_INFO,"cached items: %d",(int)(Users.GetNumOfItems() + Groups.GetNumOfItems()));
+    syslog(LOG_INFO,"cache loaded in %.3f s (%s format)",etime-stime,format == CACHE_BINARY ? "binary" : "text");
 
     return(true);
 }
 
 // -----------------------------------------------------------------------------
 
-void save_cache(void)
+bool add_cache_record(char type,const std::string& name,unsigned int nid)
+{
+    if( (type == 'n') && (nid > 0) && Users.Add(name,nid) ){
+        if( TopUserID < nid ){
+            TopUserID = nid;
+        }
+        return(true);
+    }
+    if( (type == 'g') && (nid > 0) && Groups.Add(name,nid) ){
+        if( TopGroupID < nid ){
+            TopGroupID = nid;
+        }
+        return(true);
+    }
+    return(false);
+}
+
+// -----------------------------------------------------------------------------
+
+bool save_cache(void)
 {
     // write cache if necessary
-    if( CacheFileName == NULL ) return;
+    if( CacheFileName == NULL ) return(true);
+
+    // the checkpoint and the final write can overlap
+    pthread_mutex_lock(&CacheLock);
 
     syslog(LOG_INFO,"writing cache to %s",(const char*)CacheFileName);
 
@@ -419,185 +979,173 @@ void save_cache(void)
     mkdir(dir, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
     chmod(dir, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH );
 
-    std::ofstream fout(CacheFileName);
-    int unum = 0;
-    int gnum = 0;
-    if( fout ){
-        chmod(CacheFileName,S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
-
-        std::map<std::string,uid_t>::iterator it = UserToID.begin();
-        std::map<std::string,uid_t>::iterator ie = UserToID.end();
-        while( it != ie ){
-            fout << "n " << it->first << " " << it->second << std::endl;
-            it++;
-            unum++;
+    double stime = get_time();
+
+    // tables are only copied under the lock, thus lookups are not blocked and
+    // registrations are blocked only for the copy, the binary image is the copy
+    std::string image;
+    CNameTable  users;
+    CNameTable  groups;
+    uid_t       top_uid;
+    gid_t       top_gid;
+    int         unum;
+    int         gnum;
+    {
+        CReadLock lock(&DataLock);
+
+        if( BinaryCache ){
+            WriteBinaryCache(image,Users,Groups);
+        } else {
+            users = Users;
+            groups = Groups;
         }
+        top_uid = TopUserID;
+        top_gid = TopGroupID;
+        unum = Users.GetNumOfItems();
+        gnum = Groups.GetNumOfItems();
 
-        it = GroupToID.begin();
-        ie = GroupToID.end();
-        while( it != ie ){
-            fout << "g " << it->first << " " << it->second << std::endl;
-            it++;
-            gnum++;
-        }
-        fout.close();
+        // all journal records are in the copy, later records are kept
+        mark_journal();
+    }
+    double ctime = get_time();
+
+    if( BinaryCache == false ){
+        WriteTextCache(image,users,groups);
+        users.Clear();
+        groups.Clear();
+    }
+
+    // the old cache is replaced only by the complete new one
+    if( SaveCacheFile(CacheFileName,image) == false ){
+        syslog(LOG_ERR,"unable to write the cache %s (%s)",(const char*)CacheFileName,strerror(errno));
+        truncate_journal(false);
+        pthread_mutex_unlock(&CacheLock);
+        return(false);
     }
 
+    // journal records are in the cache now
+    truncate_journal(true);
+    SavedTopUserID = top_uid;
+    SavedTopGroupID = top_gid;
+
+    double etime = get_time();
+
     syslog(LOG_INFO,"number of cache records (users/groups): %d/%d",unum,gnum);
+    syslog(LOG_INFO,"cache written in %.3f s (%lu bytes, tables copied in %.3f s)",etime-stime,(unsigned long)image.size(),ctime-stime);
+
+    pthread_mutex_unlock(&CacheLock);
+    return(true);
 }
 
 // -----------------------------------------------------------------------------
 
-bool load_group(void)
+// test if ids were allocated since the last cache write
+bool is_cache_changed(void)
 {
-// load group if present
-    if( GroupFileName == NULL ) return(true);
-
-    syslog(LOG_INFO,"group file: %s",(const char*)GroupFileName);
-
-    memset(&LastGroupStat,0,sizeof(LastGroupStat));
-
-    if( stat(GroupFileName,&LastGroupStat) != 0 ){
-        syslog(LOG_INFO,"unable to stat the group file %s",(const char*)GroupFileName);
-        if( IgnoreIfNotExist ) {
-            syslog(LOG_INFO,"but ignored as requested (IgnoreIfNotExist = on)");
-            return(true);
-        }
-        return(false);
-    }
-    if( (LastGroupStat.st_uid != 0) || (LastGroupStat.st_gid != 0) || ((LastGroupStat.st_mode & 0777) != 0644) ){
-        syslog(LOG_INFO,"wrong access rights on the group file %s(%d:%d/%o) (root:root/0644 is required)",(const char*)GroupFileName,LastGroupStat.st_uid,LastGroupStat.st_gid,(LastGroupStat.st_mode & 0777));
-        return(false);
+    pthread_mutex_lock(&CacheLock);
+    bool changed;
+    {
+        CReadLock lock(&DataLock);
+        changed = (TopUserID != SavedTopUserID) || (TopGroupID != SavedTopGroupID);
     }
+    pthread_mutex_unlock(&CacheLock);
+    return(changed);
+}
 
-    // the file can be re-loaded over time make sure the list is empty
-    GroupMembers.clear();
-
-    std::ifstream fin;
-    fin.open(GroupFileName);
-    int unum = 0;
-    int gnum = 0;
-    int uinum = 0;
-    int ulnum = 0;
-    int ginum = 0;
-    std::string line;
-    while( getline(fin,line) ){
-        std::vector<std::string> strs;
-        boost::split(strs,line,boost::is_any_of(":"));
-        if( strs.size() == 4 ){
-            std::string gname = strs[0];
-            if( gname.find("@") != std::string::npos ){
-                if( GroupToID.count(gname) == 0 ){
-                    TopGroupID++;
-                    GroupToID[gname] = TopGroupID;
-                    IDToGroup[TopGroupID] = gname;
-                    gnum++;
-                } else {
-                    gnum++;
-                    ginum++;
-                }
-                std::vector<std::string> usrs;
-                boost::split(usrs,strs[3],boost::is_any_of(","));
-                std::vector<std::string>::iterator it = usrs.begin();
-                std::vector<std::string>::iterator ie = usrs.end();
-                while( it != ie ){
-                    std::string uname = *it;
-                    if( uname.find("@") != std::string::npos ){
-                        if( UserToID.count(uname) == 0 ){
-                            TopUserID++;
-                            UserToID[uname] = TopUserID;
-                            IDToUser[TopUserID] = uname;
-                            unum++;
-                        } else {
-                            unum++;
-                            uinum++;
-                        }
-                        // add user with domain
-                        GroupMembers[gname].insert(uname);
-                        // and again if it can be mapped to local account and the mapping is allowed
-                        // this is important for proper function of rsync with --chown or --groupmap
-                        // RT#202411
-                        // well after some discussion this will not be used as it can make mess on local FSs
-                        std::string lname = can_user_be_local(uname);
-                        if( ! lname.empty() ){
-                            GroupMembers[gname].insert(lname);
-                            ulnum++;
-                        }
-                    }
-                    it++;
-                }
+// -----------------------------------------------------------------------------
 
-            }
+bool write_data(int fd,const char* p_data,size_t len)
+{
+    size_t written = 0;
+    while( written < len ){
+        ssize_t ret = write(fd,p_data + written,len - written);
+        if( ret < 0 ){
+            if( errno == EINTR ) continue;
+            return(false);
         }
+        written += ret;
     }
-    syslog(LOG_INFO,"group items (users/groups): %d/%d",unum,gnum);
-    syslog(LOG_INFO,"group items already read from cache (users/groups): %d/%d",uinum,ginum);
-    syslog(LOG_INFO,"users mapped to local users: %d",ulnum);
-    fin.close();
-
     return(true);
 }
 
 // -----------------------------------------------------------------------------
 
-bool reload_group(void)
+bool init_journal(void)
 {
-    if( GroupFileName == NULL ) return(true);
+    if( (CacheFileName == NULL) || (Journal == false) ) return(true);
 
-    struct stat my_stat;
-    if( stat(GroupFileName,&my_stat) != 0 ){
-        if( IgnoreIfNotExist ) return(true);
-        syslog(LOG_INFO,"unable to stat the group file %s",(const char*)GroupFileName);
+    JournalFileName = std::string(CacheFileName) + ".journal";
+
+    // ids allocated after the last cache write
+    if( load_journal() == false ) return(false);
+
+    JournalFD = open(JournalFileName.c_str(),O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if( JournalFD < 0 ){
+        syslog(LOG_ERR,"unable to open the journal %s (%s)",JournalFileName.c_str(),strerror(errno));
         return(false);
     }
+    fchmod(JournalFD,S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 
-    bool reload = false;
-    reload |= my_stat.st_ino != LastGroupStat.st_ino;
-    reload |= my_stat.st_size != LastGroupStat.st_size;
-    reload |= my_stat.st_mtime != LastGroupStat.st_mtime;
+    struct stat jstat;
+    if( fstat(JournalFD,&jstat) == 0 ) JournalSize = jstat.st_size;
 
-    // reload the group if the file was modified
-    if( reload == true )  return(load_group());
-    return(true);
+    // fold replayed records into the cache
+    if( JournalSize > 0 ) save_cache();
+
+    JournalStarted = pthread_create(&JournalThread,NULL,journal_main,NULL) == 0;
+
+    if( JournalStarted == false ){
+        syslog(LOG_ERR,"unable to start journal writer");
+    }
+    return(JournalStarted);
 }
 
 // -----------------------------------------------------------------------------
 
-bool load_principal_map(void)
+void finalize_journal(void)
 {
-// load group if present
-    if( PrincipalMapFileName == NULL ) return(true);
+    if( JournalStarted ){
+        // pending records are written
+        pthread_mutex_lock(&JournalLock);
+        StopJournal = true;
+        pthread_cond_signal(&JournalCond);
+        pthread_mutex_unlock(&JournalLock);
+
+        pthread_join(JournalThread,NULL);
+        JournalStarted = false;
+    }
 
-    syslog(LOG_INFO,"principalmap file: %s",(const char*)PrincipalMapFileName);
+    if( JournalFD >= 0 ) close(JournalFD);
+    JournalFD = -1;
+}
 
-    memset(&LastPrincMapStat,0,sizeof(LastPrincMapStat));
+// -----------------------------------------------------------------------------
 
-    if( stat(PrincipalMapFileName,&LastPrincMapStat) != 0 ){
-        syslog(LOG_INFO,"unable to stat the principalmap file %s",(const char*)PrincipalMapFileName);
-        return(false);
-    }
-    if( (LastPrincMapStat.st_uid != 0) || (LastPrincMapStat.st_gid != 0) || ((LastPrincMapStat.st_mode & 0777) != 0644) ){
-        syslog(LOG_INFO,"wrong access rights on the principalmap file %s(%d:%d/%o) (root:root/0644 is required)",(const char*)PrincipalMapFileName,LastPrincMapStat.st_uid,LastPrincMapStat.st_gid,(LastPrincMapStat.st_mode & 0777));
+bool load_journal(void)
+{
+    struct stat jstat;
+    if( stat(JournalFileName.c_str(),&jstat) != 0 ) return(true);
+
+    if( (jstat.st_uid != 0) || (jstat.st_gid != 0) || ((jstat.st_mode & 0777) != 0644) ){
+        syslog(LOG_INFO,"wrong access rights on the journal file %s(%d:%d/%o) (root:root/0644 is required)",JournalFileName.c_str(),jstat.st_uid,jstat.st_gid,(jstat.st_mode & 0777));
         return(false);
     }
 
-    // the file can be re-loaded over time make sure the list is empty
-    PrincipalMap.clear();
-
     std::ifstream fin;
-    fin.open(PrincipalMapFileName);
-    int unum = 0;
+    fin.open(JournalFileName.c_str());
+    int num = 0;
     std::string line;
     while( getline(fin,line) ){
-        std::vector<std::string> strs;
-        boost::split(strs,line,boost::is_any_of(":"));
-        if( strs.size() == 2 ){
-            if( strs[1] == "root" ) continue;
-            PrincipalMap[strs[0]] = strs[1];
-        }
+        // the last record can be incomplete if the server crashed
+        if( fin.eof() ) break;
+        std::stringstream str(line);
+        char        type = '-';
+        std::string name;
+        unsigned int nid = 0;
+        str >> type >> name >> nid;
+        if( (str) && add_cache_record(type,name,nid) ) num++;
     }
-
-    syslog(LOG_INFO,"principalmap items (principal:local): %d",unum);
+    syslog(LOG_INFO,"journal items: %d",num);
     fin.close();
 
     return(true);
@@ -605,358 +1153,2743 @@ bool load_principal_map(void)
 
 // -----------------------------------------------------------------------------
 
-bool reload_principal_map(void)
+void append_journal(char type,const std::string& name,unsigned int id)
 {
-// load group if present
-    if( PrincipalMapFileName == NULL ) return(true);
-
-    struct stat my_stat;
-    if( stat(PrincipalMapFileName,&my_stat) != 0 ){
-        syslog(LOG_INFO,"unable to stat the principalmap file %s",(const char*)PrincipalMapFileName);
-        return(false);
-    }
+    if( JournalFD < 0 ) return;
+
+    char buffer[32];
+    snprintf(buffer,sizeof(buffer)," %u\n",id);
+
+    pthread_mutex_lock(&JournalLock);
+    JournalBuffer.push_back(type);
+    JournalBuffer.push_back(' ');
+    JournalBuffer.append(name);
+    JournalBuffer.append(buffer);
+    __atomic_store_n(&JournalAppended,JournalAppended+1,__ATOMIC_RELEASE);
+    pthread_cond_signal(&JournalCond);
+    pthread_mutex_unlock(&JournalLock);
+}
 
-    bool reload = false;
-    reload |= my_stat.st_ino != LastPrincMapStat.st_ino;
-    reload |= my_stat.st_size != LastPrincMapStat.st_size;
-    reload |= my_stat.st_mtime != LastPrincMapStat.st_mtime;
+// -----------------------------------------------------------------------------
 
-    // reload the group if the file was modified
-    if( reload == true )  return(load_principal_map());
+// wait until all already appended records are on the disk,
+// it returns false if they cannot be written
+bool sync_journal(void)
+{
+    if( __atomic_load_n(&JournalSynced,__ATOMIC_ACQUIRE) >= __atomic_load_n(&JournalAppended,__ATOMIC_ACQUIRE) ) return(true);
 
-    return(true);
+    pthread_mutex_lock(&JournalLock);
+    uint64_t appended = JournalAppended;
+    while( JournalStarted && (JournalSynced < appended) && (JournalFailed < appended) ){
+        pthread_cond_wait(&JournalSyncCond,&JournalLock);
+    }
+    bool result = JournalSynced >= appended;
+    pthread_mutex_unlock(&JournalLock);
+    return(result);
 }
 
 // -----------------------------------------------------------------------------
 
-void finalize_server(void)
+// write all pending records, only the journal thread writes to the journal
+void flush_journal(void)
 {
-    if( ServerSocket >= 0 ) close(ServerSocket);
-    unlink(SERVERNAME);
+    pthread_mutex_lock(&JournalLock);
+    std::string data;
+    data.swap(JournalBuffer);
+    uint64_t appended = JournalAppended;
+    size_t keep_from = JournalKeep ? JournalKeepFrom : std::string::npos;
+    JournalKeepFrom = 0;
+    pthread_mutex_unlock(&JournalLock);
+
+    // records of the failed write are written again together with new ones,
+    // all records collected in the meantime are synced at once
+    bool failing = JournalBroken || (JournalUnsynced.empty() == false);
+    JournalUnsynced.append(data);
+    JournalFlushed = appended;
+
+    bool written = false;
+    if( JournalBroken == false ){
+        written = write_data(JournalFD,JournalUnsynced.c_str(),JournalUnsynced.size()) && (fdatasync(JournalFD) == 0);
+        if( written ){
+            JournalSize += JournalUnsynced.size();
+            JournalUnsynced.clear();
+        } else {
+            syslog(LOG_ERR,"unable to write the journal %s (%s)",JournalFileName.c_str(),strerror(errno));
+            // an incomplete record would be merged with the next one
+            if( ftruncate(JournalFD,JournalSize) != 0 ){
+                syslog(LOG_ERR,"unable to truncate the journal %s (%s), it is replaced by the next cache write",JournalFileName.c_str(),strerror(errno));
+                JournalBroken = true;
+            }
+        }
+    }
 
-    syslog(LOG_INFO,"closing server");
+    // ids are stored by the cache if the journal cannot be written
+    if( (written == false) && (failing == false) ) request_checkpoint();
 
-    // close syslog
-    closelog();
+    pthread_mutex_lock(&JournalLock);
+    if( JournalKeep && (keep_from < data.size()) ){
+        JournalKept.append(data,keep_from,std::string::npos);
+    }
+    if( written ){
+        __atomic_store_n(&JournalSynced,appended,__ATOMIC_RELEASE);
+    } else {
+        JournalFailed = appended;
+    }
+    pthread_cond_broadcast(&JournalSyncCond);
+    pthread_mutex_unlock(&JournalLock);
 }
 
 // -----------------------------------------------------------------------------
 
-void start_main_loop(void)
+// records appended from now are kept for the journal replacement,
+// DataLock must be held thus the cache copy contains all previous records
+void mark_journal(void)
 {
-    int                 connsckt;
-    struct sockaddr_un  address;
-    socklen_t           address_length = sizeof(address);
+    if( JournalStarted == false ) return;
 
-    while( (connsckt = accept(ServerSocket,(struct sockaddr *)&address,&address_length)) > -1 ){
-        // receive message
-        struct SNFS4Message data;
-        memset(&data,0,sizeof(data));
+    pthread_mutex_lock(&JournalLock);
+    JournalKeep = true;
+    JournalKeepFrom = JournalBuffer.size();
+    JournalKept.clear();
+    pthread_mutex_unlock(&JournalLock);
+}
 
-        // receive data --------------------------
-        if( read(connsckt,&data,sizeof(data)) != sizeof(data) ){
-            syslog(LOG_ERR,"unable to receive message");
-        }
-        
-        if( Verbose ){
-            syslog(LOG_INFO,"request: type(%d), ID(%d), Extra(%d), name(%s)",data.Type,data.ID.UID,data.Extra.UID,data.Name);
-        }
+// -----------------------------------------------------------------------------
 
-        // supplementary data
-        std::string extra_data;
+// remove records, which are in the cache, from the journal
+void truncate_journal(bool saved)
+{
+    if( JournalFD < 0 ) return;
 
-        // process data --------------------------
-        try{           
-            switch(data.Type){
+    // during the start only, no records are appended
+    if( JournalStarted == false ){
+        if( saved ){
+            if( (ftruncate(JournalFD,0) != 0) || (fdatasync(JournalFD) != 0) ){
+                syslog(LOG_ERR,"unable to truncate the journal %s (%s)",JournalFileName.c_str(),strerror(errno));
+            }
+            JournalSize = 0;
+        }
+        return;
+    }
 
-                case MSG_IDMAP_REG_NAME:{
-                    // check if sender is root
-                    bool authorized = false;
-                    struct ucred cred;
-                    socklen_t credlen = sizeof(cred);
-                    if( getsockopt(connsckt,SOL_SOCKET,SO_PEERCRED,&cred,&credlen) == 0 ){
-                        if( cred.uid == 0 ){
-                            authorized = true;
-                         }
-                    }
+    pthread_mutex_lock(&JournalLock);
+    if( saved ){
+        // the journal is replaced by kept records by the journal thread
+        JournalTruncate = true;
+        pthread_cond_signal(&JournalCond);
+        while( JournalTruncate ){
+            pthread_cond_wait(&JournalSyncCond,&JournalLock);
+        }
+    } else {
+        JournalKeep = false;
+        JournalKept.clear();
+    }
+    pthread_mutex_unlock(&JournalLock);
+}
 
-                    if( authorized == false ){
-                        memset(&data,0,sizeof(data));
-                        data.Type = MSG_INVALID;
-                        syslog(LOG_INFO,"unauthorized request");
-                        break;
-                    }
+// -----------------------------------------------------------------------------
 
-                    // perform operation
-                    uid_t   uid = 0;
-                    std::string name(data.Name);
-                    std::string lname;
-
-                    if( ! is_domain_local(name,lname) ){
-                        // get id
-                        uid = UserToID[name];
-                        if( uid == 0 ){
-                            // not registered - create new record
-                            TopUserID++;
-                            UserToID[name] = TopUserID;
-                            IDToUser[TopUserID] = name;
-                            uid = TopUserID;
-                        }
-                        uid = uid + BaseID;
-                    }
+// replace the journal by kept records, only the journal thread writes to the journal
+void replace_journal(void)
+{
+    pthread_mutex_lock(&JournalLock);
+    std::string data;
+    data.swap(JournalKept);
+    JournalKeep = false;
+    pthread_mutex_unlock(&JournalLock);
+
+    bool replaced = false;
+    if( data.empty() ){
+        // both the old and the empty journal are valid after a crash
+        if( ftruncate(JournalFD,0) == 0 ){
+            JournalSize = 0;
+            replaced = fdatasync(JournalFD) == 0;
+        }
+        if( replaced == false ){
+            syslog(LOG_ERR,"unable to truncate the journal %s (%s)",JournalFileName.c_str(),strerror(errno));
+        }
+    } else {
+        // kept records must not be lost, the new journal replaces the old one
+        // by rename, and it is placed to the same descriptor
+        std::string tmpname = JournalFileName + ".new";
+        int fd = open(tmpname.c_str(),O_WRONLY | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC,S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if( (fd >= 0) && (fchmod(fd,S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0) &&
+            write_data(fd,data.c_str(),data.size()) && (fdatasync(fd) == 0) &&
+            (rename(tmpname.c_str(),JournalFileName.c_str()) == 0) ){
+            dup2(fd,JournalFD);
+            SyncFileDirectory(JournalFileName.c_str());
+            JournalSize = data.size();
+            replaced = true;
+        } else {
+            syslog(LOG_ERR,"unable to replace the journal %s (%s)",JournalFileName.c_str(),strerror(errno));
+            unlink(tmpname.c_str());
+        }
+        if( fd >= 0 ) close(fd);
+    }
 
-                    memset(&data,0,sizeof(data));
-                    data.Type = MSG_IDMAP_REG_NAME;
-                    data.ID.UID = uid;
-                    data.Extra.UID = NobodyID;
-                    strncpy(data.Name,lname.c_str(),MAX_NAME);
-                }
-                break;
+    // all flushed records are either in the cache or in the new journal
+    if( replaced ){
+        JournalUnsynced.clear();
+        JournalBroken = false;
+    }
 
-                case MSG_IDMAP_REG_GROUP:{
-                    // check if sender is root
-                    bool authorized = false;
-                    struct ucred cred;
-                    socklen_t credlen = sizeof(cred);
-                    if( getsockopt(connsckt,SOL_SOCKET,SO_PEERCRED,&cred,&credlen) == 0 ){
-                        if( cred.uid == 0 ){
-                            authorized = true;
-                         }
-                    }
-                    if( authorized == false ){
-                        memset(&data,0,sizeof(data));
-                        data.Type = MSG_INVALID;
-                        syslog(LOG_INFO,"unauthorized request");
-                        break;
-                    }
+    pthread_mutex_lock(&JournalLock);
+    if( replaced && (JournalSynced < JournalFlushed) ){
+        __atomic_store_n(&JournalSynced,JournalFlushed,__ATOMIC_RELEASE);
+    }
+    JournalTruncate = false;
+    pthread_cond_broadcast(&JournalSyncCond);
+    pthread_mutex_unlock(&JournalLock);
+}
 
-                    // perform operation
-                    gid_t gid = 0;
-                    std::string name(data.Name);
-                    std::string lname;
-
-                    if( ! is_domain_local(name,lname) ){
-                        // get id
-                        gid = GroupToID[name];
-                        if( gid == 0 ){
-                            // not registered - create new record
-                            TopGroupID++;
-                            GroupToID[name] = TopGroupID;
-                            IDToGroup[TopGroupID] = name;
-                            gid = TopGroupID;
-                        }
-                        gid = gid + BaseID;
-                    }
+// -----------------------------------------------------------------------------
 
-                    memset(&data,0,sizeof(data));
-                    data.Type = MSG_IDMAP_REG_GROUP;
-                    data.ID.GID = gid;
-                    data.Extra.GID = NoGroupID;
-                    strncpy(data.Name,lname.c_str(),MAX_NAME);
-                }
-                break;
+void* journal_main(void* p_arg)
+{
+    pthread_mutex_lock(&JournalLock);
+    for(;;){
+        if( JournalTruncate ){
+            pthread_mutex_unlock(&JournalLock);
+            replace_journal();
+            pthread_mutex_lock(&JournalLock);
+            continue;
+        }
+        if( JournalBuffer.empty() ){
+            if( StopJournal ) break;
+            if( JournalUnsynced.empty() && (JournalBroken == false) ){
+                pthread_cond_wait(&JournalCond,&JournalLock);
+                continue;
+            }
+            // repeat the failed write
+            struct timespec retry;
+            clock_gettime(CLOCK_REALTIME,&retry);
+            retry.tv_sec += JOURNAL_RETRY;
+            if( pthread_cond_timedwait(&JournalCond,&JournalLock,&retry) != ETIMEDOUT ) continue;
+        }
+        pthread_mutex_unlock(&JournalLock);
 
-                case MSG_IDMAP_PRINC_TO_ID:{
+        flush_journal();
 
-                    reload_principal_map(); // reload map if necessary
+        // fold the journal into the cache, it is written by the checkpoint thread
+        if( JournalSize > JOURNAL_LIMIT ) request_checkpoint();
 
-                    std::string name(data.Name);
-                    std::string lname;
+        pthread_mutex_lock(&JournalLock);
+    }
+    pthread_mutex_unlock(&JournalLock);
+    return(NULL);
+}
 
-                    if( PrincipalMap.count(name) == 1 ){
-                        lname = PrincipalMap[name];
-                    } else {
-                        lname = is_princ_local(name);
-                    }
+// -----------------------------------------------------------------------------
 
-                    memset(&data,0,sizeof(data));
-                    data.Type = MSG_IDMAP_PRINC_TO_ID;
-
-                    if( (! lname.empty()) && (lname.find("@") == std::string::npos) ){
-                        struct passwd *p_pwd = getpwnam(lname.c_str());  // only LOCAL query!!!
-                        if( p_pwd != NULL ){
-                            strncpy(data.Name,lname.c_str(),MAX_NAME);
-                            data.ID.UID = p_pwd->pw_uid;
-                            data.Extra.GID = p_pwd->pw_gid;
-                        }
-                    }
-                    // root squash
-                    if( (data.ID.UID == 0) || (data.Extra.GID == 0) ){
-                        strncpy(data.Name,NoBody.c_str(),MAX_NAME);
-                        data.ID.UID = NobodyID;
-                        data.Extra.GID = NoGroupID;
-                    }
-                }
-                break;
+bool start_checkpointer(void)
+{
+    if( CacheFileName == NULL ) return(true);
 
-            case MSG_IDMAP_USER_TO_LOCAL_DOMAIN:{
+    CheckpointStarted = pthread_create(&CheckpointThread,NULL,checkpoint_main,NULL) == 0;
 
-                    std::string name(data.Name);
+    if( CheckpointStarted == false ){
+        syslog(LOG_ERR,"unable to start cache checkpointer");
+    }
+    return(CheckpointStarted);
+}
 
-                    if( name == "root" ){
-                        name = NoBody;
-                    } else {
-                        map_to_localdomain_ifnecessary(name);
-                    }
+// -----------------------------------------------------------------------------
 
-                    memset(&data,0,sizeof(data));
-                    data.Type = MSG_IDMAP_USER_TO_LOCAL_DOMAIN;
-                    strncpy(data.Name,name.c_str(),MAX_NAME);
-                }
-                break;
+void stop_checkpointer(void)
+{
+    if( CheckpointStarted == false ) return;
 
-            case MSG_IDMAP_GROUP_TO_LOCAL_DOMAIN:{
+    // the checkpoint in progress is finished
+    pthread_mutex_lock(&CheckpointLock);
+    StopCheckpoint = true;
+    pthread_cond_signal(&CheckpointCond);
+    pthread_mutex_unlock(&CheckpointLock);
 
-                    std::string name(data.Name);
+    pthread_join(CheckpointThread,NULL);
+    CheckpointStarted = false;
+}
 
-                    if( name == "root" ){
-                        name = NoGroup;
-                    } else {
-                        map_to_localdomain_ifnecessary(name);
+// -----------------------------------------------------------------------------
+
+void request_checkpoint(void)
+{
+    pthread_mutex_lock(&CheckpointLock);
+    CheckpointRequested = true;
+    pthread_cond_signal(&CheckpointCond);
+    pthread_mutex_unlock(&CheckpointLock);
+}
+
+// -----------------------------------------------------------------------------
+
+void* checkpoint_main(void* p_arg)
+{
+    struct timespec next;
+    clock_gettime(CLOCK_REALTIME,&next);
+    next.tv_sec += CheckpointInterval;
+
+    pthread_mutex_lock(&CheckpointLock);
+    while( StopCheckpoint == false ){
+        if( CheckpointRequested == false ){
+            if( CheckpointInterval == 0 ){
+                pthread_cond_wait(&CheckpointCond,&CheckpointLock);
+                continue;
+            }
+            if( pthread_cond_timedwait(&CheckpointCond,&CheckpointLock,&next) != ETIMEDOUT ) continue;
+        }
+        CheckpointRequested = false;
+        pthread_mutex_unlock(&CheckpointLock);
+
+        // the cache is written only if new ids were allocated
+        if( is_cache_changed() ) save_cache();
+
+        clock_gettime(CLOCK_REALTIME,&next);
+        next.tv_sec += CheckpointInterval;
+
+        pthread_mutex_lock(&CheckpointLock);
+    }
+    pthread_mutex_unlock(&CheckpointLock);
+    return(NULL);
+}
+
+// -----------------------------------------------------------------------------
+
+bool load_group(void)
+{
+// load group if present
+    if( GroupFileName == NULL ) return(true);
+
+    syslog(LOG_INFO,"group file: %s",(const char*)GroupFileName);
+
+    double stime = get_time();
+
+    memset(&LastGroupStat,0,sizeof(LastGroupStat));
+
+    if( stat(GroupFileName,&LastGroupStat) != 0 ){
+        syslog(LOG_INFO,"unable to stat the group file %s",(const char*)GroupFileName);
+        if( IgnoreIfNotExist ) {
+            syslog(LOG_INFO,"but ignored as requested (IgnoreIfNotExist = on)");
+            return(true);
+        }
+        return(false);
+    }
+    if( (LastGroupStat.st_uid != 0) || (LastGroupStat.st_gid != 0) || ((LastGroupStat.st_mode & 0777) != 0644) ){
+        syslog(LOG_INFO,"wrong access rights on the group file %s(%d:%d/%o) (root:root/0644 is required)",(const char*)GroupFileName,LastGroupStat.st_uid,LastGroupStat.st_gid,(LastGroupStat.st_mode & 0777));
+        return(false);
+    }
+
+    // collect members of groups, a group can be on more lines
+    std::map<std::string,std::string> group_lines;
+
+    std::ifstream fin;
+    fin.open(GroupFileName);
+    std::string line;
+    while( getline(fin,line) ){
+        // name:password:gid:members
+        size_t p1 = line.find(':');
+        if( p1 == std::string::npos ) continue;
+        size_t p2 = line.find(':',p1+1);
+        if( p2 == std::string::npos ) continue;
+        size_t p3 = line.find(':',p2+1);
+        if( (p3 == std::string::npos) || (line.find(':',p3+1) != std::string::npos) ) continue;
+        if( line.find('@') >= p1 ) continue;
+        std::string& members = group_lines[line.substr(0,p1)];
+        if( ! members.empty() ) members += ",";
+        members.append(line,p3+1,std::string::npos);
+    }
+    fin.close();
+
+    // only new and changed groups are parsed, it is slow for large groups
+    // because local accounts are queried for all members, unchanged groups
+    // only re-check local accounts of their members from LocalDomains
+    std::map<std::string,SGroupState>               group_states;
+    std::map<std::string, std::set<std::string> >  group_members;  // new and changed groups
+    std::vector<std::pair<SGroupState*,SGroupState*> >
+                                                    unchanged;      // new and previous states
+    std::map<std::string,std::string>               aliases;        // local aliases of members
+    std::set<std::string>                           users;
+    int ulnum = 0;
+    int lcnum = 0;
+    int lnum = 0;
+
+    std::map<std::string,std::string>::iterator lit = group_lines.begin();
+    std::map<std::string,std::string>::iterator lie = group_lines.end();
+    while( lit != lie ){
+        const std::string& gname = lit->first;
+        SGroupState& state = group_states[gname];
+        state.Hash = get_line_hash(lit->second);
+
+        std::map<std::string,SGroupState>::iterator hit = GroupStates.find(gname);
+        if( (hit != GroupStates.end()) && (hit->second.Hash == state.Hash) ){
+            if( is_local_mapping_changed(hit->second,aliases) == false ){
+                unchanged.push_back(std::make_pair(&state,&hit->second));
+                lit++;
+                continue;
+            }
+            lcnum++;
+        }
+
+        // the server is terminating
+        if( (++lnum % 1024 == 0) && is_reload_cancelled() ){
+            syslog(LOG_INFO,"loading of the group file was cancelled");
+            return(false);
+        }
+
+        std::set<std::string>& members = group_members[gname];
+        std::vector<std::string> usrs;
+        boost::split(usrs,lit->second,boost::is_any_of(","));
+        std::vector<std::string>::iterator it = usrs.begin();
+        std::vector<std::string>::iterator ie = usrs.end();
+        while( it != ie ){
+            std::string uname = *it;
+            if( uname.find("@") != std::string::npos ){
+                users.insert(uname);
+                // add user with domain
+                members.insert(uname);
+                // and again if it can be mapped to local account and the mapping is allowed
+                // this is important for proper function of rsync with --chown or --groupmap
+                // RT#202411
+                // well after some discussion this will not be used as it can make mess on local FSs
+                if( is_local_domain_member(uname) ){
+                    const std::string& lname = get_member_alias(uname,aliases);
+                    state.LocalMembers.push_back(std::make_pair(uname,! lname.empty()));
+                    if( ! lname.empty() ){
+                        members.insert(lname);
+                        ulnum++;
                     }
+                }
+            }
+            it++;
+        }
+        lit++;
+    }
+
+    // groups removed from the file keep their ids
+    std::vector<std::string> removed_groups;
+    std::map<std::string,SGroupState>::iterator hit = GroupStates.begin();
+    std::map<std::string,SGroupState>::iterator hie = GroupStates.end();
+    while( hit != hie ){
+        if( group_states.find(hit->first) == group_states.end() ) removed_groups.push_back(hit->first);
+        hit++;
+    }
+
+    double ptime = get_time();
+
+    // register new users and groups, readers wait only for this step
+    std::vector<gid_t> gids;
+    gids.reserve(group_members.size());
+    std::vector<gid_t> removed;
+    int uinum = 0;
+    int ginum = 0;
+    size_t num_of_groups = 0;
+    {
+        CWriteLock lock(&DataLock);
+
+        std::map<std::string, std::set<std::string> >::iterator git = group_members.begin();
+        std::map<std::string, std::set<std::string> >::iterator gie = group_members.end();
+        while( git != gie ){
+            gid_t gid = Groups.FindID(git->first);
+            if( gid == 0 ){
+                gid = allocate_group(git->first);
+            } else {
+                ginum++;
+            }
+            gids.push_back(gid);
+            git++;
+        }
+
+        std::set<std::string>::iterator uit = users.begin();
+        std::set<std::string>::iterator uie = users.end();
+        while( uit != uie ){
+            if( Users.FindID(*uit) == 0 ){
+                allocate_user(*uit);
+            } else {
+                uinum++;
+            }
+            uit++;
+        }
+
+        for(size_t i=0; i < removed_groups.size(); i++){
+            gid_t gid = Groups.FindID(removed_groups[i]);
+            if( gid != 0 ) removed.push_back(gid);
+        }
+
+        num_of_groups = Groups.GetTopID() + 1;
+    }
+
+    // new ids are safely stored before they are published, the load is repeated
+    // after the next check of the file
+    if( sync_journal() == false ){
+        syslog(LOG_ERR,"unable to store ids of the group file in the journal, the group file is not loaded");
+        memset(&LastGroupStat,0,sizeof(LastGroupStat));
+        return(false);
+    }
+
+    // the load cannot fail anymore, unchanged groups take their members over
+    for(size_t i=0; i < unchanged.size(); i++){
+        unchanged[i].first->LocalMembers.swap(unchanged[i].second->LocalMembers);
+    }
+
+    double rtime = get_time();
+
+    // start from the current membership and update only changed groups,
+    // shards without any changed group or member are shared
+    boost::shared_ptr<SMembership> p_membership(new SMembership(*get_membership()));
+    p_membership->GroupShards.resize((num_of_groups + GROUP_SHARD_SIZE - 1) / GROUP_SHARD_SIZE);
+    SMembershipChange change;
+    change.GroupShards.resize(p_membership->GroupShards.size());
+    change.MemberShards.resize(MEMBER_SHARDS);
+
+    for(size_t i=0; i < removed.size(); i++){
+        remove_group_members(*p_membership,change,removed[i]);
+    }
+
+    // serialize members once, they are sent without any change
+    std::map<std::string, std::set<std::string> >::iterator git = group_members.begin();
+    std::map<std::string, std::set<std::string> >::iterator gie = group_members.end();
+    for(size_t i=0; git != gie; git++, i++){
+        gid_t gid = gids[i];
+        remove_group_members(*p_membership,change,gid);
+        SGroupRecord& rec = change_group_record(*p_membership,change,gid);
+        strncpy(rec.Header.Name,git->first.c_str(),MAX_NAME);
+        rec.Header.ID.GID = gid + BaseID;
+        rec.Header.Extra.GID = git->second.size();
+        if( git->second.size() > 0 ){
+            std::string* p_blob = new std::string;
+            std::set<std::string>::iterator it = git->second.begin();
+            std::set<std::string>::iterator ie = git->second.end();
+            while( it != ie ){
+                p_blob->append(it->c_str(),it->size()+1);
+                change_member_shard(*p_membership,change,*it)[*it].insert(gid);
+                it++;
+            }
+            rec.Header.Len = p_blob->size();
+            rec.Members.reset(p_blob);
+        }
+    }
+
+    double btime = get_time();
+
+    // publish the new membership, the old one is released by the last reader
+    boost::shared_ptr<const SMembership> p_old = set_membership(p_membership);
+
+    double etime = get_time();
+
+    p_old.reset();
+    GroupStates.swap(group_states);
+
+    syslog(LOG_INFO,"group items (users/groups): %d/%d",(int)users.size(),(int)GroupStates.size());
+    syslog(LOG_INFO,"changed groups (new or modified/removed/unchanged): %d/%d/%d",
+           (int)group_members.size(),(int)removed.size(),(int)(GroupStates.size()-group_members.size()));
+    syslog(LOG_INFO,"groups changed by local accounts of their members: %d",lcnum);
+    syslog(LOG_INFO,"group items already read from cache (users/groups): %d/%d",uinum,ginum);
+    syslog(LOG_INFO,"users mapped to local users: %d",ulnum);
+    syslog(LOG_INFO,"group file loaded in %.3f s (parse %.3f s, registration %.3f s, build %.3f s, swap %.1f us)",
+           etime-stime,ptime-stime,rtime-ptime,btime-rtime,(etime-btime)*1e6);
+    log_local_cache_stat();
+
+    // group members were changed
+    if( (group_members.size() > 0) || (removed.size() > 0) ){
+        clear_princ_cache();
+        change_generation();
+        request_snapshot();
+    }
+
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+// FNV-1a hash of the group line
+uint64_t get_line_hash(const std::string& line)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i=0; i < line.size(); i++){
+        hash ^= (unsigned char)line[i];
+        hash *= 1099511628211ULL;
+    }
+    return(hash);
+}
+
+// -----------------------------------------------------------------------------
+
+// the member is from LocalDomains, thus it can be mapped to a local account
+bool is_local_domain_member(const std::string& name)
+{
+    size_t pos = name.find('@');
+    if( pos == std::string::npos ) return(false);
+    return(LocalDomains.count(name.substr(pos+1)) > 0);
+}
+
+// -----------------------------------------------------------------------------
+
+// local alias of the member (see can_user_be_local()), each member is
+// queried only once during one load
+const std::string& get_member_alias(const std::string& name,std::map<std::string,std::string>& aliases)
+{
+    std::map<std::string,std::string>::iterator it = aliases.find(name);
+    if( it == aliases.end() ){
+        it = aliases.insert(std::make_pair(name,can_user_be_local(name))).first;
+    }
+    return(it->second);
+}
+
+// -----------------------------------------------------------------------------
+
+// test if any member gained or lost the local account since the last load
+bool is_local_mapping_changed(const SGroupState& state,std::map<std::string,std::string>& aliases)
+{
+    for(size_t i=0; i < state.LocalMembers.size(); i++){
+        bool local = ! get_member_alias(state.LocalMembers[i].first,aliases).empty();
+        if( local != state.LocalMembers[i].second ) return(true);
+    }
+    return(false);
+}
+
+// -----------------------------------------------------------------------------
+
+// clear the group record and remove the group from the member index
+void remove_group_members(SMembership& membership,SMembershipChange& change,gid_t gid)
+{
+    const SGroupRecord* p_rec = find_group_record(membership,gid);
+    if( (p_rec == NULL) || (p_rec->Header.ID.GID == 0) ) return;
+
+    SGroupRecord& rec = change_group_record(membership,change,gid);
+
+    if( rec.Members != NULL ){
+        const std::string& blob = *rec.Members;
+        size_t pos = 0;
+        while( pos < blob.size() ){
+            std::string member(blob.c_str() + pos);
+            pos += member.size() + 1;
+            SMemberShard& shard = change_member_shard(membership,change,member);
+            SMemberShard::iterator mit = shard.find(member);
+            if( mit == shard.end() ) continue;
+            mit->second.erase(gid);
+            if( mit->second.empty() ) shard.erase(mit);
+        }
+    }
+
+    memset(&rec.Header,0,sizeof(rec.Header));
+    rec.Members.reset();
+}
+
+// -----------------------------------------------------------------------------
+
+size_t get_member_shard(const std::string& member)
+{
+    return(get_line_hash(member) % MEMBER_SHARDS);
+}
+
+// -----------------------------------------------------------------------------
+
+// NULL if the group is not in the group file
+const SGroupRecord* find_group_record(const SMembership& membership,gid_t gid)
+{
+    size_t index = gid / GROUP_SHARD_SIZE;
+    if( (index >= membership.GroupShards.size()) || (membership.GroupShards[index] == NULL) ) return(NULL);
+    return(&(*membership.GroupShards[index])[gid % GROUP_SHARD_SIZE]);
+}
+
+// -----------------------------------------------------------------------------
+
+// NULL if the member is not in any group
+const std::set<gid_t>* find_member_groups(const SMembership& membership,const std::string& member)
+{
+    const boost::shared_ptr<const SMemberShard>& p_shard = membership.MemberShards[get_member_shard(member)];
+    if( p_shard == NULL ) return(NULL);
+    SMemberShard::const_iterator mit = p_shard->find(member);
+    if( mit == p_shard->end() ) return(NULL);
+    return(&mit->second);
+}
+
+// -----------------------------------------------------------------------------
+
+// the shard is copied on the first change, shared shards are never modified
+SGroupRecord& change_group_record(SMembership& membership,SMembershipChange& change,gid_t gid)
+{
+    size_t index = gid / GROUP_SHARD_SIZE;
+    if( change.GroupShards[index] == NULL ){
+        SGroupShard* p_shard;
+        if( membership.GroupShards[index] != NULL ){
+            p_shard = new SGroupShard(*membership.GroupShards[index]);
+        } else {
+            SGroupRecord empty;
+            memset(&empty.Header,0,sizeof(empty.Header));
+            p_shard = new SGroupShard(GROUP_SHARD_SIZE,empty);
+        }
+        membership.GroupShards[index].reset(p_shard);
+        change.GroupShards[index] = p_shard;
+    }
+    return((*change.GroupShards[index])[gid % GROUP_SHARD_SIZE]);
+}
+
+// -----------------------------------------------------------------------------
+
+// the shard is copied on the first change, shared shards are never modified
+SMemberShard& change_member_shard(SMembership& membership,SMembershipChange& change,const std::string& member)
+{
+    size_t index = get_member_shard(member);
+    if( change.MemberShards[index] == NULL ){
+        SMemberShard* p_shard;
+        if( membership.MemberShards[index] != NULL ){
+            p_shard = new SMemberShard(*membership.MemberShards[index]);
+        } else {
+            p_shard = new SMemberShard;
+        }
+        membership.MemberShards[index].reset(p_shard);
+        change.MemberShards[index] = p_shard;
+    }
+    return(*change.MemberShards[index]);
+}
+
+// -----------------------------------------------------------------------------
+
+bool is_file_changed(const struct stat& current,const struct stat& last)
+{
+    // ctime is changed by any write, chmod, chown or rename over the file
+    bool changed = false;
+    changed |= current.st_ino != last.st_ino;
+    changed |= current.st_size != last.st_size;
+    changed |= current.st_mtim.tv_sec != last.st_mtim.tv_sec;
+    changed |= current.st_mtim.tv_nsec != last.st_mtim.tv_nsec;
+    changed |= current.st_ctim.tv_sec != last.st_ctim.tv_sec;
+    changed |= current.st_ctim.tv_nsec != last.st_ctim.tv_nsec;
+    return(changed);
+}
+
+// -----------------------------------------------------------------------------
+
+bool reload_group(void)
+{
+    if( GroupFileName == NULL ) return(true);
+
+    struct stat my_stat;
+    if( stat(GroupFileName,&my_stat) != 0 ){
+        if( IgnoreIfNotExist ) return(true);
+        // report only once
+        if( LastGroupStat.st_ino != 0 ){
+            syslog(LOG_INFO,"unable to stat the group file %s",(const char*)GroupFileName);
+            memset(&LastGroupStat,0,sizeof(LastGroupStat));
+        }
+        return(false);
+    }
+
+    // reload the group if the file was modified
+    if( is_file_changed(my_stat,LastGroupStat) == false ) return(true);
+
+    return(load_group());
+}
+
+// -----------------------------------------------------------------------------
+
+bool load_principal_map(void)
+{
+// load group if present
+    if( PrincipalMapFileName == NULL ) return(true);
+
+    syslog(LOG_INFO,"principalmap file: %s",(const char*)PrincipalMapFileName);
+
+    memset(&LastPrincMapStat,0,sizeof(LastPrincMapStat));
+
+    if( stat(PrincipalMapFileName,&LastPrincMapStat) != 0 ){
+        syslog(LOG_INFO,"unable to stat the principalmap file %s",(const char*)PrincipalMapFileName);
+        return(false);
+    }
+    if( (LastPrincMapStat.st_uid != 0) || (LastPrincMapStat.st_gid != 0) || ((LastPrincMapStat.st_mode & 0777) != 0644) ){
+        syslog(LOG_INFO,"wrong access rights on the principalmap file %s(%d:%d/%o) (root:root/0644 is required)",(const char*)PrincipalMapFileName,LastPrincMapStat.st_uid,LastPrincMapStat.st_gid,(LastPrincMapStat.st_mode & 0777));
+        return(false);
+    }
+
+    // the file can be re-loaded over time - read it aside and then apply only changes
+    std::map<std::string,std::string> princ_map;
+
+    std::ifstream fin;
+    fin.open(PrincipalMapFileName);
+    std::string line;
+    while( getline(fin,line) ){
+        std::vector<std::string> strs;
+        boost::split(strs,line,boost::is_any_of(":"));
+        if( strs.size() == 2 ){
+            if( strs[1] == "root" ) continue;
+            princ_map[strs[0]] = strs[1];
+        }
+    }
+
+    fin.close();
+
+    // both maps are sorted, thus they can be merged in one pass
+    std::vector<std::pair<std::string,std::string> >    changed;
+    std::vector<std::string>                            removed;
+    {
+        CReadLock lock(&DataLock);
+        std::map<std::string,std::string>::iterator nit = princ_map.begin();
+        std::map<std::string,std::string>::iterator nie = princ_map.end();
+        std::map<std::string,std::string>::iterator oit = PrincipalMap.begin();
+        std::map<std::string,std::string>::iterator oie = PrincipalMap.end();
+        while( (nit != nie) || (oit != oie) ){
+            if( (oit == oie) || ((nit != nie) && (nit->first < oit->first)) ){
+                changed.push_back(*nit);
+                nit++;
+            } else if( (nit == nie) || (oit->first < nit->first) ){
+                removed.push_back(oit->first);
+                oit++;
+            } else {
+                if( nit->second != oit->second ) changed.push_back(*nit);
+                nit++;
+                oit++;
+            }
+        }
+    }
+
+    // only this thread modifies the map
+    if( (changed.size() > 0) || (removed.size() > 0) ){
+        CWriteLock lock(&DataLock);
+        for(size_t i=0; i < changed.size(); i++){
+            PrincipalMap[changed[i].first] = changed[i].second;
+        }
+        for(size_t i=0; i < removed.size(); i++){
+            PrincipalMap.erase(removed[i]);
+        }
+    }
+    if( (changed.size() > 0) || (removed.size() > 0) ){
+        clear_princ_cache();
+        change_generation();
+    }
+
+    syslog(LOG_INFO,"principalmap items (principal:local): %d",(int)princ_map.size());
+    syslog(LOG_INFO,"principalmap changes (new or modified/removed): %d/%d",(int)changed.size(),(int)removed.size());
+
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+bool reload_principal_map(void)
+{
+// load group if present
+    if( PrincipalMapFileName == NULL ) return(true);
+
+    struct stat my_stat;
+    if( stat(PrincipalMapFileName,&my_stat) != 0 ){
+        // report only once
+        if( LastPrincMapStat.st_ino != 0 ){
+            syslog(LOG_INFO,"unable to stat the principalmap file %s",(const char*)PrincipalMapFileName);
+            memset(&LastPrincMapStat,0,sizeof(LastPrincMapStat));
+        }
+        return(false);
+    }
+
+    // reload the map if the file was modified
+    if( is_file_changed(my_stat,LastPrincMapStat) == false ) return(true);
+
+    return(load_principal_map());
+}
+
+// -----------------------------------------------------------------------------
+
+void finalize_server(void)
+{
+    log_local_cache_stat();
+    finalize_journal();
+    finalize_snapshot();
+    if( ServerSocket >= 0 ) close(ServerSocket);
+    if( EpollFD >= 0 ) close(EpollFD);
+    if( DoneEventFD >= 0 ) close(DoneEventFD);
+    if( InotifyFD >= 0 ) close(InotifyFD);
+    if( SignalFD >= 0 ) close(SignalFD);
+    unlink(SERVERNAME);
+
+    syslog(LOG_INFO,"closing server");
+
+    // close syslog
+    closelog();
+}
+
+// -----------------------------------------------------------------------------
+
+void start_main_loop(void)
+{
+    if( start_workers() == false ) return;
+    if( start_reloader() == false ){
+        stop_workers();
+        return;
+    }
+    if( start_checkpointer() == false ){
+        stop_reloader();
+        stop_workers();
+        return;
+    }
+
+    time_t last_check = time(NULL);
+
+    while( Terminated == false ){
+        struct epoll_event events[64];
+
+        int nevents = epoll_wait(EpollFD,events,64,1000);
+        if( nevents < 0 ){
+            if( errno == EINTR ) continue;
+            syslog(LOG_ERR,"event loop failed (%s)",strerror(errno));
+            break;
+        }
+
+        for(int i=0; i < nevents; i++){
+            if( events[i].data.ptr == NULL ){
+                accept_connections();
+                continue;
+            }
+            if( events[i].data.ptr == &DoneEventFD ){
+                finish_requests();
+                continue;
+            }
+            if( events[i].data.ptr == &InotifyFD ){
+                read_file_events();
+                continue;
+            }
+            if( events[i].data.ptr == &SignalFD ){
+                read_signals();
+                continue;
+            }
+            SConnection* p_conn = (SConnection*)events[i].data.ptr;
+            if( p_conn->State == CONN_CLOSED ){
+                // closed by the previous event
+                continue;
+            }
+            p_conn->Armed = 0;
+            if( events[i].events & EPOLLOUT ){
+                p_conn->WaitWrite = false;
+                send_responses(p_conn);
+            }
+            if( (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && (p_conn->State != CONN_CLOSED) ){
+                receive_request(p_conn);
+            }
+            if( p_conn->State != CONN_CLOSED ){
+                update_connection(p_conn);
+            }
+        }
+
+        // closed connections are deleted after all events, which can refer to them
+        delete_closed_connections();
+
+        // close connections of clients, which do not send or receive data
+        // and reload changed files, all events of one update are thus
+        // handled by one reload
+        time_t now = time(NULL);
+        if( now != last_check ){
+            close_idle_connections();
+            check_files();
+            last_check = now;
+        }
+    }
+
+    stop_reloader();
+    stop_workers();
+    stop_checkpointer();
+
+    // workers are finished - close all connections
+    finish_requests();
+    std::map<int,SConnection*>::iterator it = Connections.begin();
+    std::map<int,SConnection*>::iterator ie = Connections.end();
+    while( it != ie ){
+        close_connection(it->second);
+        it++;
+    }
+    delete_closed_connections();
+}
+
+// -----------------------------------------------------------------------------
+
+void accept_connections(void)
+{
+    int connsckt;
+    while( (connsckt = accept4(ServerSocket,NULL,NULL,SOCK_NONBLOCK | SOCK_CLOEXEC)) > -1 ){
+        SConnection* p_conn = new SConnection;
+        p_conn->Socket = connsckt;
+        p_conn->State = CONN_READ;
+        p_conn->LastActivity = time(NULL);
+        p_conn->Armed = EPOLLIN;
+        p_conn->WaitWrite = false;
+        p_conn->Serial = true;
+        p_conn->NumOfPending = 0;
+        p_conn->Request = NULL;
+        pthread_mutex_init(&p_conn->EnumLock,NULL);
+
+        struct epoll_event event;
+        memset(&event,0,sizeof(event));
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = p_conn;
+        if( epoll_ctl(EpollFD,EPOLL_CTL_ADD,connsckt,&event) != 0 ){
+            syslog(LOG_ERR,"unable to register connection in the event loop");
+            close(connsckt);
+            pthread_mutex_destroy(&p_conn->EnumLock);
+            delete p_conn;
+            continue;
+        }
+        Connections[connsckt] = p_conn;
+    }
+    if( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) ){
+        syslog(LOG_ERR,"unable to accept connection (%s)",strerror(errno));
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool can_receive(SConnection* p_conn)
+{
+    if( p_conn->State == CONN_READ_EXTRA ) return(true);
+    if( p_conn->State != CONN_READ ) return(false);
+    if( p_conn->NumOfPending == 0 ) return(true);
+    return( (p_conn->Serial == false) && (p_conn->NumOfPending < MaxPipelined) );
+}
+
+// -----------------------------------------------------------------------------
+
+void receive_request(SConnection* p_conn)
+{
+    while( can_receive(p_conn) ){
+        SRequest* p_req = p_conn->Request;
+
+        if( p_conn->State == CONN_READ ){
+            // the record is either SNFS4Message (v1) or SNFS4Header with payload (v2)
+            std::vector<char>& buffer = p_conn->RecvBuffer;
+            if( buffer.empty() ) buffer.resize(sizeof(struct SNFS4TaggedHeader) + MAX_NAME_V2 + 1 + MAX_BATCH_DATA);
+
+            ssize_t len = recv(p_conn->Socket,&buffer[0],buffer.size(),MSG_DONTWAIT | MSG_TRUNC);
+            if( len < 0 ){
+                if( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ) return;
+                close_connection(p_conn);
+                return;
+            }
+            if( len == 0 ){
+                // client closed the connection
+                close_connection(p_conn);
+                return;
+            }
+
+            p_conn->LastActivity = time(NULL);
+
+            p_req = new SRequest;
+            p_req->Connection = p_conn;
+            p_req->V2 = false;
+            p_req->Tagged = false;
+            p_req->Tag = 0;
+            p_req->MaxLen = 0;
+            p_req->SentParts = 0;
+            memset(&p_req->Data,0,sizeof(p_req->Data));
+
+            struct SNFS4TaggedHeader tagged;
+            struct SNFS4Header& header = tagged.Header;
+            memset(&tagged,0,sizeof(tagged));
+            if( (size_t)len >= sizeof(header) ) memcpy(&header,&buffer[0],sizeof(header));
+
+            size_t hlen = sizeof(header);
+            if( header.Magic == PROTOCOL_MAGIC_TAGGED ){
+                hlen = sizeof(tagged);
+                if( (size_t)len >= hlen ) memcpy(&tagged.Tag,&buffer[sizeof(header)],sizeof(tagged.Tag));
+            }
+
+            if( (header.Magic == PROTOCOL_MAGIC) || (header.Magic == PROTOCOL_MAGIC_TAGGED) ){
+                const char* p_payload = &buffer[hlen];
+                if( ((size_t)len > buffer.size()) || (header.NameLen > MAX_NAME_V2 + 1)
+                    || (header.DataLen > MAX_BATCH_DATA)
+                    || ((size_t)len != hlen + header.NameLen + header.DataLen)
+                    || ((header.NameLen > 0) && (p_payload[header.NameLen-1] != '\0')) ){
+                    syslog(LOG_ERR,"malformed request");
+                    delete p_req;
+                    close_connection(p_conn);
+                    return;
+                }
+                p_req->V2 = true;
+                p_req->Tagged = header.Magic == PROTOCOL_MAGIC_TAGGED;
+                p_req->Tag = tagged.Tag;
+                p_req->MaxLen = header.MaxLen;
+                p_req->Name.assign(p_payload,header.NameLen > 0 ? header.NameLen - 1 : 0);
+                p_req->RequestData.assign(p_payload + header.NameLen,header.DataLen);
+                p_req->Data.Type = header.Type;
+                p_req->Data.ID.UID = header.ID;
+                p_req->Data.Extra.UID = header.Extra;
+                p_req->Data.Len = header.DataLen;
+                strncpy(p_req->Data.Name,p_req->Name.c_str(),MAX_NAME);
+            } else {
+                if( len != sizeof(p_req->Data) ){
+                    syslog(LOG_ERR,"unable to receive message");
+                    delete p_req;
+                    close_connection(p_conn);
+                    return;
+                }
+                memcpy(&p_req->Data,&buffer[0],sizeof(p_req->Data));
+                p_req->Data.Name[MAX_NAME] = '\0';
+                p_req->Name = p_req->Data.Name;
+
+                // request with extra data - they are sent as the next record
+                if( p_req->Data.Len > 0 ){
+                    if( p_req->Data.Len > MAX_BATCH_DATA ){
+                        syslog(LOG_ERR,"too long request (%ld)",p_req->Data.Len);
+                        delete p_req;
+                        close_connection(p_conn);
+                        return;
+                    }
+                    p_req->RequestData.resize(p_req->Data.Len);
+                    p_conn->Request = p_req;
+                    p_conn->State = CONN_READ_EXTRA;
+                }
+            }
+        }
+
+        if( p_conn->State == CONN_READ_EXTRA ){
+            ssize_t len = recv(p_conn->Socket,&p_req->RequestData[0],p_req->RequestData.size(),MSG_DONTWAIT);
+            if( len < 0 ){
+                if( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ) return;
+                close_connection(p_conn);
+                return;
+            }
+            if( (size_t)len != p_req->RequestData.size() ){
+                syslog(LOG_ERR,"unable to receive extra message");
+                close_connection(p_conn);
+                return;
+            }
+            p_conn->Request = NULL;
+            p_conn->State = CONN_READ;
+        }
+
+        // hand the request over to workers, untagged requests are answered in order,
+        // thus no other request is read until the response is sent
+        p_conn->Serial = p_req->Tagged == false;
+        p_conn->NumOfPending++;
+
+        pthread_mutex_lock(&QueueLock);
+        WorkQueue.push_back(p_req);
+        pthread_cond_signal(&QueueCond);
+        pthread_mutex_unlock(&QueueLock);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void send_responses(SConnection* p_conn)
+{
+    // the first request can be partially sent (v1)
+    while( (p_conn->WaitWrite == false) && (p_conn->SendQueue.empty() == false) ){
+        SRequest* p_req = p_conn->SendQueue.front();
+        bool result = p_req->V2 ? send_response_v2(p_req) : send_response(p_req);
+        if( result == false ){
+            close_connection(p_conn);
+            return;
+        }
+        if( p_conn->WaitWrite ) return;
+
+        p_conn->SendQueue.pop_front();
+        p_conn->NumOfPending--;
+        p_conn->LastActivity = time(NULL);
+        delete p_req;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool send_response(SRequest* p_req)
+{
+    // the response is composed from the message and optional extra data,
+    // each part is sent as one record
+    while( p_req->SentParts < 2 ){
+        const void* p_data = &p_req->Data;
+        size_t      len = sizeof(p_req->Data);
+        if( p_req->SentParts == 1 ){
+            if( p_req->Data.Len == 0 ){
+                p_req->SentParts++;
+                break;
+            }
+            if( p_req->ExtraBlob != NULL ){
+                p_data = p_req->ExtraBlob->data();
+                len = p_req->ExtraBlob->length();
+            } else {
+                p_data = p_req->ExtraData.data();
+                len = p_req->ExtraData.length();
+            }
+        }
+
+        ssize_t slen = send(p_req->Connection->Socket,p_data,len,MSG_DONTWAIT | MSG_NOSIGNAL);
+        if( slen < 0 ){
+            if( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ){
+                // wait until the client drains the socket
+                p_req->Connection->WaitWrite = true;
+                return(true);
+            }
+            if( (p_req->SentParts == 0) || Verbose ){
+                // the extra message can be discarded by client - print info only in verbose mode
+                syslog(LOG_ERR,"unable to send %s",p_req->SentParts == 0 ? "message" : "extra message");
+            }
+            return(false);
+        }
+        if( (size_t)slen != len ){
+            syslog(LOG_ERR,"incomplete message sent");
+            return(false);
+        }
+
+        if( (p_req->SentParts == 1) && Verbose ){
+            syslog(LOG_INFO,"response: type(%d), extra data sent (%ld)",p_req->Data.Type,p_req->Data.Len);
+        }
+        p_req->SentParts++;
+    }
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+bool send_response_v2(SRequest* p_req)
+{
+    // the response is one record composed from the header, name, and extra data
+    const struct SNFS4Message& data = p_req->Data;
+    const std::string* p_name = &p_req->ResponseName;
+    std::string        short_name;
+    if( p_name->empty() || (data.Type == MSG_INVALID) ){
+        short_name = data.Name;
+        p_name = &short_name;
+    }
+
+    const char* p_data = NULL;
+    size_t      len = 0;
+    if( data.Len > 0 ){
+        if( p_req->ExtraBlob != NULL ){
+            p_data = p_req->ExtraBlob->data();
+            len = p_req->ExtraBlob->length();
+        } else {
+            p_data = p_req->ExtraData.data();
+            len = p_req->ExtraData.length();
+        }
+    }
+
+    struct SNFS4TaggedHeader tagged;
+    struct SNFS4Header& header = tagged.Header;
+    memset(&tagged,0,sizeof(tagged));
+    header.Magic = p_req->Tagged ? PROTOCOL_MAGIC_TAGGED : PROTOCOL_MAGIC;
+    tagged.Tag = p_req->Tag;
+    header.Type = data.Type;
+    header.ID = data.ID.UID;
+    header.Extra = data.Extra.UID;
+    header.Generation = data.Generation;
+    header.Instance = data.Instance;
+    header.NameLen = p_name->empty() ? 0 : p_name->length() + 1;
+    header.DataLen = len;
+
+    struct iovec iov[3];
+    iov[0].iov_base = &tagged;
+    iov[0].iov_len = p_req->Tagged ? sizeof(tagged) : sizeof(header);
+    iov[1].iov_base = (void*)p_name->c_str();
+    iov[1].iov_len = header.NameLen;
+    iov[2].iov_base = (void*)p_data;
+    iov[2].iov_len = len;
+
+    size_t payload = (size_t)header.NameLen + len;
+    if( payload > p_req->MaxLen ){
+        // the client provides larger buffer and repeats the request,
+        // NameLen and DataLen are kept so the client knows sizes of both parts
+        header.MaxLen = payload;
+        header.Status = ERANGE;
+        iov[1].iov_len = 0;
+        iov[2].iov_len = 0;
+        if( Verbose ){
+            syslog(LOG_INFO,"response: type(%d), too large payload (%ld)",data.Type,(long)payload);
+        }
+    }
+
+    struct msghdr msg;
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+
+    size_t  total = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+    ssize_t slen = sendmsg(p_req->Connection->Socket,&msg,MSG_DONTWAIT | MSG_NOSIGNAL);
+    if( slen < 0 ){
+        if( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ){
+            // wait until the client drains the socket
+            p_req->Connection->WaitWrite = true;
+            return(true);
+        }
+        syslog(LOG_ERR,"unable to send message");
+        return(false);
+    }
+    if( (size_t)slen != total ){
+        syslog(LOG_ERR,"incomplete message sent");
+        return(false);
+    }
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+void close_connection(SConnection* p_conn)
+{
+    if( p_conn->State == CONN_CLOSED ) return;
+
+    // the socket is closed when workers return all requests of the connection,
+    // thus its descriptor is not reused while they query credentials of the peer
+    epoll_ctl(EpollFD,EPOLL_CTL_DEL,p_conn->Socket,NULL);
+    shutdown(p_conn->Socket,SHUT_RDWR);
+    p_conn->State = CONN_CLOSED;
+
+    delete p_conn->Request;
+    p_conn->Request = NULL;
+    for(size_t i=0; i < p_conn->SendQueue.size(); i++){
+        delete p_conn->SendQueue[i];
+        p_conn->NumOfPending--;
+    }
+    p_conn->SendQueue.clear();
+    ClosedConnections.push_back(p_conn);
+}
+
+// -----------------------------------------------------------------------------
+
+void delete_closed_connections(void)
+{
+    size_t kept = 0;
+    for(size_t i=0; i < ClosedConnections.size(); i++){
+        SConnection* p_conn = ClosedConnections[i];
+        if( p_conn->NumOfPending > 0 ){
+            ClosedConnections[kept++] = p_conn;
+            continue;
+        }
+        Connections.erase(p_conn->Socket);
+        close(p_conn->Socket);
+        pthread_mutex_destroy(&p_conn->EnumLock);
+        delete p_conn;
+    }
+    ClosedConnections.resize(kept);
+}
+
+// -----------------------------------------------------------------------------
+
+void update_connection(SConnection* p_conn)
+{
+    int events = 0;
+    if( can_receive(p_conn) ) events |= EPOLLIN;
+    if( p_conn->WaitWrite ) events |= EPOLLOUT;
+
+    // the connection stays disarmed while workers process all its requests
+    if( (events == 0) || (events == p_conn->Armed) ) return;
+
+    struct epoll_event event;
+    memset(&event,0,sizeof(event));
+    event.events = events | EPOLLONESHOT;
+    event.data.ptr = p_conn;
+    if( epoll_ctl(EpollFD,EPOLL_CTL_MOD,p_conn->Socket,&event) != 0 ){
+        syslog(LOG_ERR,"unable to arm connection in the event loop");
+        close_connection(p_conn);
+        return;
+    }
+    p_conn->Armed = events;
+}
+
+// -----------------------------------------------------------------------------
+
+void finish_requests(void)
+{
+    eventfd_t value;
+    eventfd_read(DoneEventFD,&value);
+
+    std::deque<SRequest*> done;
+    pthread_mutex_lock(&DoneLock);
+    done.swap(DoneQueue);
+    pthread_mutex_unlock(&DoneLock);
+
+    // responses are queued in the order in which workers finished them,
+    // connections with already queued responses wait for the client
+    std::vector<SConnection*> ready;
+    for(size_t i=0; i < done.size(); i++){
+        SRequest*    p_req = done[i];
+        SConnection* p_conn = p_req->Connection;
+        if( p_conn->State == CONN_CLOSED ){
+            p_conn->NumOfPending--;
+            delete p_req;
+            continue;
+        }
+        if( p_conn->SendQueue.empty() ) ready.push_back(p_conn);
+        p_conn->SendQueue.push_back(p_req);
+    }
+
+    for(size_t i=0; i < ready.size(); i++){
+        SConnection* p_conn = ready[i];
+        p_conn->LastActivity = time(NULL);
+        send_responses(p_conn);
+        if( p_conn->State == CONN_CLOSED ) continue;
+
+        // the connection with too many pending tagged requests is not armed
+        // for reading, but the client usually has next requests already queued
+        if( (p_conn->Serial == false) && ((p_conn->Armed & EPOLLIN) == 0) ){
+            receive_request(p_conn);
+            if( p_conn->State == CONN_CLOSED ) continue;
+        }
+        update_connection(p_conn);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void close_idle_connections(void)
+{
+    if( IdleTimeout <= 0 ) return;
+
+    time_t now = time(NULL);
+
+    std::vector<SConnection*> idle;
+    std::map<int,SConnection*>::iterator it = Connections.begin();
+    std::map<int,SConnection*>::iterator ie = Connections.end();
+    while( it != ie ){
+        SConnection* p_conn = it->second;
+        // responses not drained by the client do not keep the connection open
+        if( (p_conn->State != CONN_CLOSED) && ((size_t)p_conn->NumOfPending == p_conn->SendQueue.size())
+            && (now - p_conn->LastActivity > IdleTimeout) ){
+            idle.push_back(p_conn);
+        }
+        it++;
+    }
+
+    for(size_t i=0; i < idle.size(); i++){
+        if( Verbose ){
+            syslog(LOG_INFO,"closing idle connection");
+        }
+        close_connection(idle[i]);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool init_file_watches(void)
+{
+    setup_file_watch(GroupWatch,GroupFileName);
+    setup_file_watch(PrincMapWatch,PrincipalMapFileName);
+
+    InotifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if( InotifyFD < 0 ){
+        syslog(LOG_ERR,"unable to initialize inotify (%s), files are checked every second",strerror(errno));
+        return(false);
+    }
+
+    struct epoll_event event;
+    memset(&event,0,sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &InotifyFD;    // pointer to InotifyFD is file notification
+    if( epoll_ctl(EpollFD,EPOLL_CTL_ADD,InotifyFD,&event) != 0 ){
+        syslog(LOG_ERR,"unable to register file notification in the event loop, files are checked every second");
+        close(InotifyFD);
+        InotifyFD = -1;
+        return(false);
+    }
+
+    bool result = true;
+    if( (GroupWatch.Name.empty() == false) && (add_file_watch(GroupWatch) == false) ){
+        syslog(LOG_ERR,"unable to watch %s (%s), the group file is checked every second",GroupWatch.Directory.c_str(),strerror(errno));
+        result = false;
+    }
+    if( (PrincMapWatch.Name.empty() == false) && (add_file_watch(PrincMapWatch) == false) ){
+        syslog(LOG_ERR,"unable to watch %s (%s), the principalmap file is checked every second",PrincMapWatch.Directory.c_str(),strerror(errno));
+        result = false;
+    }
+    return(result);
+}
+
+// -----------------------------------------------------------------------------
+
+void setup_file_watch(SFileWatch& watch,const char* p_file)
+{
+    watch.WD = -1;
+    watch.Changed = false;
+    watch.Directory.clear();
+    watch.Name.clear();
+    if( p_file == NULL ) return;
+
+    std::string path(p_file);
+    size_t pos = path.rfind('/');
+    if( pos == std::string::npos ){
+        watch.Directory = ".";
+        watch.Name = path;
+    } else {
+        watch.Directory = pos == 0 ? "/" : path.substr(0,pos);
+        watch.Name = path.substr(pos+1);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool add_file_watch(SFileWatch& watch)
+{
+    if( InotifyFD < 0 ) return(false);
+
+    // the directory is watched, thus the file can be created, removed or replaced
+    uint32_t mask = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                  | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+    watch.WD = inotify_add_watch(InotifyFD,watch.Directory.c_str(),mask);
+    return(watch.WD >= 0);
+}
+
+// -----------------------------------------------------------------------------
+
+void read_file_events(void)
+{
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for(;;){
+        ssize_t len = read(InotifyFD,buffer,sizeof(buffer));
+        if( len <= 0 ) return;  // EAGAIN - all events were read
+
+        const char* p_buffer = buffer;
+        while( p_buffer < buffer + len ){
+            const struct inotify_event* p_event = (const struct inotify_event*)p_buffer;
+            p_buffer += sizeof(struct inotify_event) + p_event->len;
+
+            // events were lost - reload both files
+            if( p_event->mask & IN_Q_OVERFLOW ){
+                GroupWatch.Changed = true;
+                PrincMapWatch.Changed = true;
+                continue;
+            }
+
+            SFileWatch* watches[2] = { &GroupWatch, &PrincMapWatch };
+            for(int i=0; i < 2; i++){
+                SFileWatch& watch = *watches[i];
+                if( (watch.WD < 0) || (p_event->wd != watch.WD) ) continue;
+
+                // the directory itself was removed or renamed - files are checked
+                // every second until the directory can be watched again
+                if( p_event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED) ){
+                    if( (p_event->mask & IN_IGNORED) == 0 ) inotify_rm_watch(InotifyFD,watch.WD);
+                    watch.WD = -1;
+                    watch.Changed = true;
+                    continue;
+                }
+
+                if( (p_event->len > 0) && (watch.Name == p_event->name) ){
+                    watch.Changed = true;
+                }
+            }
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void check_files(void)
+{
+    bool group = false;
+    bool princ_map = false;
+
+    if( GroupWatch.Name.empty() == false ){
+        bool poll = GroupWatch.WD < 0;
+        if( poll ) add_file_watch(GroupWatch);
+        group = poll || GroupWatch.Changed;
+        GroupWatch.Changed = false;
+    }
+
+    if( PrincMapWatch.Name.empty() == false ){
+        bool poll = PrincMapWatch.WD < 0;
+        if( poll ) add_file_watch(PrincMapWatch);
+        princ_map = poll || PrincMapWatch.Changed;
+        PrincMapWatch.Changed = false;
+    }
+
+    // files are loaded by the reloader, the event loop is not blocked
+    if( group || princ_map ) request_reload(group,princ_map);
+}
+
+// -----------------------------------------------------------------------------
+
+bool start_reloader(void)
+{
+    ReloaderStarted = pthread_create(&ReloaderThread,NULL,reloader_main,NULL) == 0;
+
+    if( ReloaderStarted == false ){
+        syslog(LOG_ERR,"unable to start file reloader");
+    }
+    return(ReloaderStarted);
+}
+
+// -----------------------------------------------------------------------------
+
+void stop_reloader(void)
+{
+    if( ReloaderStarted == false ) return;
+
+    // the reload in progress is cancelled
+    pthread_mutex_lock(&ReloadLock);
+    __atomic_store_n(&StopReloader,true,__ATOMIC_RELAXED);
+    pthread_cond_signal(&ReloadCond);
+    pthread_mutex_unlock(&ReloadLock);
+
+    pthread_join(ReloaderThread,NULL);
+    ReloaderStarted = false;
+}
+
+// -----------------------------------------------------------------------------
+
+void request_reload(bool group,bool princ_map)
+{
+    pthread_mutex_lock(&ReloadLock);
+    GroupReloadRequested |= group;
+    PrincMapReloadRequested |= princ_map;
+    pthread_cond_signal(&ReloadCond);
+    pthread_mutex_unlock(&ReloadLock);
+}
+
+// -----------------------------------------------------------------------------
+
+void* reloader_main(void* p_arg)
+{
+    pthread_mutex_lock(&ReloadLock);
+    while( StopReloader == false ){
+        if( (GroupReloadRequested == false) && (PrincMapReloadRequested == false) ){
+            pthread_cond_wait(&ReloadCond,&ReloadLock);
+            continue;
+        }
+        bool group = GroupReloadRequested;
+        bool princ_map = PrincMapReloadRequested;
+        GroupReloadRequested = false;
+        PrincMapReloadRequested = false;
+        pthread_mutex_unlock(&ReloadLock);
+
+        // measure requests served during the reload
+        __atomic_store_n(&ReloadNumOfRequests,0,__ATOMIC_RELAXED);
+        __atomic_store_n(&ReloadMaxLatency,0,__ATOMIC_RELAXED);
+        __atomic_store_n(&ReloadInProgress,true,__ATOMIC_RELAXED);
+
+        double stime = get_time();
+        if( princ_map ) reload_principal_map();
+        if( group ) reload_group();
+        double etime = get_time();
+
+        __atomic_store_n(&ReloadInProgress,false,__ATOMIC_RELAXED);
+
+        // reload_*() do nothing if the files were not modified
+        if( Verbose || (etime - stime > 1.0) ){
+            syslog(LOG_INFO,"reload finished in %.3f s, requests served during the reload: %lu (max latency %lu us)",
+                   etime-stime,__atomic_load_n(&ReloadNumOfRequests,__ATOMIC_RELAXED),
+                   __atomic_load_n(&ReloadMaxLatency,__ATOMIC_RELAXED));
+        }
+
+        pthread_mutex_lock(&ReloadLock);
+    }
+    pthread_mutex_unlock(&ReloadLock);
+    return(NULL);
+}
+
+// -----------------------------------------------------------------------------
+
+bool is_reload_cancelled(void)
+{
+    return(__atomic_load_n(&StopReloader,__ATOMIC_RELAXED));
+}
+
+// -----------------------------------------------------------------------------
+
+void record_reload_latency(double start)
+{
+    unsigned long latency = (get_time() - start)*1e6;
+    __atomic_add_fetch(&ReloadNumOfRequests,1,__ATOMIC_RELAXED);
+    unsigned long max = __atomic_load_n(&ReloadMaxLatency,__ATOMIC_RELAXED);
+    while( (latency > max) &&
+           (__atomic_compare_exchange_n(&ReloadMaxLatency,&max,latency,true,__ATOMIC_RELAXED,__ATOMIC_RELAXED) == false) );
+}
+
+// -----------------------------------------------------------------------------
+
+boost::shared_ptr<const SMembership> get_membership(void)
+{
+    return(boost::atomic_load(&Membership));
+}
+
+// -----------------------------------------------------------------------------
 
-                    memset(&data,0,sizeof(data));
-                    data.Type = MSG_IDMAP_GROUP_TO_LOCAL_DOMAIN;
-                    strncpy(data.Name,name.c_str(),MAX_NAME);
+// it returns the previous membership
+boost::shared_ptr<const SMembership> set_membership(const boost::shared_ptr<const SMembership>& p_membership)
+{
+    return(boost::atomic_exchange(&Membership,p_membership));
+}
+
+// -----------------------------------------------------------------------------
+
+double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec + ts.tv_nsec*1e-9);
+}
+
+// -----------------------------------------------------------------------------
+
+bool start_workers(void)
+{
+    for(int i=0; i < Workers; i++){
+        pthread_t tid;
+        if( pthread_create(&tid,NULL,worker_main,NULL) != 0 ){
+            syslog(LOG_ERR,"unable to start worker thread #%d",i+1);
+            break;
+        }
+        WorkerThreads.push_back(tid);
+    }
+
+    if( WorkerThreads.size() == 0 ) return(false);
+
+    syslog(LOG_INFO,"number of started worker threads: %d",(int)WorkerThreads.size());
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+void stop_workers(void)
+{
+    pthread_mutex_lock(&QueueLock);
+    StopWorkers = true;
+    pthread_cond_broadcast(&QueueCond);
+    pthread_mutex_unlock(&QueueLock);
+
+    for(size_t i=0; i < WorkerThreads.size(); i++){
+        pthread_join(WorkerThreads[i],NULL);
+    }
+    WorkerThreads.clear();
+}
+
+// -----------------------------------------------------------------------------
+
+void* worker_main(void* p_arg)
+{
+    for(;;){
+        pthread_mutex_lock(&QueueLock);
+        while( WorkQueue.empty() && (StopWorkers == false) ){
+            pthread_cond_wait(&QueueCond,&QueueLock);
+        }
+        if( WorkQueue.empty() ){
+            // no more work and the pool is stopping
+            pthread_mutex_unlock(&QueueLock);
+            break;
+        }
+        SRequest* p_req = WorkQueue.front();
+        WorkQueue.pop_front();
+        pthread_mutex_unlock(&QueueLock);
+
+        // requests served during the file reload are measured
+        if( __atomic_load_n(&ReloadInProgress,__ATOMIC_RELAXED) ){
+            double start = get_time();
+            process_request(p_req);
+            record_reload_latency(start);
+        } else {
+            process_request(p_req);
+        }
+
+        // return the request to the event loop
+        pthread_mutex_lock(&DoneLock);
+        DoneQueue.push_back(p_req);
+        pthread_mutex_unlock(&DoneLock);
+        eventfd_write(DoneEventFD,1);
+    }
+    return(NULL);
+}
+
+// -----------------------------------------------------------------------------
+
+bool init_snapshot(void)
+{
+    // the shared state must exist even if the snapshot is disabled
+    // because clients can still map the state of the previous server instance
+    int fd = open(STATENAME,O_RDWR | O_CREAT | O_CLOEXEC,S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if( fd < 0 ){
+        syslog(LOG_ERR,"unable to open the snapshot state %s (%s)",STATENAME,strerror(errno));
+        return(false);
+    }
+    fchmod(fd,S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    // do not truncate the file - it is mapped by clients
+    struct stat my_stat;
+    if( (fstat(fd,&my_stat) != 0) ||
+        ( (my_stat.st_size < (off_t)sizeof(struct SNFS4State)) && (ftruncate(fd,sizeof(struct SNFS4State)) != 0) ) ){
+        syslog(LOG_ERR,"unable to resize the snapshot state %s",STATENAME);
+        close(fd);
+        return(false);
+    }
+
+    void* p_data = mmap(NULL,sizeof(struct SNFS4State),PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if( p_data == MAP_FAILED ){
+        syslog(LOG_ERR,"unable to map the snapshot state %s",STATENAME);
+        return(false);
+    }
+    SharedState = (struct SNFS4State*)p_data;
+
+    // generations continue from the previous server instance
+    if( (SharedState->Magic != SNAPSHOT_MAGIC) || (SharedState->Version != SNAPSHOT_VERSION) ){
+        __atomic_store_n(&SharedState->Generation,0,__ATOMIC_RELEASE);
+        SharedState->Counter = 0;
+        SharedState->Version = SNAPSHOT_VERSION;
+        SharedState->Magic = SNAPSHOT_MAGIC;
+    }
+
+    // clients reject ids out of the range even if the snapshot is disabled,
+    // the generation of the previous instance is replaced unconditionally
+    publish_names();
+    SharedState->DataInstance = DataInstance;
+    __atomic_store_n(&SharedState->DataGeneration,__atomic_load_n(&DataGeneration,__ATOMIC_ACQUIRE),__ATOMIC_RELEASE);
+    publish_range();
+
+    if( Snapshot == false ){
+        __atomic_store_n(&SharedState->Generation,0,__ATOMIC_RELEASE);
+        unlink(SNAPSHOTNAME);
+        return(true);
+    }
+
+    // the first snapshot is published before any request is accepted
+    if( publish_snapshot() == false ) return(false);
+
+    return(start_publisher());
+}
+
+// -----------------------------------------------------------------------------
+
+void finalize_snapshot(void)
+{
+    stop_publisher();
+
+    if( SharedState == NULL ) return;
+
+    // clients switch back to the socket and do not check the range
+    __atomic_store_n(&SharedState->Generation,0,__ATOMIC_RELEASE);
+    __atomic_store_n(&SharedState->Flags,0,__ATOMIC_RELEASE);
+    unlink(SNAPSHOTNAME);
+
+    munmap(SharedState,sizeof(struct SNFS4State));
+    SharedState = NULL;
+}
+
+// -----------------------------------------------------------------------------
+
+void publish_range(void)
+{
+    // called from init_snapshot() and allocate_user/group(), the state is
+    // updated before new ids are provided to clients
+    if( SharedState == NULL ) return;
+
+    SharedState->BaseID = BaseID;
+    SharedState->NobodyID = NobodyID;
+    SharedState->NoGroupID = NoGroupID;
+    __atomic_store_n(&SharedState->TopUserID,TopUserID,__ATOMIC_RELEASE);
+    __atomic_store_n(&SharedState->TopGroupID,TopGroupID,__ATOMIC_RELEASE);
+    __atomic_store_n(&SharedState->Flags,STATE_RANGE | STATE_DATA | (StateNames ? STATE_NAMES : 0),__ATOMIC_RELEASE);
+}
+
+// -----------------------------------------------------------------------------
+
+void publish_generation(unsigned int generation)
+{
+    // called from change_generation(), concurrent changes never move
+    // the published generation back
+    if( SharedState == NULL ) return;
+
+    unsigned int current = __atomic_load_n(&SharedState->DataGeneration,__ATOMIC_RELAXED);
+    while( ((int)(generation - current) > 0) &&
+           (__atomic_compare_exchange_n(&SharedState->DataGeneration,&current,generation,true,__ATOMIC_RELEASE,__ATOMIC_RELAXED) == false) );
+}
+
+// -----------------------------------------------------------------------------
+
+void publish_names(void)
+{
+    // called once from init_snapshot() before publish_range(), the names
+    // of the local domain mapping are not changed while the daemon is running
+    if( SharedState == NULL ) return;
+
+    // clients of the previous server instance stop using its names
+    __atomic_store_n(&SharedState->Flags,0,__ATOMIC_RELEASE);
+
+    std::string domain(LocalDomain);
+    StateNames = (domain.length() <= STATE_MAX_DOMAIN) && (NoBody.length() <= MAX_NAME) && (NoGroup.length() <= MAX_NAME);
+    if( StateNames == false ){
+        syslog(LOG_INFO,"too long names for the snapshot state, the local domain mapping is done only by the daemon");
+        return;
+    }
+
+    memset(SharedState->LocalDomain,0,sizeof(SharedState->LocalDomain));
+    memset(SharedState->NoBody,0,sizeof(SharedState->NoBody));
+    memset(SharedState->NoGroup,0,sizeof(SharedState->NoGroup));
+    strncpy(SharedState->LocalDomain,domain.c_str(),STATE_MAX_DOMAIN);
+    strncpy(SharedState->NoBody,NoBody.c_str(),MAX_NAME);
+    strncpy(SharedState->NoGroup,NoGroup.c_str(),MAX_NAME);
+}
+
+// -----------------------------------------------------------------------------
+
+bool publish_snapshot(void)
+{
+    uint64_t generation = SharedState->Counter + 1;
+
+    // the image is built from data at least as new as data_generation
+    unsigned int data_generation = __atomic_load_n(&DataGeneration,__ATOMIC_ACQUIRE);
+
+    boost::shared_ptr<std::vector<char> > p_image(new std::vector<char>);
+    std::vector<char>& image = *p_image;
+    if( build_snapshot(image,generation,data_generation) == false ) return(false);
+
+    // the published snapshot is never modified, it is replaced by rename
+    std::string tmpname = std::string(SNAPSHOTNAME) + ".new";
+    int fd = open(tmpname.c_str(),O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if( fd < 0 ){
+        syslog(LOG_ERR,"unable to create the snapshot %s (%s)",tmpname.c_str(),strerror(errno));
+        return(false);
+    }
+    fchmod(fd,S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    size_t written = 0;
+    while( written < image.size() ){
+        ssize_t ret = write(fd,&image[written],image.size() - written);
+        if( ret < 0 ){
+            if( errno == EINTR ) continue;
+            syslog(LOG_ERR,"unable to write the snapshot %s (%s)",tmpname.c_str(),strerror(errno));
+            close(fd);
+            unlink(tmpname.c_str());
+            return(false);
+        }
+        written += ret;
+    }
+    close(fd);
+
+    if( rename(tmpname.c_str(),SNAPSHOTNAME) != 0 ){
+        syslog(LOG_ERR,"unable to publish the snapshot %s (%s)",SNAPSHOTNAME,strerror(errno));
+        unlink(tmpname.c_str());
+        return(false);
+    }
+
+    // announce the new snapshot
+    SharedState->Counter = generation;
+    __atomic_store_n(&SharedState->Generation,generation,__ATOMIC_RELEASE);
+
+    // enumerations need not build the same data again
+    offer_enum_image(p_image,data_generation);
+
+    if( Verbose ){
+        syslog(LOG_INFO,"snapshot #%lu published (%lu bytes)",(unsigned long)generation,(unsigned long)image.size());
+    }
+
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+// number of hash slots - power of two and at least twice the number of items
+uint32_t get_hash_size(size_t items)
+{
+    uint32_t size = 16;
+    while( size < 2*items ) size *= 2;
+    return(size);
+}
+
+// -----------------------------------------------------------------------------
+
+// append zero terminated string, return its offset
+uint32_t add_snapshot_string(std::string& strings,const std::string& str)
+{
+    uint32_t offset = strings.size();
+    strings.append(str.c_str(),str.size()+1);
+    return(offset);
+}
+
+// -----------------------------------------------------------------------------
+
+bool build_snapshot(std::vector<char>& image,uint64_t generation,unsigned int data_generation)
+{
+    boost::shared_ptr<const SMembership> p_membership = get_membership();
+
+    CReadLock lock(&DataLock);
+
+    struct SNFS4SnapshotHeader header;
+    memset(&header,0,sizeof(header));
+
+    header.Magic = SNAPSHOT_MAGIC;
+    header.Version = SNAPSHOT_VERSION;
+    header.Generation = generation;
+    header.DataInstance = DataInstance;
+    header.DataGeneration = data_generation;
+    header.BaseID = BaseID;
+    header.PrimaryGroupID = PrimaryGroupID;
+    header.NumOfUsers = Users.GetTopID() + 1;
+    header.NumOfGroups = Groups.GetTopID() + 1;
+    header.UserHashSize = get_hash_size(Users.GetNumOfItems());
+    header.GroupHashSize = get_hash_size(Groups.GetNumOfItems());
+
+    std::vector<uint32_t>                   users(header.NumOfUsers,0);
+    std::vector<uint32_t>                   user_hash(header.UserHashSize,0);
+    std::vector<struct SNFS4SnapshotGroup>  groups(header.NumOfGroups);
+    std::vector<uint32_t>                   group_hash(header.GroupHashSize,0);
+    std::string                             strings(1,'\0');  // offset 0 is no string
+
+    for(uint32_t id=1; id < header.NumOfUsers; id++){
+        const char* p_name = Users.FindName(id);
+        if( p_name == NULL ) continue;
+        users[id] = add_snapshot_string(strings,p_name);
+        uint32_t slot = snapshot_hash(p_name) & (header.UserHashSize - 1);
+        while( user_hash[slot] != 0 ) slot = (slot + 1) & (header.UserHashSize - 1);
+        user_hash[slot] = id;
+    }
+
+    memset(&groups[0],0,groups.size()*sizeof(struct SNFS4SnapshotGroup));
+    for(uint32_t id=1; id < header.NumOfGroups; id++){
+        const char* p_name = Groups.FindName(id);
+        if( p_name == NULL ) continue;
+        struct SNFS4SnapshotGroup& grp = groups[id];
+        grp.Name = add_snapshot_string(strings,p_name);
+        const SGroupRecord* p_rec = find_group_record(*p_membership,id);
+        if( (p_rec != NULL) && (p_rec->Members != NULL) ){
+            grp.Members = strings.size();
+            grp.NumOfMembers = p_rec->Header.Extra.GID;
+            grp.MembersLen = p_rec->Header.Len;
+            strings.append(*p_rec->Members);
+        }
+        uint32_t slot = snapshot_hash(p_name) & (header.GroupHashSize - 1);
+        while( group_hash[slot] != 0 ) slot = (slot + 1) & (header.GroupHashSize - 1);
+        group_hash[slot] = id;
+    }
+
+    // string offsets are 32-bit
+    if( strings.size() > 0xFFFFFFFFUL ){
+        syslog(LOG_ERR,"too many data for the snapshot");
+        return(false);
+    }
+
+    // layout
+    header.UserTable = sizeof(header);
+    header.UserHash = header.UserTable + users.size()*sizeof(uint32_t);
+    header.GroupTable = header.UserHash + user_hash.size()*sizeof(uint32_t);
+    header.GroupHash = header.GroupTable + groups.size()*sizeof(struct SNFS4SnapshotGroup);
+    header.Strings = header.GroupHash + group_hash.size()*sizeof(uint32_t);
+    header.StringsSize = strings.size();
+    header.Size = header.Strings + header.StringsSize;
+
+    image.resize(header.Size);
+    memcpy(&image[0],&header,sizeof(header));
+    if( users.size() > 0 ) memcpy(&image[header.UserTable],&users[0],users.size()*sizeof(uint32_t));
+    memcpy(&image[header.UserHash],&user_hash[0],user_hash.size()*sizeof(uint32_t));
+    if( groups.size() > 0 ) memcpy(&image[header.GroupTable],&groups[0],groups.size()*sizeof(struct SNFS4SnapshotGroup));
+    memcpy(&image[header.GroupHash],&group_hash[0],group_hash.size()*sizeof(uint32_t));
+    memcpy(&image[header.Strings],strings.c_str(),strings.size());
+
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+void request_snapshot(void)
+{
+    pthread_mutex_lock(&PublishLock);
+    PublishRequested = true;
+    pthread_cond_signal(&PublishCond);
+    pthread_mutex_unlock(&PublishLock);
+}
+
+// -----------------------------------------------------------------------------
+
+bool start_publisher(void)
+{
+    PublisherStarted = pthread_create(&PublisherThread,NULL,publisher_main,NULL) == 0;
+
+    if( PublisherStarted == false ){
+        syslog(LOG_ERR,"unable to start snapshot publisher");
+    }
+    return(PublisherStarted);
+}
+
+// -----------------------------------------------------------------------------
+
+void stop_publisher(void)
+{
+    if( PublisherStarted == false ) return;
+
+    pthread_mutex_lock(&PublishLock);
+    StopPublisher = true;
+    pthread_cond_signal(&PublishCond);
+    pthread_mutex_unlock(&PublishLock);
+
+    pthread_join(PublisherThread,NULL);
+    PublisherStarted = false;
+}
+
+// -----------------------------------------------------------------------------
+
+void* publisher_main(void* p_arg)
+{
+    pthread_mutex_lock(&PublishLock);
+    while( StopPublisher == false ){
+        if( PublishRequested == false ){
+            pthread_cond_wait(&PublishCond,&PublishLock);
+            continue;
+        }
+        PublishRequested = false;
+        pthread_mutex_unlock(&PublishLock);
+
+        // clients use the socket for data not present in the snapshot
+        // so a failure is not fatal
+        publish_snapshot();
+
+        pthread_mutex_lock(&PublishLock);
+
+        // publish at most once per second, changes in the meantime are coalesced
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME,&deadline);
+        deadline.tv_sec++;
+        while( (StopPublisher == false) && (pthread_cond_timedwait(&PublishCond,&PublishLock,&deadline) != ETIMEDOUT) );
+    }
+    pthread_mutex_unlock(&PublishLock);
+    return(NULL);
+}
+
+// -----------------------------------------------------------------------------
+
+boost::shared_ptr<const std::vector<char> > get_enum_image(void)
+{
+    unsigned int generation = __atomic_load_n(&DataGeneration,__ATOMIC_ACQUIRE);
+
+    // concurrent enumerations wait for one build instead of building their own copies
+    pthread_mutex_lock(&EnumImageLock);
+    if( (SharedEnumImage == NULL) || (EnumImageGeneration != generation) ){
+        boost::shared_ptr<std::vector<char> > p_image(new std::vector<char>);
+        if( build_snapshot(*p_image,0,generation) ){
+            SharedEnumImage = p_image;
+            EnumImageGeneration = generation;
+        } else {
+            SharedEnumImage.reset();
+        }
+    }
+    boost::shared_ptr<const std::vector<char> > p_image = SharedEnumImage;
+    pthread_mutex_unlock(&EnumImageLock);
+
+    return(p_image);
+}
+
+// -----------------------------------------------------------------------------
+
+void offer_enum_image(const boost::shared_ptr<const std::vector<char> >& p_image,unsigned int generation)
+{
+    // newer image is never replaced by an older one
+    pthread_mutex_lock(&EnumImageLock);
+    if( (SharedEnumImage == NULL) || ((int)(generation - EnumImageGeneration) > 0) ){
+        SharedEnumImage = p_image;
+        EnumImageGeneration = generation;
+    }
+    pthread_mutex_unlock(&EnumImageLock);
+}
+
+// -----------------------------------------------------------------------------
+
+void process_request(SRequest* p_req)
+{
+    int                     connsckt = p_req->Connection->Socket;
+    struct SNFS4Message&    data = p_req->Data;
+
+    if( Verbose ){
+        syslog(LOG_INFO,"request: type(%d), ID(%d), Extra(%d), name(%s)",data.Type,data.ID.UID,data.Extra.UID,p_req->Name.c_str());
+    }
+
+    // supplementary data
+    std::string& extra_data = p_req->ExtraData;
+
+    unsigned int generation = __atomic_load_n(&DataGeneration,__ATOMIC_ACQUIRE);
+
+    // process data --------------------------
+    try{
+        switch(data.Type){
+
+            case MSG_IDMAP_REG_NAME:
+            case MSG_IDMAP_NAME_TO_UID:{
+                int type = data.Type;
+
+                // check if sender is root
+                bool authorized = false;
+                struct ucred cred;
+                socklen_t credlen = sizeof(cred);
+                if( getsockopt(connsckt,SOL_SOCKET,SO_PEERCRED,&cred,&credlen) == 0 ){
+                    if( cred.uid == 0 ){
+                        authorized = true;
+                     }
                 }
-                break;
-                
-                case MSG_ID_TO_NAME:{
-                    uid_t uid = data.ID.UID;
+
+                if( authorized == false ){
                     memset(&data,0,sizeof(data));
-                    if( uid > BaseID ){
-                        std::string name = IDToUser[uid - BaseID];
-                        if( ! name.empty() ) {
-                            data.Type = MSG_ID_TO_NAME;
-                            strncpy(data.Name,name.c_str(),MAX_NAME);
-                            data.ID.UID = uid;
-                            data.Extra.GID = PrimaryGroupID;
-                        }
+                    data.Type = MSG_INVALID;
+                    syslog(LOG_INFO,"unauthorized request");
+                    break;
+                }
+
+                // perform operation
+                uid_t   uid = 0;
+                std::string name(p_req->Name);
+                std::string lname;
+
+                if( ! is_domain_local(name,lname) ){
+                    // get id or register new record
+                    uid = register_user(name);
+                    if( uid == 0 ){
+                        memset(&data,0,sizeof(data));
+                        data.Type = MSG_INVALID;
+                        break;
                     }
+                    uid = uid + BaseID;
+                }
+
+                // local names are resolved by the daemon, nobody if the account does not exist
+                if( (type == MSG_IDMAP_NAME_TO_UID) && (uid == 0) ){
+                    gid_t gid;
+                    if( get_local_user(lname,uid,gid) == false ) uid = NobodyID;
                 }
-                break;
 
-                case MSG_NAME_TO_ID:{
-                    std::string name(data.Name);
-                    uid_t id = UserToID[name];
+                memset(&data,0,sizeof(data));
+                data.Type = type;
+                data.ID.UID = uid;
+                data.Extra.UID = NobodyID;
+                strncpy(data.Name,lname.c_str(),MAX_NAME);
+                p_req->ResponseName = lname;
+            }
+            break;
+
+            case MSG_IDMAP_REG_GROUP:
+            case MSG_IDMAP_NAME_TO_GID:{
+                int type = data.Type;
+
+                // check if sender is root
+                bool authorized = false;
+                struct ucred cred;
+                socklen_t credlen = sizeof(cred);
+                if( getsockopt(connsckt,SOL_SOCKET,SO_PEERCRED,&cred,&credlen) == 0 ){
+                    if( cred.uid == 0 ){
+                        authorized = true;
+                     }
+                }
+                if( authorized == false ){
                     memset(&data,0,sizeof(data));
-                    if( id > 0 ) {
-                        id = id + BaseID;
-                        data.Type = MSG_NAME_TO_ID;
-                        strncpy(data.Name,name.c_str(),MAX_NAME);
-                        data.ID.UID = id;
-                        data.Extra.GID = PrimaryGroupID;
+                    data.Type = MSG_INVALID;
+                    syslog(LOG_INFO,"unauthorized request");
+                    break;
+                }
+
+                // perform operation
+                gid_t gid = 0;
+                std::string name(p_req->Name);
+                std::string lname;
+
+                if( ! is_domain_local(name,lname) ){
+                    // get id or register new record
+                    gid = register_group(name);
+                    if( gid == 0 ){
+                        memset(&data,0,sizeof(data));
+                        data.Type = MSG_INVALID;
+                        break;
                     }
+                    gid = gid + BaseID;
                 }
-                break;
 
-                case MSG_ENUM_NAME:{
-                    reload_group();
-                    uid_t id = data.ID.UID;
-                    memset(&data,0,sizeof(data));
-                    if( (id >= 1) && (id <= TopUserID) ){
-                        std::string name = IDToUser[id];
-                        if( ! name.empty() ) {
-                            data.Type = MSG_ENUM_NAME;
-                            strncpy(data.Name,name.c_str(),MAX_NAME);
-                            data.ID.UID = id+BaseID;
-                            data.Extra.GID = PrimaryGroupID;
-                        }
+                // local names are resolved by the daemon, nogroup if the group does not exist
+                if( (type == MSG_IDMAP_NAME_TO_GID) && (gid == 0) ){
+                    if( get_local_group(lname,gid) == false ) gid = NoGroupID;
+                }
+
+                memset(&data,0,sizeof(data));
+                data.Type = type;
+                data.ID.GID = gid;
+                data.Extra.GID = NoGroupID;
+                strncpy(data.Name,lname.c_str(),MAX_NAME);
+                p_req->ResponseName = lname;
+            }
+            break;
+
+            case MSG_IDMAP_PRINC_TO_ID:
+            case MSG_IDMAP_PRINC_TO_GROUPS:{
+                int type = data.Type;
+                SPrincRecord record;
+                get_princ_record(p_req->Name,record);
+
+                data = record.Header;
+                data.Type = type;
+                if( type == MSG_IDMAP_PRINC_TO_GROUPS ){
+                    data.Len = record.Groups->size();
+                    p_req->ExtraBlob = record.Groups;
+                }
+            }
+            break;
+
+        case MSG_IDMAP_USER_TO_LOCAL_DOMAIN:{
+
+                std::string name(p_req->Name);
+
+                if( name == "root" ){
+                    name = NoBody;
+                } else {
+                    map_to_localdomain_ifnecessary(name);
+                }
+
+                memset(&data,0,sizeof(data));
+                data.Type = MSG_IDMAP_USER_TO_LOCAL_DOMAIN;
+                strncpy(data.Name,name.c_str(),MAX_NAME);
+                p_req->ResponseName = name;
+            }
+            break;
+
+        case MSG_IDMAP_GROUP_TO_LOCAL_DOMAIN:{
+
+                std::string name(p_req->Name);
+
+                if( name == "root" ){
+                    name = NoGroup;
+                } else {
+                    map_to_localdomain_ifnecessary(name);
+                }
+
+                memset(&data,0,sizeof(data));
+                data.Type = MSG_IDMAP_GROUP_TO_LOCAL_DOMAIN;
+                strncpy(data.Name,name.c_str(),MAX_NAME);
+                p_req->ResponseName = name;
+            }
+            break;
+
+            case MSG_ID_TO_NAME:
+            case MSG_NAME_TO_ID:
+            case MSG_ID_TO_GROUP:
+            case MSG_GROUP_TO_ID:
+                p_req->ResponseName = p_req->Name;
+                process_lookup(data,p_req->ResponseName,&p_req->ExtraBlob);
+            break;
+
+            case MSG_LOOKUP_BATCH:
+            case MSG_LOOKUP_BATCH_V2:
+                process_batch(data,data.Type == MSG_LOOKUP_BATCH_V2,p_req->RequestData,extra_data);
+            break;
+
+            case MSG_USER_TO_GROUPS:{
+                std::string name(p_req->Name);
+                memset(&data,0,sizeof(data));
+                data.Type = MSG_USER_TO_GROUPS;
+                strncpy(data.Name,name.c_str(),MAX_NAME);
+                p_req->ResponseName = name;
+                boost::shared_ptr<const SMembership> p_membership = get_membership();
+                const std::set<gid_t>* p_groups = find_member_groups(*p_membership,name);
+                if( p_groups != NULL ){
+                    std::vector<gid_t> gids;
+                    gids.reserve(p_groups->size());
+                    std::set<gid_t>::const_iterator it = p_groups->begin();
+                    std::set<gid_t>::const_iterator ie = p_groups->end();
+                    while( it != ie ){
+                        gids.push_back(*it + BaseID);
+                        it++;
                     }
+                    data.ID.GID = gids.size();
+                    data.Len = gids.size()*sizeof(gid_t);
+                    if( data.Len > 0 ) extra_data.assign((const char*)&gids[0],data.Len);
                 }
-                break;
+            }
+            break;
+
+            case MSG_ENUM_USERS:
+            case MSG_ENUM_GROUPS:
+            case MSG_ENUM_USERS_V2:
+            case MSG_ENUM_GROUPS_V2:{
+                // tagged enumerations of one connection can be processed concurrently
+                SConnection* p_conn = p_req->Connection;
+                boost::shared_ptr<const std::vector<char> > p_image;
+                pthread_mutex_lock(&p_conn->EnumLock);
+                p_image = p_conn->EnumImage;
+                pthread_mutex_unlock(&p_conn->EnumLock);
+
+                process_enum(data,p_image,extra_data);
+
+                pthread_mutex_lock(&p_conn->EnumLock);
+                p_conn->EnumImage = p_image;
+                pthread_mutex_unlock(&p_conn->EnumLock);
+            }
+            break;
+
+            case MSG_HELLO:{
+                // protocol handshake, it is accepted only in v2
+                uint32_t version = data.ID.UID;
+                memset(&data,0,sizeof(data));
+                if( p_req->V2 ){
+                    data.Type = MSG_HELLO;
+                    data.ID.UID = version < PROTOCOL_VERSION ? version : PROTOCOL_VERSION;
+                }
+            }
+            break;
+
+            case MSG_IDMAP_UID_TO_NAME:{
+                // the same as getpwuid() followed by MSG_IDMAP_USER_TO_LOCAL_DOMAIN
+                uid_t uid = data.ID.UID;
+                memset(&data,0,sizeof(data));
+                std::string name;
+                bool found = false;
+                if( uid > BaseID ){
+                    CReadLock lock(&DataLock);
+                    const char* p_name = Users.FindName(uid - BaseID);
+                    if( p_name != NULL ){
+                        name = p_name;
+                        found = true;
+                    }
+                }
+                if( found == false ) found = get_local_user_name(uid,name);
+                // the response without name - the id is unknown
+                data.Type = MSG_IDMAP_UID_TO_NAME;
+                data.ID.UID = uid;
+                if( found ){
+                    if( name == "root" ){
+                        name = NoBody;
+                    } else {
+                        map_to_localdomain_ifnecessary(name);
+                    }
+                    strncpy(data.Name,name.c_str(),MAX_NAME);
+                    p_req->ResponseName = name;
+                }
+            }
+            break;
+
+            case MSG_IDMAP_GID_TO_NAME:{
+                // the same as getgrgid() followed by MSG_IDMAP_GROUP_TO_LOCAL_DOMAIN
+                gid_t gid = data.ID.GID;
+                memset(&data,0,sizeof(data));
+                std::string name;
+                bool found = false;
+                if( gid > BaseID ){
+                    CReadLock lock(&DataLock);
+                    const char* p_name = Groups.FindName(gid - BaseID);
+                    if( p_name != NULL ){
+                        name = p_name;
+                        found = true;
+                    }
+                }
+                if( found == false ) found = get_local_group_name(gid,name);
+                // the response without name - the id is unknown
+                data.Type = MSG_IDMAP_GID_TO_NAME;
+                data.ID.GID = gid;
+                if( found ){
+                    if( name == "root" ){
+                        name = NoGroup;
+                    } else {
+                        map_to_localdomain_ifnecessary(name);
+                    }
+                    strncpy(data.Name,name.c_str(),MAX_NAME);
+                    p_req->ResponseName = name;
+                }
+            }
+            break;
+
+            case MSG_ENUM_NAME:{
+                uid_t id = data.ID.UID;
+                memset(&data,0,sizeof(data));
+                CReadLock lock(&DataLock);
+                const char* p_name = Users.FindName(id);
+                if( p_name != NULL ){
+                    data.Type = MSG_ENUM_NAME;
+                    strncpy(data.Name,p_name,MAX_NAME);
+                    p_req->ResponseName = p_name;
+                    data.ID.UID = id+BaseID;
+                    data.Extra.GID = PrimaryGroupID;
+                }
+            }
+            break;
+
+            case MSG_ENUM_GROUP:{
+                gid_t id = data.ID.GID;
+                memset(&data,0,sizeof(data));
+                CReadLock lock(&DataLock);
+                const char* p_name = Groups.FindName(id);
+                if( p_name != NULL ){
+                    setup_group_response(MSG_ENUM_GROUP,id,p_name,data,&p_req->ExtraBlob);
+                    p_req->ResponseName = p_name;
+                }
+            }
+            break;
+
+            default:
+                memset(&data,0,sizeof(data));
+            break;
+        }
+    } catch(...){
+        syslog(LOG_ERR,"exception raised");
+        memset(&data,0,sizeof(data));
+    }
 
-                case MSG_ID_TO_GROUP:{
-                    gid_t gid = data.ID.GID;
-                    memset(&data,0,sizeof(data));
-                    if( gid > BaseID ) {
-                        std::string name = IDToGroup[gid-BaseID];
-                        if( ! name.empty() ) {
-                            data.Type = MSG_ID_TO_GROUP;
-                            strncpy(data.Name,name.c_str(),MAX_NAME);
-                            data.ID.GID = gid;
-                            generate_group_list(name,extra_data,data.Len,data.Extra.GID);
-                        }
-                    }
-                }
-                break;
+    // the generation from the beginning of the request, thus the response
+    // cannot be newer than its generation
+    data.Instance = DataInstance;
+    data.Generation = generation;
 
-                case MSG_GROUP_TO_ID:{
-                    std::string name(data.Name);
-                    memset(&data,0,sizeof(data));
-                    gid_t id = GroupToID[name];
-                    if( id > 0 ) {
-                        data.Type = MSG_GROUP_TO_ID;
-                        strncpy(data.Name,name.c_str(),MAX_NAME);
-                        data.ID.GID = id + BaseID;
-                        generate_group_list(name,extra_data,data.Len,data.Extra.GID);
-                    }
-                }
-                break;
+    if( Verbose ){
+        syslog(LOG_INFO,"response: type(%d), ID(%d), Extra(%d), name(%s)",data.Type,data.ID.UID,data.Extra.UID,
+               p_req->ResponseName.empty() ? data.Name : p_req->ResponseName.c_str());
+    }
 
-                case MSG_ENUM_GROUP:{
-                    reload_group();
-                    gid_t id = data.ID.GID;
-                    memset(&data,0,sizeof(data));
-                    if(  (id >= 1) && (id <= TopGroupID) ) {
-                        std::string name = IDToGroup[id];
-                        if( ! name.empty() ) {
-                            data.Type = MSG_ENUM_GROUP;
-                            strncpy(data.Name,name.c_str(),MAX_NAME);
-                            data.ID.GID = id + BaseID;
-                            generate_group_list(name,extra_data,data.Len,data.Extra.GID);
-                        }
-                    }
+    // the response is sent by the event loop
+}
+
+// -----------------------------------------------------------------------------
+
+void process_lookup(struct SNFS4Message& data,std::string& name,boost::shared_ptr<const std::string>* p_members)
+{
+    switch(data.Type){
+        case MSG_ID_TO_NAME:{
+            uid_t uid = data.ID.UID;
+            memset(&data,0,sizeof(data));
+            if( uid > BaseID ){
+                CReadLock lock(&DataLock);
+                const char* p_name = Users.FindName(uid - BaseID);
+                if( p_name != NULL ) {
+                    data.Type = MSG_ID_TO_NAME;
+                    strncpy(data.Name,p_name,MAX_NAME);
+                    name = p_name;
+                    data.ID.UID = uid;
+                    data.Extra.GID = PrimaryGroupID;
                 }
-                break;
-                
-                default:
-                    memset(&data,0,sizeof(data));
-                break;
             }
-        } catch(...){
-            syslog(LOG_ERR,"exception raised");
+        }
+        break;
+
+        case MSG_NAME_TO_ID:{
             memset(&data,0,sizeof(data));
+            CReadLock lock(&DataLock);
+            uid_t uid = Users.FindID(name);
+            if( uid != 0 ) {
+                data.Type = MSG_NAME_TO_ID;
+                strncpy(data.Name,name.c_str(),MAX_NAME);
+                data.ID.UID = uid + BaseID;
+                data.Extra.GID = PrimaryGroupID;
+            }
         }
-        
-        if( Verbose ){
-            syslog(LOG_INFO,"response: type(%d), ID(%d), Extra(%d), name(%s)",data.Type,data.ID.UID,data.Extra.UID,data.Name);
+        break;
+
+        case MSG_ID_TO_GROUP:{
+            gid_t gid = data.ID.GID;
+            memset(&data,0,sizeof(data));
+            if( gid > BaseID ) {
+                CReadLock lock(&DataLock);
+                const char* p_name = Groups.FindName(gid - BaseID);
+                if( p_name != NULL ) {
+                    setup_group_response(MSG_ID_TO_GROUP,gid - BaseID,p_name,data,p_members);
+                    name = p_name;
+                }
+            }
         }
+        break;
 
-        // send response -------------------------
-        if( write(connsckt,&data,sizeof(data)) != sizeof(data) ){
-            syslog(LOG_ERR,"unable to send message");
+        case MSG_GROUP_TO_ID:{
+            memset(&data,0,sizeof(data));
+            CReadLock lock(&DataLock);
+            gid_t gid = Groups.FindID(name);
+            if( gid != 0 ) {
+                setup_group_response(MSG_GROUP_TO_ID,gid,name.c_str(),data,p_members);
+            }
         }
-        if( data.Len > 0 ){
-            if( Verbose ){
-                syslog(LOG_INFO,"response: type(%d), extra data sent (%ld)",data.Type,data.Len);
+        break;
+
+        default:
+            memset(&data,0,sizeof(data));
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void process_enum(struct SNFS4Message& data,boost::shared_ptr<const std::vector<char> >& p_image,std::string& extra_data)
+{
+    int         type = data.Type;
+    uint32_t    index = data.ID.UID;
+
+    memset(&data,0,sizeof(data));
+
+    // new enumeration or the connection was re-established - take the current data
+    if( (index <= 1) || (p_image == NULL) ){
+        p_image = get_enum_image();
+        if( p_image == NULL ) return;
+    }
+    if( index < 1 ) index = 1;
+
+    const std::vector<char>& image = *p_image;
+
+    const struct SNFS4SnapshotHeader* p_snap = (const struct SNFS4SnapshotHeader*)&image[0];
+    const char*     p_strings = &image[p_snap->Strings];
+    uint32_t        num = 0;
+    bool            full = (type == MSG_ENUM_USERS_V2) || (type == MSG_ENUM_GROUPS_V2);
+
+    // at least one record is always sent
+    if( (type == MSG_ENUM_USERS) || (type == MSG_ENUM_USERS_V2) ){
+        const uint32_t* p_users = (const uint32_t*)&image[p_snap->UserTable];
+        while( index < p_snap->NumOfUsers ){
+            if( p_users[index] != 0 ){
+                const char* p_name = p_strings + p_users[index];
+                if( (num > 0) && (extra_data.size() + get_enum_record_size(full,p_name,0) > MAX_CHUNK) ) break;
+                append_enum_record(extra_data,full,MSG_ENUM_NAME,index + BaseID,p_snap->PrimaryGroupID,p_name,NULL,0);
+                num++;
             }
-            if( (size_t)write(connsckt,extra_data.data(),extra_data.length()) != extra_data.length() ){
-                if( Verbose ){
-                    // the message can be discarded by client - print info only in verbose mode
-                    syslog(LOG_ERR,"unable to send extra message");
-                }
+            index++;
+        }
+        if( index >= p_snap->NumOfUsers ) index = 0;
+    } else {
+        const struct SNFS4SnapshotGroup* p_groups = (const struct SNFS4SnapshotGroup*)&image[p_snap->GroupTable];
+        while( index < p_snap->NumOfGroups ){
+            const struct SNFS4SnapshotGroup& grp = p_groups[index];
+            if( grp.Name != 0 ){
+                const char* p_name = p_strings + grp.Name;
+                if( (num > 0) && (extra_data.size() + get_enum_record_size(full,p_name,grp.MembersLen) > MAX_CHUNK) ) break;
+                append_enum_record(extra_data,full,MSG_ENUM_GROUP,index + BaseID,grp.NumOfMembers,
+                                   p_name,p_strings + grp.Members,grp.MembersLen);
+                num++;
             }
+            index++;
         }
+        if( index >= p_snap->NumOfGroups ) index = 0;
+    }
+
+    data.Type = type;
+    data.ID.UID = index;
+    data.Extra.UID = num;
+    data.Len = extra_data.size();
 
-        close(connsckt);
+    // the enumeration is finished
+    if( index == 0 ) p_image.reset();
+}
+
+// -----------------------------------------------------------------------------
+
+size_t get_enum_record_size(bool full,const char* p_name,uint32_t members_len)
+{
+    if( full ) return(sizeof(struct SNFS4EnumRecord) + strlen(p_name) + 1 + members_len);
+    return(sizeof(struct SNFS4Message) + members_len);
+}
+
+// -----------------------------------------------------------------------------
+
+void append_enum_record(std::string& extra_data,bool full,int type,uint32_t id,uint32_t extra,
+                        const char* p_name,const char* p_members,uint32_t members_len)
+{
+    if( full ){
+        struct SNFS4EnumRecord rec;
+        memset(&rec,0,sizeof(rec));
+        rec.ID = id;
+        rec.Extra = extra;
+        rec.NameLen = strlen(p_name) + 1;
+        rec.DataLen = members_len;
+        extra_data.append((const char*)&rec,sizeof(rec));
+        extra_data.append(p_name,rec.NameLen);
+    } else {
+        // names are truncated in the v1 layout
+        struct SNFS4Message item;
+        memset(&item,0,sizeof(item));
+        item.Type = type;
+        strncpy(item.Name,p_name,MAX_NAME);
+        item.ID.UID = id;
+        item.Extra.UID = extra;
+        item.Len = members_len;
+        extra_data.append((const char*)&item,sizeof(item));
     }
+    if( members_len > 0 ) extra_data.append(p_members,members_len);
 }
 
 // -----------------------------------------------------------------------------
 
-void catch_signals(int signo)
+void process_batch(struct SNFS4Message& data,bool full,const std::string& request_data,std::string& extra_data)
 {
-    if( signo == SIGTERM ){
-        syslog(LOG_INFO,"SIGTERM received - shutting down server");
+    int    type = data.Type;
+    size_t count = data.ID.UID;
+    memset(&data,0,sizeof(data));
+
+    std::vector<struct SNFS4Message> items;
+    std::vector<std::string>         names;
+    if( (count == 0) || (count > MAX_BATCH) || (parse_batch(full,count,request_data,items,names) == false) ){
+        syslog(LOG_ERR,"malformed batch request");
+        return;
     }
-    if( signo == SIGINT ){
-        syslog(LOG_INFO,"SIGINT received - shutting down server");
+
+    for(size_t i=0; i < count; i++){
+        struct SNFS4Message& item = items[i];
+        switch(item.Type){
+            case MSG_ID_TO_NAME:
+            case MSG_NAME_TO_ID:
+            case MSG_ID_TO_GROUP:
+            case MSG_GROUP_TO_ID:
+                // group members are not provided
+                process_lookup(item,names[i],NULL);
+            break;
+            default:
+                memset(&item,0,sizeof(item));
+            break;
+        }
+    }
+
+    data.Type = type;
+    data.ID.UID = count;
+    if( full ){
+        extra_data.clear();
+        for(size_t i=0; i < count; i++){
+            struct SNFS4BatchRecord record;
+            memset(&record,0,sizeof(record));
+            record.Type = items[i].Type;
+            record.ID = items[i].ID.UID;
+            record.Extra = items[i].Extra.UID;
+            if( record.Type != MSG_INVALID ) record.NameLen = names[i].length() + 1;
+            extra_data.append((const char*)&record,sizeof(record));
+            if( record.NameLen > 0 ) extra_data.append(names[i].c_str(),record.NameLen);
+        }
+    } else {
+        extra_data.assign((const char*)&items[0],count*sizeof(struct SNFS4Message));
+    }
+    data.Len = extra_data.length();
+
+    if( Verbose ){
+        syslog(LOG_INFO,"batch request: %d items",(int)count);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool parse_batch(bool full,size_t count,const std::string& request_data,
+                 std::vector<struct SNFS4Message>& items,std::vector<std::string>& names)
+{
+    items.resize(count);
+    names.resize(count);
+
+    if( full == false ){
+        if( request_data.size() != count*sizeof(struct SNFS4Message) ) return(false);
+        memcpy(&items[0],request_data.data(),count*sizeof(struct SNFS4Message));
+        for(size_t i=0; i < count; i++){
+            items[i].Name[MAX_NAME] = '\0';
+            items[i].Len = 0;
+            names[i] = items[i].Name;
+        }
+        return(true);
+    }
+
+    size_t pos = 0;
+    for(size_t i=0; i < count; i++){
+        struct SNFS4BatchRecord record;
+        if( pos + sizeof(record) > request_data.size() ) return(false);
+        memcpy(&record,request_data.data() + pos,sizeof(record));
+        pos += sizeof(record);
+        if( (record.NameLen > MAX_NAME_V2 + 1) || (pos + record.NameLen > request_data.size()) ) return(false);
+        if( record.NameLen > 0 ){
+            if( request_data[pos + record.NameLen - 1] != '\0' ) return(false);
+            names[i].assign(request_data.data() + pos,record.NameLen - 1);
+            pos += record.NameLen;
+        }
+        memset(&items[i],0,sizeof(items[i]));
+        items[i].Type = record.Type;
+        items[i].ID.UID = record.ID;
+        items[i].Extra.UID = record.Extra;
+    }
+
+    return(pos == request_data.size());
+}
+
+// -----------------------------------------------------------------------------
+
+void read_signals(void)
+{
+    struct signalfd_siginfo info;
+    while( read(SignalFD,&info,sizeof(info)) == sizeof(info) ){
+        if( info.ssi_signo == SIGTERM ){
+            syslog(LOG_INFO,"SIGTERM received - shutting down server");
+        }
+        if( info.ssi_signo == SIGINT ){
+            syslog(LOG_INFO,"SIGINT received - shutting down server");
+        }
+        // stop the event loop, the cache is saved once workers are finished
+        Terminated = true;
     }
-    close(ServerSocket);
-    ServerSocket = -1;
-    
-    save_cache();
 }
 
 // -----------------------------------------------------------------------------
@@ -1009,8 +3942,9 @@ const std::string can_user_be_local(const std::string &name)
     if( LocalDomains.count(bufs[1]) == 0 ) return(std::string()); // domain is not allowed to be mapped to local user
 
     // try to determine if the local user exist
-    struct passwd* p_pw = getpwnam(bufs[0].c_str());
-    if( p_pw == NULL ) return(std::string());
+    uid_t uid;
+    gid_t gid;
+    if( get_local_user(bufs[0],uid,gid) == false ) return(std::string());
 
     return(bufs[0]);
 }
@@ -1020,21 +3954,19 @@ const std::string can_user_be_local(const std::string &name)
 int GetOrRegisterUser(const std::string& name)
 {
     // try metanfs4 user first
-    if( UserToID.count(name) == 1 ){
-        return(UserToID[name]+BaseID);
+    uid_t uid = Users.FindID(name);
+    if( uid != 0 ){
+        return(uid+BaseID);
     }
     // if it is not local account register new group
     if( name.find("@") != std::string::npos ){
-        TopUserID++;
-        UserToID[name] = TopUserID;
-        IDToUser[TopUserID] = name;
-        return(TopUserID+BaseID);
+        return(allocate_user(name)+BaseID);
     }
     // try local account
-    struct passwd * p_pw = getpwnam(name.c_str());
-    if( p_pw == NULL ) return(-1);
-    if( p_pw->pw_uid == 0 ) return(-1);
-    return( p_pw->pw_uid );
+    gid_t gid;
+    if( get_local_user(name,uid,gid) == false ) return(-1);
+    if( uid == 0 ) return(-1);
+    return( uid );
 }
 
 // -----------------------------------------------------------------------------
@@ -1042,42 +3974,464 @@ int GetOrRegisterUser(const std::string& name)
 int GetOrRegisterGroup(const std::string& name)
 {
     // try metanfs4 group first
-    if( GroupToID.count(name) == 1 ){
-        return(GroupToID[name]+BaseID);
+    gid_t gid = Groups.FindID(name);
+    if( gid != 0 ){
+        return(gid+BaseID);
     }
     // if it is not local account register new group
     if( name.find("@") != std::string::npos ){
-        TopGroupID++;
-        GroupToID[name] = TopGroupID;
-        IDToGroup[TopGroupID] = name;
-        return(TopGroupID+BaseID);
+        return(allocate_group(name)+BaseID);
     }
     // try local account
-    struct group * p_gr = getgrnam(name.c_str());
-    if( p_gr == NULL ) return(-1);
-    if( p_gr->gr_gid == 0 ) return(-1);
-    return( p_gr->gr_gid );
+    if( get_local_group(name,gid) == false ) return(-1);
+    if( gid == 0 ) return(-1);
+    return( gid );
 }
 
 // -----------------------------------------------------------------------------
 
-void generate_group_list(const std::string& gname,std::string& extra_data,size_t& len,gid_t& num)
+uid_t register_user(const std::string& name)
 {
-    // generate list of members
-    std::map<std::string, std::set<std::string> >::iterator git = GroupMembers.find(gname);
-    if( git != GroupMembers.end() ){
-        num = git->second.size(); // number of members
-        std::set<std::string>::iterator it = git->second.begin();
-        std::set<std::string>::iterator ie = git->second.end();
-        std::stringstream sextra;
-        while( it != ie ){
-            std::string name(*it);
-            sextra.write(name.c_str(),name.size()+1);
-            it++;
+    uid_t id;
+    {
+        CReadLock lock(&DataLock);
+        id = Users.FindID(name);
+    }
+
+    // not registered - create new record, the name could be registered in the meantime
+    if( id == 0 ){
+        CWriteLock lock(&DataLock);
+        id = Users.FindID(name);
+        if( id == 0 ){
+            id = allocate_user(name);
+            request_snapshot();
+        }
+    }
+
+    // the id can be used by the client only when it is safely stored
+    if( sync_journal() == false ) return(0);
+    return(id);
+}
+
+// -----------------------------------------------------------------------------
+
+uid_t allocate_user(const std::string& name)
+{
+    TopUserID++;
+    Users.Add(name,TopUserID);
+    append_journal('n',name,TopUserID);
+    publish_range();
+    change_generation();
+    return(TopUserID);
+}
+
+// -----------------------------------------------------------------------------
+
+gid_t register_group(const std::string& name)
+{
+    gid_t id;
+    {
+        CReadLock lock(&DataLock);
+        id = Groups.FindID(name);
+    }
+
+    // not registered - create new record, the name could be registered in the meantime
+    if( id == 0 ){
+        CWriteLock lock(&DataLock);
+        id = Groups.FindID(name);
+        if( id == 0 ){
+            id = allocate_group(name);
+            request_snapshot();
+        }
+    }
+
+    // the id can be used by the client only when it is safely stored
+    if( sync_journal() == false ) return(0);
+    return(id);
+}
+
+// -----------------------------------------------------------------------------
+
+gid_t allocate_group(const std::string& name)
+{
+    TopGroupID++;
+    Groups.Add(name,TopGroupID);
+    append_journal('g',name,TopGroupID);
+    publish_range();
+    change_generation();
+    return(TopGroupID);
+}
+
+// -----------------------------------------------------------------------------
+
+void change_generation(void)
+{
+    // clients with cached responses see the change without contacting the daemon
+    publish_generation(__atomic_add_fetch(&DataGeneration,1,__ATOMIC_RELEASE));
+}
+
+// -----------------------------------------------------------------------------
+
+bool get_local_user(const std::string& name,uid_t& uid,gid_t& gid)
+{
+    SLocalAccount account;
+    if( get_local_account(LocalUserCache,name,query_user_by_name,account) == false ) return(false);
+
+    uid = account.UID;
+    gid = account.GID;
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+bool get_local_group(const std::string& name,gid_t& gid)
+{
+    SLocalAccount account;
+    if( get_local_account(LocalGroupCache,name,query_group_by_name,account) == false ) return(false);
+
+    gid = account.GID;
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+bool get_local_user_name(uid_t uid,std::string& name)
+{
+    SLocalAccount account;
+    if( get_local_account(LocalUserIDCache,uid,query_user_by_id,account) == false ) return(false);
+
+    name = account.Name;
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+bool get_local_group_name(gid_t gid,std::string& name)
+{
+    SLocalAccount account;
+    if( get_local_account(LocalGroupIDCache,gid,query_group_by_id,account) == false ) return(false);
+
+    name = account.Name;
+    return(true);
+}
+
+// -----------------------------------------------------------------------------
+
+template<class Key>
+bool get_local_account(SLocalCache<Key>& cache,const Key& key,
+                       int (*query)(const Key& key,std::vector<char>& buffer,SLocalAccount& account),
+                       SLocalAccount& account)
+{
+    if( find_local_account(cache,key,account) ){
+        errno = 0;
+        return(account.Found);
+    }
+
+    std::vector<char> buffer(16384);
+
+    int ret;
+    account = SLocalAccount();
+    while( (ret = query(key,buffer,account)) == ERANGE ){
+        buffer.resize(2*buffer.size());
+    }
+
+    // failures (e.g. unavailable LDAP) are not cached, only unknown names and ids
+    if( account.Found || (ret == 0) ) add_local_account(cache,key,account);
+
+    if( account.Found == false ) errno = ret;
+    return(account.Found);
+}
+
+// -----------------------------------------------------------------------------
+
+int query_user_by_name(const std::string& name,std::vector<char>& buffer,SLocalAccount& account)
+{
+    struct passwd   pwd;
+    struct passwd*  p_pwd = NULL;
+    int ret = getpwnam_r(name.c_str(),&pwd,&buffer[0],buffer.size(),&p_pwd);
+    set_local_user(account,p_pwd);
+    return(ret);
+}
+
+// -----------------------------------------------------------------------------
+
+int query_group_by_name(const std::string& name,std::vector<char>& buffer,SLocalAccount& account)
+{
+    struct group    grp;
+    struct group*   p_grp = NULL;
+    int ret = getgrnam_r(name.c_str(),&grp,&buffer[0],buffer.size(),&p_grp);
+    set_local_group(account,p_grp);
+    return(ret);
+}
+
+// -----------------------------------------------------------------------------
+
+int query_user_by_id(const uid_t& uid,std::vector<char>& buffer,SLocalAccount& account)
+{
+    struct passwd   pwd;
+    struct passwd*  p_pwd = NULL;
+    int ret = getpwuid_r(uid,&pwd,&buffer[0],buffer.size(),&p_pwd);
+    set_local_user(account,p_pwd);
+    return(ret);
+}
+
+// -----------------------------------------------------------------------------
+
+int query_group_by_id(const gid_t& gid,std::vector<char>& buffer,SLocalAccount& account)
+{
+    struct group    grp;
+    struct group*   p_grp = NULL;
+    int ret = getgrgid_r(gid,&grp,&buffer[0],buffer.size(),&p_grp);
+    set_local_group(account,p_grp);
+    return(ret);
+}
+
+// -----------------------------------------------------------------------------
+
+void set_local_user(SLocalAccount& account,const struct passwd* p_pwd)
+{
+    if( p_pwd == NULL ) return;
+    account.Found = true;
+    account.UID = p_pwd->pw_uid;
+    account.GID = p_pwd->pw_gid;
+    account.Name = p_pwd->pw_name;
+}
+
+// -----------------------------------------------------------------------------
+
+void set_local_group(SLocalAccount& account,const struct group* p_grp)
+{
+    if( p_grp == NULL ) return;
+    account.Found = true;
+    account.GID = p_grp->gr_gid;
+    account.Name = p_grp->gr_name;
+}
+
+// -----------------------------------------------------------------------------
+
+// it returns false if the key is not cached or the item is expired
+template<class Key>
+bool find_local_account(SLocalCache<Key>& cache,const Key& key,SLocalAccount& account)
+{
+    if( LocalCacheSize == 0 ) return(false);
+
+    double now = get_time();
+
+    pthread_mutex_lock(&LocalCacheLock);
+    typename std::map<Key,SLocalAccount>::const_iterator it = cache.Items.find(key);
+    bool found = (it != cache.Items.end()) && (it->second.Expires > now);
+    if( found ){
+        account = it->second;
+        if( account.Found ){
+            LocalCacheHits++;
+        } else {
+            LocalCacheNegativeHits++;
+        }
+    } else {
+        LocalCacheMisses++;
+    }
+    pthread_mutex_unlock(&LocalCacheLock);
+
+    return(found);
+}
+
+// -----------------------------------------------------------------------------
+
+template<class Key>
+void add_local_account(SLocalCache<Key>& cache,const Key& key,const SLocalAccount& account)
+{
+    if( LocalCacheSize == 0 ) return;
+
+    double expires = get_time() + (account.Found ? LocalCacheTTL : LocalNegativeTTL);
+
+    pthread_mutex_lock(&LocalCacheLock);
+    SLocalAccount& item = cache.Items[key];
+    item = account;
+    item.Expires = expires;
+    item.Serial = ++cache.Serial;
+    cache.Order.push_back(std::make_pair(key,item.Serial));
+
+    // the order contains also serials of replaced items, they are skipped
+    while( (cache.Items.size() > (size_t)LocalCacheSize) || (cache.Order.size() > 2*(size_t)LocalCacheSize) ){
+        typename std::map<Key,SLocalAccount>::iterator it = cache.Items.find(cache.Order.front().first);
+        if( (it != cache.Items.end()) && (it->second.Serial == cache.Order.front().second) ){
+            cache.Items.erase(it);
+            LocalCacheEvictions++;
+        }
+        cache.Order.pop_front();
+    }
+    pthread_mutex_unlock(&LocalCacheLock);
+}
+
+// -----------------------------------------------------------------------------
+
+void log_local_cache_stat(void)
+{
+    if( LocalCacheSize == 0 ) return;
+
+    pthread_mutex_lock(&LocalCacheLock);
+    syslog(LOG_INFO,"local account cache (users/groups/uids/gids): %d/%d/%d/%d, hits: %lu (negative %lu), misses: %lu, evictions: %lu",
+           (int)LocalUserCache.Items.size(),(int)LocalGroupCache.Items.size(),
+           (int)LocalUserIDCache.Items.size(),(int)LocalGroupIDCache.Items.size(),
+           LocalCacheHits+LocalCacheNegativeHits,LocalCacheNegativeHits,LocalCacheMisses,LocalCacheEvictions);
+    pthread_mutex_unlock(&LocalCacheLock);
+
+    pthread_mutex_lock(&PrincCacheLock);
+    syslog(LOG_INFO,"principal cache: %d, hits: %lu, misses: %lu, invalidations: %lu",
+           (int)PrincCache.size(),PrincCacheHits,PrincCacheMisses,PrincCacheInvalidations);
+    pthread_mutex_unlock(&PrincCacheLock);
+}
+
+// -----------------------------------------------------------------------------
+
+void get_princ_record(const std::string& princ,SPrincRecord& record)
+{
+    double now = get_time();
+    unsigned long generation;
+
+    pthread_mutex_lock(&PrincCacheLock);
+    std::map<std::string,SPrincRecord>::const_iterator pit = PrincCache.find(princ);
+    if( (pit != PrincCache.end()) && (pit->second.Expires > now) ){
+        record = pit->second;
+        PrincCacheHits++;
+        pthread_mutex_unlock(&PrincCacheLock);
+        return;
+    }
+    PrincCacheMisses++;
+    generation = PrincCacheGeneration;
+    pthread_mutex_unlock(&PrincCacheLock);
+
+    std::string lname;
+    {
+        CReadLock lock(&DataLock);
+        std::map<std::string,std::string>::iterator it = PrincipalMap.find(princ);
+        if( it != PrincipalMap.end() ){
+            lname = it->second;
+        } else {
+            lname = is_princ_local(princ);
+        }
+    }
+
+    memset(&record.Header,0,sizeof(record.Header));
+    bool found = false;
+    bool failed = false;
+
+    if( (! lname.empty()) && (lname.find("@") == std::string::npos) ){
+        uid_t uid;
+        gid_t gid;
+        if( get_local_user(lname,uid,gid) ){    // only LOCAL query!!!
+            strncpy(record.Header.Name,lname.c_str(),MAX_NAME);
+            record.Header.ID.UID = uid;
+            record.Header.Extra.GID = gid;
+            found = true;
+        } else {
+            failed = errno != 0;
+        }
+    }
+    // root squash
+    if( (record.Header.ID.UID == 0) || (record.Header.Extra.GID == 0) ){
+        strncpy(record.Header.Name,NoBody.c_str(),MAX_NAME);
+        record.Header.ID.UID = NobodyID;
+        record.Header.Extra.GID = NoGroupID;
+        found = false;
+    }
+
+    std::vector<gid_t> groups(1,record.Header.Extra.GID);
+    if( found ) get_supplementary_groups(lname,record.Header.Extra.GID,groups);
+    record.Groups.reset(new std::string((const char*)&groups[0],groups.size()*sizeof(gid_t)));
+
+    // failures of local queries are not cached
+    if( (LocalCacheSize == 0) || failed ) return;
+
+    record.Expires = get_time() + (found ? LocalCacheTTL : LocalNegativeTTL);
+
+    pthread_mutex_lock(&PrincCacheLock);
+    if( generation == PrincCacheGeneration ){
+        if( PrincCache.size() >= (size_t)LocalCacheSize ){
+            // drop expired records, all if there are none
+            std::map<std::string,SPrincRecord>::iterator it = PrincCache.begin();
+            while( it != PrincCache.end() ){
+                if( it->second.Expires <= now ){
+                    PrincCache.erase(it++);
+                } else {
+                    it++;
+                }
+            }
+            if( PrincCache.size() >= (size_t)LocalCacheSize ) PrincCache.clear();
+        }
+        PrincCache[princ] = record;
+    }
+    pthread_mutex_unlock(&PrincCacheLock);
+}
+
+// -----------------------------------------------------------------------------
+
+// local groups and groups from the group file, in which the local user is a member
+void get_supplementary_groups(const std::string& lname,gid_t gid,std::vector<gid_t>& groups)
+{
+    // the daemon does not contact itself (NO_DAEMON_ENV), thus these are only local groups
+    std::vector<gid_t> lgroups(64);
+    int ngroups = lgroups.size();
+    while( getgrouplist(lname.c_str(),gid,&lgroups[0],&ngroups) < 0 ){
+        if( ngroups <= (int)lgroups.size() ) ngroups = 2*lgroups.size();
+        lgroups.resize(ngroups);
+    }
+    lgroups.resize(ngroups);
+
+    std::set<gid_t> known(groups.begin(),groups.end());
+    for(size_t i=0; i < lgroups.size(); i++){
+        if( known.insert(lgroups[i]).second ) groups.push_back(lgroups[i]);
+    }
+
+    boost::shared_ptr<const SMembership> p_membership = get_membership();
+    const std::set<gid_t>* p_groups = find_member_groups(*p_membership,lname);
+    if( p_groups == NULL ) return;
+
+    std::set<gid_t>::const_iterator it = p_groups->begin();
+    std::set<gid_t>::const_iterator ie = p_groups->end();
+    while( it != ie ){
+        if( known.insert(*it + BaseID).second ) groups.push_back(*it + BaseID);
+        it++;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void clear_princ_cache(void)
+{
+    pthread_mutex_lock(&PrincCacheLock);
+    PrincCache.clear();
+    PrincCacheGeneration++;
+    PrincCacheInvalidations++;
+    pthread_mutex_unlock(&PrincCacheLock);
+}
+
+// -----------------------------------------------------------------------------
+
+void setup_group_response(int type,gid_t gid,const char* p_name,struct SNFS4Message& data,
+                          boost::shared_ptr<const std::string>* p_members)
+{
+    boost::shared_ptr<const SMembership> p_membership = get_membership();
+    const SGroupRecord* p_rec = find_group_record(*p_membership,gid);
+
+    if( (p_rec != NULL) && (p_rec->Header.ID.GID != 0) ){
+        const SGroupRecord& rec = *p_rec;
+        if( (p_members != NULL) && (rec.Members != NULL) ){
+            data = rec.Header;
+            *p_members = rec.Members;
+        } else {
+            // members are not requested
+            memset(&data,0,sizeof(data));
+            strncpy(data.Name,rec.Header.Name,MAX_NAME);
+            data.ID.GID = rec.Header.ID.GID;
         }
-        extra_data = sextra.str();
-        len = extra_data.length();
+    } else {
+        // group without members (not in the group file)
+        memset(&data,0,sizeof(data));
+        strncpy(data.Name,p_name,MAX_NAME);
+        data.ID.GID = gid + BaseID;
     }
+    data.Type = type;
 }
 
 // -----------------------------------------------------------------------------
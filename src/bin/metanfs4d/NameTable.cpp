@@ -0,0 +1,236 @@
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type 
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+// =============================================================================
+
+#include <sys/types.h>
+#include <string.h>
+#include "NameTable.hpp"
+#include "snapshot.h"
+
+//------------------------------------------------------------------------------
+
+// header of the table image, it is followed by Names, Hash and Arena data
+struct SNameTableImage {
+    uint32_t    NumOfNames;
+    uint32_t    HashSize;
+    uint32_t    ArenaSize;
+    uint32_t    NumOfItems;
+};
+
+//==============================================================================
+//------------------------------------------------------------------------------
+//==============================================================================
+
+CNameTable::CNameTable(void)
+{
+    Clear();
+}
+
+//------------------------------------------------------------------------------
+
+void CNameTable::Clear(void)
+{
+    std::vector<char>(1,'\0').swap(Arena);
+    std::vector<uint32_t>(1,0).swap(Names);
+    std::vector<uint32_t>(16,0).swap(Hash);
+    NumOfItems = 0;
+}
+
+//==============================================================================
+//------------------------------------------------------------------------------
+//==============================================================================
+
+unsigned int CNameTable::FindID(const std::string& name) const
+{
+    return(FindID(name.c_str()));
+}
+
+//------------------------------------------------------------------------------
+
+unsigned int CNameTable::FindID(const char* p_name) const
+{
+    uint32_t mask = Hash.size() - 1;
+    uint32_t slot = snapshot_hash(p_name) & mask;
+
+    while( Hash[slot] != 0 ){
+        uint32_t id = Hash[slot];
+        if( strcmp(&Arena[Names[id]],p_name) == 0 ) return(id);
+        slot = (slot + 1) & mask;
+    }
+
+    return(0);
+}
+
+//------------------------------------------------------------------------------
+
+const char* CNameTable::FindName(unsigned int id) const
+{
+    if( (id == 0) || (id >= Names.size()) ) return(NULL);
+    if( Names[id] == 0 ) return(NULL);
+    return(&Arena[Names[id]]);
+}
+
+//==============================================================================
+//------------------------------------------------------------------------------
+//==============================================================================
+
+bool CNameTable::Add(const std::string& name,unsigned int id)
+{
+    if( id == 0 ) return(false);
+    if( (id < Names.size()) && (Names[id] != 0) ) return(false);
+    if( FindID(name) != 0 ) return(false);
+
+    // offsets are 32-bit
+    if( Arena.size() + name.size() + 1 > 0xFFFFFFFFUL ) return(false);
+
+    if( id >= Names.size() ){
+        // grow geometrically, ids are usually allocated sequentially
+        if( id >= Names.capacity() ) Names.reserve(2*id);
+        Names.resize(id+1,0);
+    }
+
+    Names[id] = Arena.size();
+    Arena.insert(Arena.end(),name.c_str(),name.c_str()+name.size()+1);
+    NumOfItems++;
+
+    // keep the load factor below 0.5
+    if( 2*NumOfItems > Hash.size() ){
+        Rehash(2*Hash.size());
+    } else {
+        InsertHash(id);
+    }
+
+    return(true);
+}
+
+//------------------------------------------------------------------------------
+
+void CNameTable::InsertHash(uint32_t id)
+{
+    uint32_t mask = Hash.size() - 1;
+    uint32_t slot = snapshot_hash(&Arena[Names[id]]) & mask;
+
+    while( Hash[slot] != 0 ){
+        slot = (slot + 1) & mask;
+    }
+    Hash[slot] = id;
+}
+
+//------------------------------------------------------------------------------
+
+void CNameTable::Rehash(size_t size)
+{
+    std::vector<uint32_t>(size,0).swap(Hash);
+    for(size_t id=1; id < Names.size(); id++){
+        if( Names[id] != 0 ) InsertHash(id);
+    }
+}
+
+//==============================================================================
+//------------------------------------------------------------------------------
+//==============================================================================
+
+void CNameTable::SaveImage(std::string& image) const
+{
+    struct SNameTableImage header;
+    header.NumOfNames = Names.size();
+    header.HashSize = Hash.size();
+    header.ArenaSize = Arena.size();
+    header.NumOfItems = NumOfItems;
+
+    image.append((const char*)&header,sizeof(header));
+    image.append((const char*)&Names[0],Names.size()*sizeof(uint32_t));
+    image.append((const char*)&Hash[0],Hash.size()*sizeof(uint32_t));
+    image.append(&Arena[0],Arena.size());
+
+    // keep the next image aligned
+    size_t size = sizeof(header) + (Names.size() + Hash.size())*sizeof(uint32_t) + Arena.size();
+    if( size % 8 != 0 ) image.append(8 - size % 8,'\0');
+}
+
+//------------------------------------------------------------------------------
+
+bool CNameTable::LoadImage(const char* p_image,size_t size)
+{
+    if( size < sizeof(struct SNameTableImage) ) return(false);
+
+    struct SNameTableImage header;
+    memcpy(&header,p_image,sizeof(header));
+
+    if( (header.NumOfNames < 1) || (header.ArenaSize < 1) ) return(false);
+    if( (header.HashSize < 16) || ((header.HashSize & (header.HashSize - 1)) != 0) ) return(false);
+    if( 2*(uint64_t)header.NumOfItems > header.HashSize ) return(false);
+
+    uint64_t len = sizeof(header) + ((uint64_t)header.NumOfNames + header.HashSize)*sizeof(uint32_t) + header.ArenaSize;
+    if( len > size ) return(false);
+
+    const uint32_t* p_names = (const uint32_t*)(p_image + sizeof(header));
+    const uint32_t* p_hash = p_names + header.NumOfNames;
+    const char*     p_arena = (const char*)(p_hash + header.HashSize);
+
+    // all offsets and ids must be valid, otherwise lookups could crash
+    if( (p_arena[0] != '\0') || (p_arena[header.ArenaSize-1] != '\0') ) return(false);
+    if( p_names[0] != 0 ) return(false);
+
+    size_t num_of_names = 0;
+    for(uint32_t id=1; id < header.NumOfNames; id++){
+        if( p_names[id] >= header.ArenaSize ) return(false);
+        if( p_names[id] != 0 ) num_of_names++;
+    }
+    size_t num_of_slots = 0;
+    for(uint32_t slot=0; slot < header.HashSize; slot++){
+        uint32_t id = p_hash[slot];
+        if( id == 0 ) continue;
+        if( (id >= header.NumOfNames) || (p_names[id] == 0) ) return(false);
+        num_of_slots++;
+    }
+    if( (num_of_names != header.NumOfItems) || (num_of_slots != header.NumOfItems) ) return(false);
+
+    Names.assign(p_names,p_names + header.NumOfNames);
+    Hash.assign(p_hash,p_hash + header.HashSize);
+    Arena.assign(p_arena,p_arena + header.ArenaSize);
+    NumOfItems = header.NumOfItems;
+
+    return(true);
+}
+
+//==============================================================================
+//------------------------------------------------------------------------------
+//==============================================================================
+
+unsigned int CNameTable::GetTopID(void) const
+{
+    return(Names.size() - 1);
+}
+
+//------------------------------------------------------------------------------
+
+size_t CNameTable::GetNumOfItems(void) const
+{
+    return(NumOfItems);
+}
+
+//------------------------------------------------------------------------------
+
+size_t CNameTable::GetMemoryUsage(void) const
+{
+    return(Arena.capacity() + (Names.capacity() + Hash.capacity())*sizeof(uint32_t));
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,85 @@
+#ifndef NameTableH
+#define NameTableH
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type 
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+// names indexed by small positive ids and ids indexed by names, ids are used
+// as indexes to a dense table, names are stored in one arena and found
+// by an open addressing hash table, nothing is inserted by lookups
+
+class CNameTable {
+public:
+    CNameTable(void);
+
+// lookups ---------------------------------------------------------------------
+    // return id of the name or 0 if it does not exist
+    unsigned int FindID(const std::string& name) const;
+    unsigned int FindID(const char* p_name) const;
+
+    // return name of the id or NULL if it does not exist
+    const char* FindName(unsigned int id) const;
+
+// registration ----------------------------------------------------------------
+    // add name with given id, it fails if the name or the id is already used
+    bool Add(const std::string& name,unsigned int id);
+
+    // remove all names
+    void Clear(void);
+
+// binary image ----------------------------------------------------------------
+    // append image of the table to the buffer, the image size is a multiple of 8
+    void SaveImage(std::string& image) const;
+
+    // replace the table by its image, the image is only checked, names are not
+    // parsed nor hashed again, it fails if the image is not valid
+    bool LoadImage(const char* p_image,size_t size);
+
+// information -----------------------------------------------------------------
+    // the highest id in the table
+    unsigned int GetTopID(void) const;
+
+    // number of names
+    size_t GetNumOfItems(void) const;
+
+    // allocated memory in bytes
+    size_t GetMemoryUsage(void) const;
+
+// section of private data -----------------------------------------------------
+private:
+    std::vector<char>       Arena;      // \0 terminated names, offset 0 is not used
+    std::vector<uint32_t>   Names;      // id -> offset of name in Arena, 0 - no name
+    std::vector<uint32_t>   Hash;       // ids, 0 - empty slot, linear probing
+    size_t                  NumOfItems;
+
+    // insert id into the hash table
+    void InsertHash(uint32_t id);
+
+    // resize the hash table
+    void Rehash(size_t size);
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -9,22 +10,148 @@
 #include <nss.h>
 #include <errno.h>
 #include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include "common.h"
+#include "snapshot.h"
+
+/* -------------------------------------------------------------------------- */
+/*
+    Each thread keeps its own connection to the daemon, which is reused for
+    all requests. The connection is reopened after fork and when the daemon
+    closes it (restart, idle timeout). The protocol version is negotiated
+    when the connection is opened.
+*/
+
+struct SNFS4Connection {
+    int         Socket;
+    pid_t       PID;            /* owner process, to detect fork */
+    int         Version;        /* protocol version used on the connection */
+    char*       Buffer;         /* payload of the last response of the v1 interface */
+    size_t      BufferSize;
+    const char* Extra;          /* extra data of the last response in Buffer, NULL - none */
+    size_t      ExtraLen;
+};
+
+DLL_LOCAL pthread_key_t     _metanfs4_conn_key;
+DLL_LOCAL pthread_once_t    _metanfs4_conn_once = PTHREAD_ONCE_INIT;
+
+/* the daemon does not support protocol v2, the handshake is tried again after this time */
+DLL_LOCAL time_t            _metanfs4_v1_until  = 0;
+
+#define V1_RETRY_TIME       60
+
+/*
+    Responses are cached in a direct mapped table shared by all threads. Each
+    response carries the generation of the daemon data and only responses of
+    the current generation are served from the cache. The current generation
+    is read from the shared state of the daemon, thus any change of data
+    invalidates the whole cache immediately. Older daemons do not publish the
+    generation, the highest received generation is then the current one and
+    not found responses are not cached because the process would not see new
+    ids until they expire.
+*/
+
+struct SNFS4CacheItem {
+    int                 Used;
+    uint32_t            Type;           /* request */
+    uint32_t            ID;
+    char*               Name;           /* NULL - no name */
+    struct SNFS4Header  Response;
+    char*               Payload;        /* Response.NameLen + Response.DataLen bytes */
+    time_t              Expires;
+};
+
+DLL_LOCAL pthread_once_t        _metanfs4_cache_once = PTHREAD_ONCE_INIT;
+DLL_LOCAL pthread_mutex_t       _metanfs4_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+DLL_LOCAL struct SNFS4CacheItem* _metanfs4_cache = NULL;    /* NULL - cache is disabled */
+DLL_LOCAL size_t                _metanfs4_cache_size = 0;   /* power of two */
+DLL_LOCAL time_t                _metanfs4_cache_ttl = CACHE_DEFAULT_TTL;
+DLL_LOCAL unsigned int          _metanfs4_instance = 0;     /* the current generation (the highest received) */
+DLL_LOCAL unsigned int          _metanfs4_generation = 0;
+
+/* the shared state of the daemon, it is mapped once and never unmapped */
+DLL_LOCAL pthread_mutex_t           _metanfs4_state_lock    = PTHREAD_MUTEX_INITIALIZER;
+DLL_LOCAL const struct SNFS4State*  _metanfs4_state         = NULL;
+DLL_LOCAL time_t                    _metanfs4_state_tried   = 0;
+
+DLL_LOCAL void update_generation(const struct SNFS4Header* p_header);
+DLL_LOCAL int exchange_v1(struct SNFS4Message* p_msg,const void* p_extra,size_t extra_len,int cached);
 
 /* -------------------------------------------------------------------------- */
 
 DLL_LOCAL
-int exchange_data(struct SNFS4Message* p_msg)
+void destroy_connection(void* p_data)
+{
+    struct SNFS4Connection* p_conn = (struct SNFS4Connection*)p_data;
+    if( p_conn == NULL ) return;
+    if( (p_conn->Socket >= 0) && (p_conn->PID == getpid()) ) close(p_conn->Socket);
+    free(p_conn->Buffer);
+    free(p_conn);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+void init_connection_key(void)
+{
+    pthread_key_create(&_metanfs4_conn_key,destroy_connection);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+struct SNFS4Connection* get_connection(void)
+{
+    struct SNFS4Connection* p_conn;
+
+    pthread_once(&_metanfs4_conn_once,init_connection_key);
+
+    p_conn = (struct SNFS4Connection*)pthread_getspecific(_metanfs4_conn_key);
+    if( p_conn == NULL ){
+        p_conn = (struct SNFS4Connection*)calloc(1,sizeof(struct SNFS4Connection));
+        if( p_conn == NULL ) return(NULL);
+        p_conn->Socket = -1;
+        p_conn->PID = getpid();
+        if( pthread_setspecific(_metanfs4_conn_key,p_conn) != 0 ){
+            free(p_conn);
+            return(NULL);
+        }
+    }
+
+    if( p_conn->PID != getpid() ){
+        /* forked child - the socket is shared with the parent */
+        if( p_conn->Socket >= 0 ) close(p_conn->Socket);
+        p_conn->Socket = -1;
+        p_conn->PID = getpid();
+    }
+
+    return(p_conn);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+void close_connection(struct SNFS4Connection* p_conn)
+{
+    if( p_conn->Socket >= 0 ) close(p_conn->Socket);
+    p_conn->Socket = -1;
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int connect_socket(void)
 {
     struct sockaddr_un  address;
     socklen_t           addrlen;
-    int                 type;
-    int                 clisckt;
-
-    if( p_msg == NULL ) return(-1);
+    int                 socket_fd;
 
-    clisckt = socket(AF_UNIX,SOCK_SEQPACKET,0);
-    if( clisckt == -1 ) return(-1);
+    socket_fd = socket(AF_UNIX,SOCK_SEQPACKET | SOCK_CLOEXEC,0);
+    if( socket_fd == -1 ) return(-1);
 
     memset(&address, 0, sizeof(struct sockaddr_un));
 
@@ -33,35 +160,667 @@ int exchange_data(struct SNFS4Message* p_msg)
 
     addrlen = offsetof(struct sockaddr_un, sun_path) + strlen(address.sun_path) + 1;
 
-    if( connect(clisckt,(struct sockaddr *) &address, addrlen) == -1 ){
-        close(clisckt);
+    if( connect(socket_fd,(struct sockaddr *) &address, addrlen) == -1 ){
+        close(socket_fd);
         return(-1);
     }
 
-    type = p_msg->Type;
+    return(socket_fd);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int negotiate_version(int socket_fd)
+{
+    struct SNFS4Header  hello;
+
+    memset(&hello,0,sizeof(hello));
+    hello.Magic = PROTOCOL_MAGIC;
+    hello.Type = MSG_HELLO;
+    hello.ID = PROTOCOL_VERSION;
+
+    if( send(socket_fd,&hello,sizeof(hello),MSG_NOSIGNAL) != sizeof(hello) ) return(-1);
+
+    if( (recv(socket_fd,&hello,sizeof(hello),0) == sizeof(hello)) &&
+        (hello.Magic == PROTOCOL_MAGIC) && (hello.Type == MSG_HELLO) && (hello.ID >= 2) ){
+        return(hello.ID < PROTOCOL_VERSION ? hello.ID : PROTOCOL_VERSION);
+    }
+
+    return(1);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int connect_daemon(struct SNFS4Connection* p_conn)
+{
+    p_conn->Socket = connect_socket();
+    if( p_conn->Socket == -1 ) return(-1);
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int open_connection(struct SNFS4Connection* p_conn)
+{
+    time_t  now;
+    int     version;
+
+    if( connect_daemon(p_conn) != 0 ) return(-1);
 
-    if( write(clisckt,p_msg,sizeof(struct SNFS4Message)) != sizeof(struct SNFS4Message) ){
-        close(clisckt);
+    p_conn->Version = 1;
+    now = time(NULL);
+    if( __atomic_load_n(&_metanfs4_v1_until,__ATOMIC_RELAXED) > now ) return(0);
+
+    /* protocol handshake, plugins do not use tagged records */
+    version = negotiate_version(p_conn->Socket);
+    if( version < 0 ){
+        close_connection(p_conn);
         return(-1);
     }
+    if( version >= 2 ){
+        p_conn->Version = 2;
+        return(0);
+    }
 
-    memset(p_msg,0,sizeof(struct SNFS4Message));
+    /* the daemon supporting only v1 closes the connection */
+    __atomic_store_n(&_metanfs4_v1_until,now + V1_RETRY_TIME,__ATOMIC_RELAXED);
+    close_connection(p_conn);
+    if( connect_daemon(p_conn) != 0 ) return(-1);
+    p_conn->Version = 1;
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* send the request and receive its response in protocol v2 */
+
+DLL_LOCAL
+int transact_v2(struct SNFS4Connection* p_conn,struct SNFS4Header* p_header,const char* p_name,
+                const void* p_data,void* p_buffer,size_t len)
+{
+    struct msghdr   msg;
+    struct iovec    iov[3];
+    ssize_t         rlen;
+
+    p_header->Magic = PROTOCOL_MAGIC;
+    p_header->NameLen = p_name != NULL ? strlen(p_name) + 1 : 0;
+    p_header->MaxLen = len;
+    p_header->Status = 0;
+    if( p_data == NULL ) p_header->DataLen = 0;
 
-    if( read(clisckt,p_msg,sizeof(struct SNFS4Message)) != sizeof(struct SNFS4Message) ){
-        close(clisckt);
+    iov[0].iov_base = p_header;
+    iov[0].iov_len = sizeof(struct SNFS4Header);
+    iov[1].iov_base = (void*)p_name;
+    iov[1].iov_len = p_header->NameLen;
+    iov[2].iov_base = (void*)p_data;
+    iov[2].iov_len = p_header->DataLen;
+
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+    if( sendmsg(p_conn->Socket,&msg,MSG_NOSIGNAL) != (ssize_t)(sizeof(struct SNFS4Header) + p_header->NameLen + p_header->DataLen) ){
         return(-1);
     }
 
-    close(clisckt);
+    /* the payload is received directly into the buffer of the caller */
+    memset(p_header,0,sizeof(struct SNFS4Header));
+    iov[0].iov_base = p_header;
+    iov[0].iov_len = sizeof(struct SNFS4Header);
+    iov[1].iov_base = p_buffer;
+    iov[1].iov_len = len;
+
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    rlen = recvmsg(p_conn->Socket,&msg,0);
+    if( (rlen < (ssize_t)sizeof(struct SNFS4Header)) || (msg.msg_flags & MSG_TRUNC) ) return(-1);
+    if( p_header->Magic != PROTOCOL_MAGIC ) return(-1);
+
+    if( p_header->Status == ERANGE ){
+        if( rlen != sizeof(struct SNFS4Header) ) return(-1);
+        return(-ERANGE);
+    }
+    if( (size_t)rlen != sizeof(struct SNFS4Header) + (size_t)p_header->NameLen + p_header->DataLen ) return(-1);
+    if( (p_header->NameLen > 0) && (((const char*)p_buffer)[p_header->NameLen-1] != '\0') ) return(-1);
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* send the request and receive its response in protocol v1, names are limited to MAX_NAME */
+
+DLL_LOCAL
+int transact_v1(struct SNFS4Connection* p_conn,struct SNFS4Header* p_header,const char* p_name,
+                const void* p_data,void* p_buffer,size_t len)
+{
+    struct SNFS4Message msg;
+    size_t              name_len;
+    char                dummy;
+
+    memset(&msg,0,sizeof(msg));
+    msg.Type = p_header->Type;
+    msg.ID.UID = p_header->ID;
+    msg.Extra.UID = p_header->Extra;
+    msg.Len = p_data != NULL ? p_header->DataLen : 0;
+    if( p_name != NULL ) strncpy(msg.Name,p_name,MAX_NAME);
+
+    if( send(p_conn->Socket,&msg,sizeof(msg),MSG_NOSIGNAL) != sizeof(msg) ) return(-1);
+    if( (msg.Len > 0) && (send(p_conn->Socket,p_data,msg.Len,MSG_NOSIGNAL) != (ssize_t)msg.Len) ) return(-1);
+
+    memset(&msg,0,sizeof(msg));
+    if( recv(p_conn->Socket,&msg,sizeof(msg),0) != sizeof(msg) ) return(-1);
+    msg.Name[MAX_NAME] = '\0';
+
+    name_len = strlen(msg.Name);
+    if( name_len > 0 ) name_len++;
+
+    memset(p_header,0,sizeof(struct SNFS4Header));
+    p_header->Magic = PROTOCOL_MAGIC;
+    p_header->Type = msg.Type;
+    p_header->ID = msg.ID.UID;
+    p_header->Extra = msg.Extra.UID;
+    p_header->Generation = msg.Generation;
+    p_header->Instance = msg.Instance;
+
+    if( name_len + msg.Len > len ){
+        /* the record with extra data is discarded */
+        if( (msg.Len > 0) && (recv(p_conn->Socket,&dummy,sizeof(dummy),0) < 0) ) return(-1);
+        p_header->NameLen = name_len;
+        p_header->DataLen = msg.Len;
+        p_header->MaxLen = name_len + msg.Len;
+        p_header->Status = ERANGE;
+        return(-ERANGE);
+    }
+
+    p_header->NameLen = name_len;
+    p_header->DataLen = msg.Len;
+    if( name_len > 0 ) memcpy(p_buffer,msg.Name,name_len);
+    if( (msg.Len > 0) && (recv(p_conn->Socket,(char*)p_buffer + name_len,msg.Len,0) != (ssize_t)msg.Len) ) return(-1);
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int exchange_message(struct SNFS4Header* p_header,const char* p_name,const void* p_data,
+                     void* p_buffer,size_t len)
+{
+    struct SNFS4Connection* p_conn;
+    struct SNFS4Header      request;
+    int                     reused;
+    int                     ret;
+
+    if( p_header == NULL ) return(-1);
+    if( (p_buffer == NULL) && (len > 0) ) return(-1);
+    if( (p_name != NULL) && (strlen(p_name) > MAX_NAME_V2) ) return(-1);
+    if( getenv(NO_DAEMON_ENV) != NULL ) return(-1);
+
+    p_conn = get_connection();
+    if( p_conn == NULL ) return(-1);
+
+    memcpy(&request,p_header,sizeof(request));
+
+    do {
+        reused = p_conn->Socket >= 0;
+        if( reused == 0 ){
+            if( open_connection(p_conn) != 0 ) return(-1);
+        }
+
+        memcpy(p_header,&request,sizeof(request));
+        if( p_conn->Version >= 2 ){
+            ret = transact_v2(p_conn,p_header,p_name,p_data,p_buffer,len);
+        } else {
+            ret = transact_v1(p_conn,p_header,p_name,p_data,p_buffer,len);
+        }
+        if( ret != -1 ) break;
+
+        /* the daemon closed the connection (restart, idle timeout) - try it once more with a new one */
+        close_connection(p_conn);
+        if( reused == 0 ) return(-1);
+    } while( 1 );
+
+    update_generation(p_header);
+
+    return(ret);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int exchange_data(struct SNFS4Message* p_msg)
+{
+    return(exchange_v1(p_msg,NULL,0,0));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int exchange_data_extra(struct SNFS4Message* p_msg,const void* p_extra,size_t extra_len)
+{
+    return(exchange_v1(p_msg,p_extra,extra_len,0));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int exchange_data_cached(struct SNFS4Message* p_msg)
+{
+    return(exchange_v1(p_msg,NULL,0,1));
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* the SNFS4Message interface over exchange_message(), the payload is received
+   into the buffer of the connection and extra data are kept there until they
+   are received by receive_extra_data() or the next exchange */
+
+DLL_LOCAL
+int exchange_v1(struct SNFS4Message* p_msg,const void* p_extra,size_t extra_len,int cached)
+{
+    struct SNFS4Connection* p_conn;
+    struct SNFS4Header      header;
+    char                    name[MAX_NAME+1];
+    char*                   p_buffer;
+    size_t                  name_len;
+    int                     type;
+    int                     ret;
+
+    if( p_msg == NULL ) return(-1);
+
+    p_conn = get_connection();
+    if( p_conn == NULL ) return(-1);
+
+    /* extra data not consumed by the previous request are discarded */
+    p_conn->Extra = NULL;
+    p_conn->ExtraLen = 0;
+
+    if( p_conn->Buffer == NULL ){
+        /* large enough for usual enumeration chunks and batches */
+        p_conn->Buffer = (char*)malloc(MAX_CHUNK + MAX_BUFFER);
+        if( p_conn->Buffer == NULL ) return(-1);
+        p_conn->BufferSize = MAX_CHUNK + MAX_BUFFER;
+    }
+
+    type = p_msg->Type;
+    memcpy(name,p_msg->Name,MAX_NAME);
+    name[MAX_NAME] = '\0';
+
+    do {
+        memset(&header,0,sizeof(header));
+        header.Type = type;
+        header.ID = p_msg->ID.UID;
+        header.Extra = p_msg->Extra.UID;
+        header.DataLen = p_extra != NULL ? extra_len : 0;
+
+        if( cached && (p_extra == NULL) ){
+            ret = exchange_message_cached(&header,name[0] != '\0' ? name : NULL,p_conn->Buffer,p_conn->BufferSize);
+        } else {
+            ret = exchange_message(&header,name[0] != '\0' ? name : NULL,p_extra,p_conn->Buffer,p_conn->BufferSize);
+        }
+        if( ret != -ERANGE ) break;
+
+        /* enlarge the buffer and repeat the request */
+        if( header.MaxLen <= p_conn->BufferSize ) return(-1);
+        p_buffer = (char*)realloc(p_conn->Buffer,header.MaxLen);
+        if( p_buffer == NULL ) return(-1);
+        p_conn->Buffer = p_buffer;
+        p_conn->BufferSize = header.MaxLen;
+    } while( 1 );
+
+    memset(p_msg,0,sizeof(struct SNFS4Message));
+    if( ret != 0 ) return(-1);
+
+    p_msg->Type = header.Type;
+    p_msg->ID.UID = header.ID;
+    p_msg->Extra.UID = header.Extra;
+    p_msg->Generation = header.Generation;
+    p_msg->Instance = header.Instance;
+    p_msg->Len = header.DataLen;
 
-    /* ensure \0 termination of the string */
+    /* longer names cannot be provided by this interface */
+    name_len = header.NameLen;
+    if( name_len > MAX_NAME ) name_len = MAX_NAME;
+    if( name_len > 0 ) memcpy(p_msg->Name,p_conn->Buffer,name_len);
     p_msg->Name[MAX_NAME] = '\0';
 
-    if( p_msg->Type == type) return(0);
+    if( header.DataLen > 0 ){
+        p_conn->Extra = p_conn->Buffer + header.NameLen;
+        p_conn->ExtraLen = header.DataLen;
+    }
+
+    if( p_msg->Type == type ) return(0);
 
     return(-1);
 }
 
 /* -------------------------------------------------------------------------- */
 
+DLL_LOCAL
+int receive_extra_data(void* p_buffer,size_t len)
+{
+    struct SNFS4Connection* p_conn;
+
+    p_conn = get_connection();
+    if( p_conn == NULL ) return(-1);
+
+    if( (p_conn->Extra == NULL) || (p_conn->ExtraLen < len) ){
+        p_conn->Extra = NULL;
+        return(-1);
+    }
+
+    memcpy(p_buffer,p_conn->Extra,len);
+    p_conn->Extra = NULL;
+    p_conn->ExtraLen = 0;
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+void init_cache(void)
+{
+    const char*     p_env;
+    char*           p_end;
+    unsigned long   size;
+    long            ttl;
+
+    p_env = getenv(CACHE_ENV);
+    if( p_env == NULL ) return;
+
+    size = strtoul(p_env,&p_end,10);
+    if( *p_end == ':' ){
+        ttl = strtol(p_end+1,&p_end,10);
+        if( ttl > 0 ) _metanfs4_cache_ttl = ttl;
+    }
+    if( (size == 0) || (*p_end != '\0') ) return;
+    if( size > 1048576 ) size = 1048576;
+
+    _metanfs4_cache_size = 1;
+    while( _metanfs4_cache_size < size ) _metanfs4_cache_size *= 2;
+
+    _metanfs4_cache = (struct SNFS4CacheItem*)calloc(_metanfs4_cache_size,sizeof(struct SNFS4CacheItem));
+    if( _metanfs4_cache == NULL ) _metanfs4_cache_size = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+time_t get_cache_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* FNV-1a hash of the request */
+DLL_LOCAL
+size_t get_cache_index(const struct SNFS4Header* p_header,const char* p_name)
+{
+    unsigned int    hash = 2166136261U;
+
+    hash = (hash ^ p_header->Type) * 16777619U;
+    hash = (hash ^ p_header->ID) * 16777619U;
+    while( (p_name != NULL) && (*p_name != '\0') ){
+        hash ^= (unsigned char)(*p_name);
+        hash *= 16777619U;
+        p_name++;
+    }
+    return(hash & (_metanfs4_cache_size - 1));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+void update_generation(const struct SNFS4Header* p_header)
+{
+    pthread_once(&_metanfs4_cache_once,init_cache);
+
+    /* the daemon does not provide generations */
+    if( (_metanfs4_cache == NULL) || (p_header->Instance == 0) ) return;
+
+    pthread_mutex_lock(&_metanfs4_cache_lock);
+    if( p_header->Instance != _metanfs4_instance ){
+        /* the daemon was restarted */
+        _metanfs4_instance = p_header->Instance;
+        _metanfs4_generation = p_header->Generation;
+    } else if( (int)(p_header->Generation - _metanfs4_generation) > 0 ){
+        _metanfs4_generation = p_header->Generation;
+    }
+    pthread_mutex_unlock(&_metanfs4_cache_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int exchange_message_cached(struct SNFS4Header* p_header,const char* p_name,
+                            void* p_buffer,size_t len)
+{
+    struct SNFS4CacheItem*  p_item;
+    struct SNFS4Header      request;
+    char*                   p_payload;
+    char*                   p_copy;
+    size_t                  size;
+    size_t                  index;
+    time_t                  now;
+    unsigned int            instance;
+    unsigned int            generation;
+    int                     published;
+    int                     ret;
+
+    if( p_header == NULL ) return(-1);
+    p_header->DataLen = 0;
+
+    pthread_once(&_metanfs4_cache_once,init_cache);
+    if( _metanfs4_cache == NULL ) return(exchange_message(p_header,p_name,NULL,p_buffer,len));
 
+    memcpy(&request,p_header,sizeof(request));
+    index = get_cache_index(&request,p_name);
+    now = get_cache_time();
+    published = get_data_generation(&instance,&generation) == 0;
+
+    /* cached response */
+    pthread_mutex_lock(&_metanfs4_cache_lock);
+    if( ! published ){
+        instance = _metanfs4_instance;
+        generation = _metanfs4_generation;
+    }
+    p_item = &_metanfs4_cache[index];
+    if( p_item->Used && (p_item->Type == request.Type) && (p_item->ID == request.ID) &&
+        ( (p_item->Name == NULL) == (p_name == NULL) ) &&
+        ( (p_name == NULL) || (strcmp(p_item->Name,p_name) == 0) ) && (p_item->Expires > now) &&
+        (p_item->Response.Instance == instance) && (p_item->Response.Generation == generation) ){
+        memcpy(p_header,&p_item->Response,sizeof(struct SNFS4Header));
+        size = (size_t)p_item->Response.NameLen + p_item->Response.DataLen;
+        if( size > len ){
+            pthread_mutex_unlock(&_metanfs4_cache_lock);
+            p_header->MaxLen = size;
+            p_header->Status = ERANGE;
+            return(-ERANGE);
+        }
+        if( size > 0 ) memcpy(p_buffer,p_item->Payload,size);
+        pthread_mutex_unlock(&_metanfs4_cache_lock);
+        return(0);
+    }
+    pthread_mutex_unlock(&_metanfs4_cache_lock);
+
+    ret = exchange_message(p_header,p_name,NULL,p_buffer,len);
+
+    /* failed exchange or the daemon does not provide generations */
+    if( (ret != 0) || (p_header->Instance == 0) ) return(ret);
+
+    /* not found response can be invalidated only by the published generation */
+    if( (p_header->Type != request.Type) && (! published) ) return(ret);
+
+    size = (size_t)p_header->NameLen + p_header->DataLen;
+    if( size > CACHE_MAX_EXTRA ) return(ret);
+
+    p_payload = NULL;
+    p_copy = NULL;
+    if( size > 0 ){
+        p_payload = (char*)malloc(size);
+        if( p_payload == NULL ) return(ret);
+        memcpy(p_payload,p_buffer,size);
+    }
+    if( p_name != NULL ){
+        p_copy = strdup(p_name);
+        if( p_copy == NULL ){
+            free(p_payload);
+            return(ret);
+        }
+    }
+
+    pthread_mutex_lock(&_metanfs4_cache_lock);
+    p_item = &_metanfs4_cache[index];
+    free(p_item->Name);
+    free(p_item->Payload);
+    p_item->Used = 1;
+    p_item->Type = request.Type;
+    p_item->ID = request.ID;
+    p_item->Name = p_copy;
+    memcpy(&p_item->Response,p_header,sizeof(struct SNFS4Header));
+    p_item->Payload = p_payload;
+    p_item->Expires = now + _metanfs4_cache_ttl;
+    pthread_mutex_unlock(&_metanfs4_cache_lock);
+
+    return(ret);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+const struct SNFS4State* map_state(void)
+{
+    const struct SNFS4State*    p_state;
+    time_t                      now;
+    int                         fd;
+    void*                       p_data;
+
+    p_state = __atomic_load_n(&_metanfs4_state,__ATOMIC_ACQUIRE);
+    if( p_state != NULL ) return(p_state);
+
+    /* try to map the state at most once per second */
+    now = time(NULL);
+    pthread_mutex_lock(&_metanfs4_state_lock);
+    if( (_metanfs4_state == NULL) && (_metanfs4_state_tried != now) ){
+        _metanfs4_state_tried = now;
+        fd = open(STATENAME,O_RDONLY | O_CLOEXEC);
+        if( fd >= 0 ){
+            p_data = mmap(NULL,sizeof(struct SNFS4State),PROT_READ,MAP_SHARED,fd,0);
+            if( p_data != MAP_FAILED ){
+                __atomic_store_n(&_metanfs4_state,(const struct SNFS4State*)p_data,__ATOMIC_RELEASE);
+            }
+            close(fd);
+        }
+    }
+    p_state = _metanfs4_state;
+    pthread_mutex_unlock(&_metanfs4_state_lock);
+
+    return(p_state);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* the daemon updates the top ids before new ids are provided to any client,
+   thus registered ids are never rejected */
+
+DLL_LOCAL
+int is_foreign_uid(uid_t uid)
+{
+    const struct SNFS4State* p_state = map_state();
+
+    if( p_state == NULL ) return(0);
+    if( (__atomic_load_n(&p_state->Flags,__ATOMIC_ACQUIRE) & STATE_RANGE) == 0 ) return(0);
+
+    if( uid <= p_state->BaseID ) return(1);
+    return( uid - p_state->BaseID > __atomic_load_n(&p_state->TopUserID,__ATOMIC_ACQUIRE) );
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int is_foreign_gid(gid_t gid)
+{
+    const struct SNFS4State* p_state = map_state();
+
+    if( p_state == NULL ) return(0);
+    if( (__atomic_load_n(&p_state->Flags,__ATOMIC_ACQUIRE) & STATE_RANGE) == 0 ) return(0);
+
+    if( gid <= p_state->BaseID ) return(1);
+    return( gid - p_state->BaseID > __atomic_load_n(&p_state->TopGroupID,__ATOMIC_ACQUIRE) );
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int get_data_generation(unsigned int* p_instance,unsigned int* p_generation)
+{
+    const struct SNFS4State* p_state = map_state();
+
+    if( p_state == NULL ) return(-1);
+    if( (__atomic_load_n(&p_state->Flags,__ATOMIC_ACQUIRE) & STATE_DATA) == 0 ) return(-1);
+
+    *p_instance = p_state->DataInstance;
+    *p_generation = __atomic_load_n(&p_state->DataGeneration,__ATOMIC_ACQUIRE);
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int get_nobody_ids(uid_t* p_uid,gid_t* p_gid)
+{
+    const struct SNFS4State* p_state = map_state();
+
+    if( p_state == NULL ) return(-1);
+    if( (__atomic_load_n(&p_state->Flags,__ATOMIC_ACQUIRE) & STATE_RANGE) == 0 ) return(-1);
+
+    if( p_uid != NULL ) *p_uid = p_state->NobodyID;
+    if( p_gid != NULL ) *p_gid = p_state->NoGroupID;
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int map_to_local_domain(const char* name,int group,char* lname,size_t len)
+{
+    const struct SNFS4State*    p_state = map_state();
+    const char*                 p_root;
+    size_t                      nlen;
+    size_t                      dlen;
+
+    if( p_state == NULL ) return(-1);
+    if( (__atomic_load_n(&p_state->Flags,__ATOMIC_ACQUIRE) & STATE_NAMES) == 0 ) return(-1);
+
+    /* root is mapped to nobody/nogroup without domain */
+    if( strcmp(name,"root") == 0 ){
+        p_root = group ? p_state->NoGroup : p_state->NoBody;
+        nlen = strnlen(p_root,MAX_NAME);
+        if( nlen + 1 > len ) return(-ERANGE);
+        memcpy(lname,p_root,nlen);
+        lname[nlen] = '\0';
+        return(0);
+    }
+
+    nlen = strlen(name);
+    dlen = strnlen(p_state->LocalDomain,STATE_MAX_DOMAIN);
+    if( nlen + 1 + dlen + 1 > len ) return(-ERANGE);
+    memcpy(lname,name,nlen);
+    lname[nlen] = '@';
+    memcpy(lname + nlen + 1,p_state->LocalDomain,dlen);
+    lname[nlen + 1 + dlen] = '\0';
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -22,6 +22,8 @@
 // =============================================================================
 */
 
+#include <stdint.h>
+
 /* -------------------------------------------------------------------------- */
 
 #define DLL_EXPORT __attribute__ ((visibility ("default")))
@@ -42,9 +44,23 @@
 /* max buffer for all data */
 #define MAX_BUFFER       4096
 
+/* clients in the process with this environment variable do not contact the daemon,
+   it is set by the daemon to avoid recursive requests through its own nsswitch module */
+#define NO_DAEMON_ENV   "METANFS4_NO_DAEMON"
+
 /* max number of records */
 #define MAX_RECORDS      4096
 
+/* max number of queries in one MSG_LOOKUP_BATCH/MSG_LOOKUP_BATCH_V2 request */
+#define MAX_BATCH         256
+
+/* max size of extra data in one batch request */
+#define MAX_BATCH_DATA  (MAX_BATCH*sizeof(struct SNFS4Message))
+
+/* max size of extra data in one MSG_ENUM_USERS/MSG_ENUM_GROUPS response,
+   larger response is possible only for one group with many members */
+#define MAX_CHUNK       32768
+
 /* -------------------------------------------------------------------------- */
 /* messages */
 #define MSG_INVALID                     0
@@ -64,7 +80,37 @@
 
 #define MSG_IDMAP_PRINC_TO_ID          12
 
-/* message structure */
+#define MSG_LOOKUP_BATCH               13       /* ID.UID is number of queries, extra data are SNFS4Message records */
+                                                /* supported are MSG_NAME_TO_ID, MSG_ID_TO_NAME, MSG_GROUP_TO_ID, MSG_ID_TO_GROUP */
+
+#define MSG_USER_TO_GROUPS             14       /* Name is user, response ID.GID is number of groups of the user, */
+                                                /* extra data are gid_t items */
+
+#define MSG_ENUM_USERS                 15       /* ID.UID is index (id without BaseID) from 1, index 1 starts new enumeration */
+#define MSG_ENUM_GROUPS                16       /* response ID.UID is the next index or 0 at the end, Extra.UID is number of items, */
+                                                /* extra data are SNFS4Message records, each group record is followed */
+                                                /* by its members (Len bytes) */
+
+#define MSG_IDMAP_PRINC_TO_GROUPS      17       /* response is the same as for MSG_IDMAP_PRINC_TO_ID, extra data are */
+                                                /* supplementary groups (gid_t items), the primary group is the first one */
+
+#define MSG_HELLO                      18       /* protocol v2 only, ID is the highest version supported by the client, */
+                                                /* response ID is the version used on the connection */
+
+#define MSG_IDMAP_UID_TO_NAME          19       /* ID.UID is any uid (local or metanfs4), response Name is the name */
+#define MSG_IDMAP_GID_TO_NAME          20       /* used on the wire, i.e. after the local domain mapping, */
+                                                /* the response without name - the id is unknown */
+
+#define MSG_IDMAP_NAME_TO_UID          21       /* the same as MSG_IDMAP_REG_NAME/MSG_IDMAP_REG_GROUP but local names */
+#define MSG_IDMAP_NAME_TO_GID          22       /* are resolved by the daemon, thus response ID is always the final id */
+
+#define MSG_ENUM_USERS_V2              23       /* the same as MSG_ENUM_USERS/MSG_ENUM_GROUPS but extra data are */
+#define MSG_ENUM_GROUPS_V2             24       /* SNFS4EnumRecord records followed by full names and members */
+
+#define MSG_LOOKUP_BATCH_V2            25       /* the same as MSG_LOOKUP_BATCH but extra data are SNFS4BatchRecord */
+                                                /* records followed by full names */
+
+/* message structure, Generation and Instance occupy former padding, thus the size is not changed */
 struct SNFS4Message {
     int     Type;
     union Primary {
@@ -75,13 +121,118 @@ struct SNFS4Message {
         uid_t   UID;
         gid_t   GID;
     } Extra;
-    size_t  Len;    /* extra message size */
+    unsigned int    Generation; /* response: generation of daemon data, it is changed by any change of data */
+    size_t  Len;    /* extra message size, extra data are sent as the next record */
     char    Name[MAX_NAME+1];
+    unsigned int    Instance;   /* response: daemon instance, generations are comparable only within one instance */
+};
+
+/* protocol v2 ----------------------------------------------------------------
+   Each request and response is one record composed from the header followed by
+   the name (including the terminating \0) and data. Records are sent by one
+   sendmsg() and the payload of the response is received directly into the buffer
+   of the caller. Records of protocol v1 are SNFS4Message structures (optionally
+   followed by one record with extra data), they are distinguished by the magic
+   number at the beginning of the header. Each connection starts with MSG_HELLO,
+   a daemon supporting only v1 closes the connection and the client then uses v1.
+   Extra data of MSG_LOOKUP_BATCH and v1 enumerations keep the v1 record layout,
+   MSG_LOOKUP_BATCH_V2 and MSG_ENUM_*_V2 records carry names of any length.
+
+   Protocol v3 adds tagged records (SNFS4TaggedHeader), the response carries
+   the tag of its request, thus a client can keep many requests in flight over
+   one connection. Tagged records can be sent only if v3 was negotiated, v2
+   records are still accepted on such connection. */
+
+#define PROTOCOL_MAGIC          0x3256464d      /* MFV2 */
+#define PROTOCOL_MAGIC_TAGGED   0x3356464d      /* MFV3 */
+#define PROTOCOL_VERSION        3
+#define MAX_NAME_V2             1024            /* max name length in protocol v2 */
+
+struct SNFS4Header {
+    uint32_t    Magic;
+    uint32_t    Type;
+    uint32_t    ID;
+    uint32_t    Extra;
+    uint32_t    Generation;     /* response: see SNFS4Message */
+    uint32_t    Instance;       /* response: see SNFS4Message */
+    uint32_t    NameLen;        /* name length including \0, 0 - no name */
+    uint32_t    DataLen;        /* data follow the name */
+    uint32_t    MaxLen;         /* request: max size of the response payload (name and data), */
+                                /* response: required size if the payload was not sent */
+    uint32_t    Status;         /* response: 0 or ERANGE if the payload is larger than MaxLen, */
+                                /* NameLen and DataLen are then sizes of the payload not sent */
+};
+
+struct SNFS4TaggedHeader {
+    struct SNFS4Header  Header;     /* Magic is PROTOCOL_MAGIC_TAGGED */
+    uint64_t            Tag;        /* request: any value chosen by the client, response: tag of the request */
+};
+
+/* record of MSG_ENUM_USERS_V2/MSG_ENUM_GROUPS_V2, it is followed by the name
+   (including the terminating \0) and by group members (\0 terminated names),
+   records are not aligned */
+struct SNFS4EnumRecord {
+    uint32_t    ID;
+    uint32_t    Extra;          /* primary group of the user or number of group members */
+    uint32_t    NameLen;        /* name length including \0 */
+    uint32_t    DataLen;        /* size of group members */
 };
 
+/* record of MSG_LOOKUP_BATCH_V2, it is followed by the name (including the terminating \0),
+   records are not aligned, the response has the same records, unresolved ones have
+   MSG_INVALID type and no name */
+struct SNFS4BatchRecord {
+    uint32_t    Type;           /* MSG_NAME_TO_ID, MSG_ID_TO_NAME, MSG_GROUP_TO_ID, or MSG_ID_TO_GROUP */
+    uint32_t    ID;
+    uint32_t    Extra;          /* response: primary group of the user */
+    uint32_t    NameLen;        /* name length including \0, 0 - no name */
+};
+
+/* optional in-process cache of responses, it is enabled by the environment variable
+   METANFS4_CACHE=size[:ttl], size is number of cached responses, ttl is in seconds,
+   cached responses are valid only for the last generation received from the daemon */
+#define CACHE_ENV           "METANFS4_CACHE"
+#define CACHE_DEFAULT_TTL   60
+#define CACHE_MAX_EXTRA     65536   /* larger extra data are not cached */
+
 /* common methods ----------------------------------------------------------- */
 
+/* connect to the daemon, it returns the socket or -1 on failure */
+int connect_socket(void);
+
+/* protocol handshake on the new socket, it returns the highest protocol version
+   supported by both sides, 1 if the daemon supports only v1 (the daemon then closes
+   the connection), and -1 on failure */
+int negotiate_version(int socket);
+
+/* send request and receive response over the connection of the calling thread,
+   extra data of the response (Len > 0) must be received by receive_extra_data()
+   otherwise they are discarded by the next exchange */
 int exchange_data(struct SNFS4Message* p_msg);
 
+/* send request together with extra data */
+int exchange_data_extra(struct SNFS4Message* p_msg,const void* p_extra,size_t len);
+
+/* receive extra data of the last response */
+int receive_extra_data(void* p_buffer,size_t len);
+
+/* the same as exchange_data() but the response can be served from the in-process cache,
+   the request is identified by Type, ID and Name, thus only idempotent requests can be cached */
+int exchange_data_cached(struct SNFS4Message* p_msg);
+
+/* protocol v2 exchange, Type, ID, Extra and DataLen of the request are taken from p_header,
+   the name (can be NULL) and data are sent with them, the response header is returned
+   in p_header and its payload is received into p_buffer - the name at the beginning
+   followed by data, it returns 0 on success, -ERANGE if the payload is larger than len
+   (p_header->MaxLen is the required size), and -1 on other failures,
+   the exchange is converted to protocol v1 if the daemon does not support v2 */
+int exchange_message(struct SNFS4Header* p_header,const char* p_name,const void* p_data,
+                     void* p_buffer,size_t len);
+
+/* the same as exchange_message() but the response can be served from the in-process cache,
+   requests with data are never cached */
+int exchange_message_cached(struct SNFS4Header* p_header,const char* p_name,
+                            void* p_buffer,size_t len);
+
 /* -------------------------------------------------------------------------- */
 #endif
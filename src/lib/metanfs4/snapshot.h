@@ -0,0 +1,150 @@
+#ifndef METANFS4_SNAPSHOT_H
+#define METANFS4_SNAPSHOT_H
+/*
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+// =============================================================================
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "common.h"
+
+/* -------------------------------------------------------------------------- */
+/*
+    The daemon publishes user and group tables into SNAPSHOTNAME. The file is
+    never modified, a new snapshot is written into a temporary file, renamed
+    over the old one and then its generation is stored into STATENAME, which
+    is shared memory mapped by clients. Clients thus detect a new snapshot by
+    reading the generation without any system call.
+
+    The state also contains the range of ids managed by the daemon, which is
+    updated whenever a new id is allocated, before the id is provided to any
+    client. Clients use it to reject foreign ids without contacting the daemon
+    even if the snapshot is disabled. Names used by the local domain mapping
+    are published as well, thus the nfsidmap plugin can map local names itself.
+    Finally, the generation of daemon data is published whenever data are
+    changed, thus responses cached by clients are invalidated immediately.
+    The snapshot records the generation it was built from, groups are read
+    from the snapshot only while no newer data are published.
+*/
+
+#define SNAPSHOTNAME        SERVERPATH "/metanfs4d.snapshot"
+#define STATENAME           SERVERPATH "/metanfs4d.state"
+
+#define SNAPSHOT_MAGIC      0x344e464d      /* MFN4 */
+#define STATE_MAX_DOMAIN    255
+#define SNAPSHOT_VERSION    2
+
+/* shared state */
+struct SNFS4State {
+    uint32_t    Magic;
+    uint32_t    Version;
+    uint64_t    Generation;         /* generation of published snapshot, 0 - no snapshot */
+    uint64_t    Counter;            /* last used generation, generations are never reused */
+    uint32_t    Flags;              /* STATE_RANGE - the following items are valid */
+    uint32_t    BaseID;             /* ids of the daemon are in (BaseID, BaseID + TopUserID/TopGroupID] */
+    uint32_t    TopUserID;
+    uint32_t    TopGroupID;
+    uint32_t    NobodyID;
+    uint32_t    NoGroupID;
+    char        LocalDomain[STATE_MAX_DOMAIN+1];    /* STATE_NAMES - the following names are valid */
+    char        NoBody[MAX_NAME+1];                 /* local names of root in the local domain mapping */
+    char        NoGroup[MAX_NAME+1];
+    uint32_t    DataInstance;       /* STATE_DATA - instance and generation of daemon data */
+    uint32_t    DataGeneration;     /* (see SNFS4Message), the generation is updated before */
+                                    /* the change is reported to the client, which caused it */
+};
+
+/* the state of older daemons is shorter, missing items are read as zero
+   because the state is smaller than one page */
+#define STATE_RANGE         0x1
+#define STATE_NAMES         0x2
+#define STATE_DATA          0x4
+
+/* snapshot header, all offsets are from the beginning of the snapshot */
+struct SNFS4SnapshotHeader {
+    uint32_t    Magic;
+    uint32_t    Version;
+    uint64_t    Generation;
+    uint64_t    Size;               /* size of the whole snapshot */
+    uint32_t    BaseID;
+    uint32_t    PrimaryGroupID;
+    uint32_t    NumOfUsers;         /* number of items in user table, index is id without BaseID */
+    uint32_t    NumOfGroups;        /* number of items in group table, index is id without BaseID */
+    uint32_t    UserHashSize;       /* number of slots in user hash table, power of two */
+    uint32_t    GroupHashSize;      /* number of slots in group hash table, power of two */
+    uint64_t    UserTable;          /* uint32_t name offsets, 0 - no user */
+    uint64_t    GroupTable;         /* struct SNFS4SnapshotGroup items */
+    uint64_t    UserHash;           /* uint32_t ids, 0 - empty slot, linear probing */
+    uint64_t    GroupHash;          /* uint32_t ids, 0 - empty slot, linear probing */
+    uint64_t    Strings;            /* \0 terminated strings */
+    uint64_t    StringsSize;
+    uint32_t    DataInstance;       /* version 2 - instance and generation of daemon data (see SNFS4State), */
+    uint32_t    DataGeneration;     /* the snapshot is built from data at least as new as them */
+};
+
+/* the header of version 1 ends at DataInstance */
+#define SNAPSHOT_HEADER_V1  offsetof(struct SNFS4SnapshotHeader,DataInstance)
+
+struct SNFS4SnapshotGroup {
+    uint32_t    Name;               /* name offset in strings, 0 - no group */
+    uint32_t    Members;            /* offset in strings, members are \0 terminated names */
+    uint32_t    NumOfMembers;
+    uint32_t    MembersLen;         /* the same layout as extra data of MSG_ID_TO_GROUP */
+};
+
+/* -------------------------------------------------------------------------- */
+
+/* map the shared state (implemented in common.c), it returns NULL if it is not available */
+const struct SNFS4State* map_state(void);
+
+/* checks of ids based on the shared state, they return 1 only if the id
+   certainly does not belong to the daemon, thus the daemon need not be asked */
+int is_foreign_uid(uid_t uid);
+int is_foreign_gid(gid_t gid);
+
+/* the current instance and generation of daemon data, it returns 0 if they are published */
+int get_data_generation(unsigned int* p_instance,unsigned int* p_generation);
+
+/* nobody and nogroup ids of the daemon, it returns 0 if they are known */
+int get_nobody_ids(uid_t* p_uid,gid_t* p_gid);
+
+/* the local domain mapping of a name without domain in the same way as
+   MSG_IDMAP_USER_TO_LOCAL_DOMAIN/MSG_IDMAP_GROUP_TO_LOCAL_DOMAIN, it returns 0,
+   -ERANGE if len is too small, or -1 if the names are not published */
+int map_to_local_domain(const char* name,int group,char* lname,size_t len);
+
+/* -------------------------------------------------------------------------- */
+
+/* FNV-1a hash of names */
+static inline uint32_t snapshot_hash(const char* p_name)
+{
+    uint32_t hash = 2166136261U;
+    while( *p_name != '\0' ){
+        hash ^= (unsigned char)(*p_name);
+        hash *= 16777619U;
+        p_name++;
+    }
+    return(hash);
+}
+
+/* -------------------------------------------------------------------------- */
+#endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -9,6 +10,7 @@
 #include <grp.h>
 #include <syslog.h>
 #include <common.h>
+#include <snapshot.h>
 #include <metanfs4_idmap.h>
 
 /* -----------------------------------------------------------------------------
@@ -45,30 +47,52 @@ struct trans_func *libnfsidmap_plugin_init()
 DLL_LOCAL
 int idmap_get_uid(char* name,uid_t* uid)
 {
-    struct SNFS4Message msg;
+    struct SNFS4Header  header;
+    char                lname[MAX_NAME_V2+1];
     struct passwd*      p_pwd;
+    uid_t               nobody;
 
-    memset(&msg,0,sizeof(msg));
+    /* names without domain are local, they are resolved in the same way
+       as by the daemon but without any request */
+    if( (strchr(name,'@') == NULL) && (get_nobody_ids(&nobody,NULL) == 0) ){
+        p_pwd = getpwnam(name);
+        (*uid) = (p_pwd != NULL) ? p_pwd->pw_uid : nobody;
+        return(0);
+    }
+
+    /* the daemon resolves also names of the local domain */
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_IDMAP_NAME_TO_UID;
 
-    msg.Type = MSG_IDMAP_REG_NAME;
-    strncpy(msg.Name,name,MAX_NAME);
+    if( exchange_message_cached(&header,name,lname,sizeof(lname)) != 0 ) return(-ENOENT);
+    if( header.Type == MSG_IDMAP_NAME_TO_UID ){
+        (*uid) = header.ID;
+        return(0);
+    }
 
-    if( exchange_data(&msg) != 0 ) return(-ENOENT);
+    /* older daemon */
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_IDMAP_REG_NAME;
 
-    if( msg.ID.UID > 0 ){
-        (*uid) = msg.ID.UID;
+    if( exchange_message_cached(&header,name,lname,sizeof(lname)) != 0 ) return(-ENOENT);
+    if( header.Type != MSG_IDMAP_REG_NAME ) return(-ENOENT);
+
+    if( header.ID > 0 ){
+        (*uid) = header.ID;
         return(0);
     }
 
     /* ask for local uid */
-    p_pwd = getpwnam(msg.Name);  /* data.Name contains local name */
-    if( p_pwd != NULL ){
-        (*uid) = p_pwd->pw_uid;
-        return(0);
+    if( header.NameLen > 0 ){
+        p_pwd = getpwnam(lname);  /* the response contains local name */
+        if( p_pwd != NULL ){
+            (*uid) = p_pwd->pw_uid;
+            return(0);
+        }
     }
 
     /* return nobody - already received in datagram */
-    (*uid) = msg.Extra.UID;
+    (*uid) = header.Extra;
     return(0);
 }
 /* -------------------------------------------------------------------------- */
@@ -76,29 +100,51 @@ int idmap_get_uid(char* name,uid_t* uid)
 DLL_LOCAL
 int idmap_get_gid(char *name, uid_t *gid)
 {
-    struct SNFS4Message msg;
+    struct SNFS4Header  header;
+    char                lname[MAX_NAME_V2+1];
     struct group*       p_grp;
+    gid_t               nogroup;
+
+    /* names without domain are local, see idmap_get_uid() */
+    if( (strchr(name,'@') == NULL) && (get_nobody_ids(NULL,&nogroup) == 0) ){
+        p_grp = getgrnam(name);
+        (*gid) = (p_grp != NULL) ? p_grp->gr_gid : nogroup;
+        return(0);
+    }
+
+    /* the daemon resolves also names of the local domain */
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_IDMAP_NAME_TO_GID;
+
+    if( exchange_message_cached(&header,name,lname,sizeof(lname)) != 0 ) return(-ENOENT);
+    if( header.Type == MSG_IDMAP_NAME_TO_GID ){
+        (*gid) = header.ID;
+        return(0);
+    }
 
-    memset(&msg,0,sizeof(msg));
-    msg.Type = MSG_IDMAP_REG_GROUP;
-    strncpy(msg.Name,name,MAX_NAME);
+    /* older daemon */
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_IDMAP_REG_GROUP;
 
-    if( exchange_data(&msg) != 0 ) return(-ENOENT);
+    if( exchange_message_cached(&header,name,lname,sizeof(lname)) != 0 ) return(-ENOENT);
+    if( header.Type != MSG_IDMAP_REG_GROUP ) return(-ENOENT);
 
-    if( msg.ID.GID > 0 ){
-        (*gid) = msg.ID.GID;
+    if( header.ID > 0 ){
+        (*gid) = header.ID;
         return(0);
     }
 
     /* ask for local gid */
-    p_grp = getgrnam(msg.Name);   /* data.Name contains local name */
-    if( p_grp != NULL ){
-        (*gid) = p_grp->gr_gid;
-        return(0);
+    if( header.NameLen > 0 ){
+        p_grp = getgrnam(lname);   /* the response contains local name */
+        if( p_grp != NULL ){
+            (*gid) = p_grp->gr_gid;
+            return(0);
+        }
     }
 
     /* return nogroup - already received in datagram */
-    (*gid) = msg.Extra.GID;
+    (*gid) = header.Extra;
     return(0);
 }
 
@@ -107,7 +153,24 @@ int idmap_get_gid(char *name, uid_t *gid)
 DLL_LOCAL
 int uid_to_name(uid_t uid, char *domain, char *name, size_t len)
 {
-    struct passwd *p_pwd = getpwuid(uid);
+    struct SNFS4Header  header;
+    struct passwd*      p_pwd;
+    int                 ret;
+
+    /* the daemon maps the id directly to the name on the wire */
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_IDMAP_UID_TO_NAME;
+    header.ID = uid;
+
+    ret = exchange_message_cached(&header,NULL,name,len);
+    if( ret == -ERANGE ) return(-ERANGE);
+    if( (ret == 0) && (header.Type == MSG_IDMAP_UID_TO_NAME) ){
+        /* the daemon resolves also local ids */
+        return( header.NameLen > 0 ? 0 : -ENOENT );
+    }
+
+    /* older daemon */
+    p_pwd = getpwuid(uid);
     if( p_pwd == NULL ) return(-ENOENT);
 
     return( idmap_user_to_local_domain(p_pwd->pw_name,name,len) );
@@ -118,8 +181,25 @@ int uid_to_name(uid_t uid, char *domain, char *name, size_t len)
 DLL_LOCAL
 int gid_to_name(gid_t gid, char *domain, char *name, size_t len)
 {
-    struct group *p_grp = getgrgid(gid);
-    if( p_grp == NULL )return(-ENOENT);
+    struct SNFS4Header  header;
+    struct group*       p_grp;
+    int                 ret;
+
+    /* the daemon maps the id directly to the name on the wire */
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_IDMAP_GID_TO_NAME;
+    header.ID = gid;
+
+    ret = exchange_message_cached(&header,NULL,name,len);
+    if( ret == -ERANGE ) return(-ERANGE);
+    if( (ret == 0) && (header.Type == MSG_IDMAP_GID_TO_NAME) ){
+        /* the daemon resolves also local ids */
+        return( header.NameLen > 0 ? 0 : -ENOENT );
+    }
+
+    /* older daemon */
+    p_grp = getgrgid(gid);
+    if( p_grp == NULL ) return(-ENOENT);
 
     return( idmap_group_to_local_domain(p_grp->gr_name,name,len) );
 }
@@ -130,20 +210,21 @@ DLL_LOCAL
 int princ_to_ids(char *secname, char *princ, uid_t *uid, gid_t *gid,
                 extra_mapping_params **ex)
 {
-    struct SNFS4Message msg;
+    struct SNFS4Header  header;
+    char                lname[MAX_NAME_V2+1];
 
     /* check allowed security contexts */
     if (strcmp(secname, "spkm3") == 0) return(-ENOENT);
     if (strcmp(secname, "krb5") != 0) return(-EINVAL);
 
-    memset(&msg,0,sizeof(msg));
-    msg.Type = MSG_IDMAP_PRINC_TO_ID;
-    strncpy(msg.Name,princ,MAX_NAME);
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_IDMAP_PRINC_TO_ID;
 
-    if( exchange_data(&msg) != 0 ) return(-ENOENT);
+    if( exchange_message_cached(&header,princ,lname,sizeof(lname)) != 0 ) return(-ENOENT);
+    if( header.Type != MSG_IDMAP_PRINC_TO_ID ) return(-ENOENT);
 
-    (*uid) = msg.ID.UID;
-    (*gid) = msg.Extra.GID;
+    (*uid) = header.ID;
+    (*gid) = header.Extra;
     return(0);
 }
 
@@ -153,19 +234,72 @@ DLL_LOCAL
 int gss_princ_to_grouplist(char *secname, char *princ, gid_t *groups,
                            int *ngroups, extra_mapping_params **ex)
 {
-    struct SNFS4Message msg;
+    struct SNFS4Header  header;
+    char                lname[MAX_NAME_V2+1];
+    char*               p_buffer;
+    size_t              len;
+    size_t              max;
+    size_t              count;
+    int                 ret;
 
     /* check allowed security contexts */
     if (strcmp(secname, "krb5") != 0) return(-EINVAL);
 
-    memset(&msg,0,sizeof(msg));
-    msg.Type = MSG_IDMAP_PRINC_TO_ID;
-    strncpy(msg.Name,princ,MAX_NAME);
+    max = (*ngroups > 0) ? (*ngroups) : 0;
 
-    if( exchange_data(&msg) != 0 ) return(-ENOENT);
+    /* the response is the local name followed by groups */
+    len = MAX_NAME_V2 + 1 + max*sizeof(gid_t);
+    p_buffer = (char*)malloc(len);
+    if( p_buffer == NULL ) return(-ENOMEM);
 
-    if (getgrouplist(msg.Name, msg.Extra.GID, groups, ngroups) < 0) return(-ERANGE);
+    /* the daemon provides complete list of groups (local groups and groups from the group file) */
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_IDMAP_PRINC_TO_GROUPS;
+
+    ret = exchange_message_cached(&header,princ,p_buffer,len);
+    if( (ret == -ERANGE) && (header.DataLen > max*sizeof(gid_t)) ){
+        /* more groups than requested, the not sent response provides their number */
+        free(p_buffer);
+        if( header.DataLen % sizeof(gid_t) != 0 ) return(-ENOENT);
+        *ngroups = header.DataLen / sizeof(gid_t);
+        return(-ERANGE);
+    }
+    if( (ret == -ERANGE) && (header.MaxLen > len) ){
+        /* longer name or the daemon does not provide sizes, get the response of the required size */
+        len = header.MaxLen;
+        free(p_buffer);
+        p_buffer = (char*)malloc(len);
+        if( p_buffer == NULL ) return(-ENOMEM);
+        memset(&header,0,sizeof(header));
+        header.Type = MSG_IDMAP_PRINC_TO_GROUPS;
+        ret = exchange_message_cached(&header,princ,p_buffer,len);
+    }
+    if( (ret == 0) && (header.Type != MSG_IDMAP_PRINC_TO_GROUPS) ){
+        /* older daemon, groups of the local account are provided by nsswitch */
+        free(p_buffer);
+        memset(&header,0,sizeof(header));
+        header.Type = MSG_IDMAP_PRINC_TO_ID;
+        if( exchange_message_cached(&header,princ,lname,sizeof(lname)) != 0 ) return(-ENOENT);
+        if( (header.Type != MSG_IDMAP_PRINC_TO_ID) || (header.NameLen == 0) ) return(-ENOENT);
+        if( getgrouplist(lname,header.Extra,groups,ngroups) < 0 ) return(-ERANGE);
+        return(0);
+    }
+    if( (ret != 0) || (header.DataLen % sizeof(gid_t) != 0) ){
+        free(p_buffer);
+        return(-ENOENT);
+    }
 
+    count = header.DataLen / sizeof(gid_t);
+    if( count > max ){
+        /* required size */
+        free(p_buffer);
+        *ngroups = count;
+        return(-ERANGE);
+    }
+    if( count > 0 ) memcpy(groups,p_buffer + header.NameLen,header.DataLen);
+    *ngroups = count;
+
+    free(p_buffer);
     return(0);
 }
 
@@ -174,17 +308,27 @@ int gss_princ_to_grouplist(char *secname, char *princ, gid_t *groups,
 DLL_LOCAL
 int idmap_user_to_local_domain(const char* name, char* lname, int len)
 {
-    struct SNFS4Message data;
+    struct SNFS4Header  header;
+    int                 ret;
+
+    /* names with domain are not changed by the daemon */
+    if( strchr(name,'@') != NULL ){
+        if( strlen(name) + 1 > len ) return(-ERANGE);
+        strcpy(lname,name);
+        return(0);
+    }
 
-    memset(&data,0,sizeof(data));
-    data.Type = MSG_IDMAP_USER_TO_LOCAL_DOMAIN;
-    strncpy(data.Name,name,MAX_NAME);
+    /* the mapping of local names is published by the daemon */
+    ret = map_to_local_domain(name,0,lname,len);
+    if( ret != -1 ) return(ret);
 
-    if( exchange_data(&data) != 0 ) return(-ENOENT);
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_IDMAP_USER_TO_LOCAL_DOMAIN;
 
-    data.Name[MAX_NAME] = '\0';
-    if( strlen(data.Name) + 1 > len ) return(-ERANGE);
-    strcpy(lname,data.Name);
+    /* the name is received directly into lname */
+    ret = exchange_message_cached(&header,name,lname,len);
+    if( ret == -ERANGE ) return(-ERANGE);
+    if( (ret != 0) || (header.Type != MSG_IDMAP_USER_TO_LOCAL_DOMAIN) || (header.NameLen == 0) ) return(-ENOENT);
 
     return(0);
 }
@@ -194,17 +338,27 @@ int idmap_user_to_local_domain(const char* name, char* lname, int len)
 DLL_LOCAL
 int idmap_group_to_local_domain(const char* name, char* lname, int len)
 {
-    struct SNFS4Message data;
+    struct SNFS4Header  header;
+    int                 ret;
+
+    /* names with domain are not changed by the daemon */
+    if( strchr(name,'@') != NULL ){
+        if( strlen(name) + 1 > len ) return(-ERANGE);
+        strcpy(lname,name);
+        return(0);
+    }
 
-    memset(&data,0,sizeof(data));
-    data.Type = MSG_IDMAP_GROUP_TO_LOCAL_DOMAIN;
-    strncpy(data.Name,name,MAX_NAME);
+    /* the mapping of local names is published by the daemon */
+    ret = map_to_local_domain(name,1,lname,len);
+    if( ret != -1 ) return(ret);
 
-    if( exchange_data(&data) != 0 ) return(-ENOENT);
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_IDMAP_GROUP_TO_LOCAL_DOMAIN;
 
-    data.Name[MAX_NAME] = '\0';
-    if( strlen(data.Name) + 1 > len ) return(-ERANGE);
-    strcpy(lname,data.Name);
+    /* the name is received directly into lname */
+    ret = exchange_message_cached(&header,name,lname,len);
+    if( ret == -ERANGE ) return(-ERANGE);
+    if( (ret != 0) || (header.Type != MSG_IDMAP_GROUP_TO_LOCAL_DOMAIN) || (header.NameLen == 0) ) return(-ENOENT);
 
     return(0);
 }
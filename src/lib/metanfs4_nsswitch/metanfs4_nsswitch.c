@@ -10,9 +10,8 @@
 #include <string.h>
 #include <pthread.h>
 #include <common.h>
-#include <sys/socket.h>
-#include <stddef.h>
 #include <metanfs4_nsswitch.h>
+#include <metanfs4_snapshot.h>
 
 /*
   Documentation:
@@ -27,10 +26,224 @@
     struct passwd *getpwent(void);
     void setpwent(void);
     void endpwent(void);
+
+    Each thread has its own enumeration cursor. The enumeration reads the
+    snapshot pinned by set*ent, or chunks of records from the daemon, which
+    keeps the data of the enumeration for the connection. Thus the whole
+    enumeration sees consistent data. Chunks have records with full names
+    (MSG_ENUM_USERS_V2/MSG_ENUM_GROUPS_V2), older daemons provide only
+    records with names truncated to MAX_NAME.
 */
 
-DLL_LOCAL int             _nss_metanfs4_udx   = 0;
-DLL_LOCAL int             _nss_metanfs4_gdx   = 0;
+struct SNFS4Enum {
+    int                     Started;
+    unsigned int            Index;      /* next index in the snapshot or of the next chunk, 0 - finished */
+    struct SNFS4Snapshot*   Snapshot;   /* pinned snapshot or NULL if the daemon is used */
+    char*                   Chunk;      /* records received from the daemon */
+    size_t                  ChunkSize;  /* allocated size */
+    size_t                  ChunkLen;
+    size_t                  ChunkPos;
+    size_t                  RecordLen;  /* size of the current record */
+    int                     Legacy;     /* records are SNFS4Message (older daemon) */
+};
+
+struct SNFS4EnumState {
+    struct SNFS4Enum    Users;
+    struct SNFS4Enum    Groups;
+};
+
+DLL_LOCAL pthread_key_t     _nss_metanfs4_enum_key;
+DLL_LOCAL pthread_once_t    _nss_metanfs4_enum_once = PTHREAD_ONCE_INIT;
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL void
+_end_enum(struct SNFS4Enum* p_enum)
+{
+    if( p_enum->Snapshot != NULL ) snapshot_release(p_enum->Snapshot);
+    if( p_enum->Chunk != NULL ) free(p_enum->Chunk);
+    memset(p_enum,0,sizeof(struct SNFS4Enum));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL void
+_start_enum(struct SNFS4Enum* p_enum, int groups)
+{
+    _end_enum(p_enum);
+    p_enum->Started = 1;
+    p_enum->Index = 1;
+    p_enum->Snapshot = snapshot_acquire();
+
+    /* groups of an older snapshot are enumerated by the daemon */
+    if( groups && (p_enum->Snapshot != NULL) && (snapshot_is_current(p_enum->Snapshot) == 0) ){
+        snapshot_release(p_enum->Snapshot);
+        p_enum->Snapshot = NULL;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL void
+_destroy_enum_state(void* p_data)
+{
+    struct SNFS4EnumState* p_state = (struct SNFS4EnumState*)p_data;
+    if( p_state == NULL ) return;
+    _end_enum(&p_state->Users);
+    _end_enum(&p_state->Groups);
+    free(p_state);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL void
+_init_enum_key(void)
+{
+    pthread_key_create(&_nss_metanfs4_enum_key,_destroy_enum_state);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL struct SNFS4EnumState*
+_get_enum_state(void)
+{
+    struct SNFS4EnumState* p_state;
+
+    pthread_once(&_nss_metanfs4_enum_once,_init_enum_key);
+
+    p_state = (struct SNFS4EnumState*)pthread_getspecific(_nss_metanfs4_enum_key);
+    if( p_state != NULL ) return(p_state);
+
+    p_state = (struct SNFS4EnumState*)calloc(1,sizeof(struct SNFS4EnumState));
+    if( p_state == NULL ) return(NULL);
+    if( pthread_setspecific(_nss_metanfs4_enum_key,p_state) != 0 ){
+        free(p_state);
+        return(NULL);
+    }
+    return(p_state);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* get the next chunk of records from the daemon */
+
+DLL_LOCAL int
+_receive_enum_chunk(struct SNFS4Enum* p_enum, int type)
+{
+    struct SNFS4Header  header;
+    struct SNFS4Message msg;
+    char*               p_chunk;
+    int                 ret;
+
+    /* large enough for usual chunks */
+    if( p_enum->Chunk == NULL ){
+        p_enum->Chunk = (char*)malloc(MAX_CHUNK);
+        if( p_enum->Chunk == NULL ) return(-1);
+        p_enum->ChunkSize = MAX_CHUNK;
+    }
+
+    if( p_enum->Legacy == 0 ){
+        do {
+            memset(&header,0,sizeof(header));
+            header.Type = (type == MSG_ENUM_USERS) ? MSG_ENUM_USERS_V2 : MSG_ENUM_GROUPS_V2;
+            header.ID = p_enum->Index;
+
+            ret = exchange_message(&header,NULL,NULL,p_enum->Chunk,p_enum->ChunkSize);
+            if( ret != -ERANGE ) break;
+
+            /* enlarge the chunk and repeat the request */
+            if( header.MaxLen <= p_enum->ChunkSize ) return(-1);
+            p_chunk = (char*)realloc(p_enum->Chunk,header.MaxLen);
+            if( p_chunk == NULL ) return(-1);
+            p_enum->Chunk = p_chunk;
+            p_enum->ChunkSize = header.MaxLen;
+        } while( 1 );
+        if( ret != 0 ) return(-1);
+
+        if( header.Type == (uint32_t)((type == MSG_ENUM_USERS) ? MSG_ENUM_USERS_V2 : MSG_ENUM_GROUPS_V2) ){
+            /* records follow the name, which is empty */
+            p_enum->Index = header.ID;
+            p_enum->ChunkLen = (size_t)header.NameLen + header.DataLen;
+            p_enum->ChunkPos = header.NameLen;
+            return(0);
+        }
+
+        /* the daemon does not support full records */
+        p_enum->Legacy = 1;
+    }
+
+    memset(&msg,0,sizeof(msg));
+    msg.Type = type;
+    msg.ID.UID = p_enum->Index;
+
+    if( exchange_data(&msg) != 0 ) return(-1);
+    if( msg.Type != type ) return(-1);
+
+    if( msg.Len > p_enum->ChunkSize ){
+        p_chunk = (char*)realloc(p_enum->Chunk,msg.Len);
+        if( p_chunk == NULL ) return(-1);
+        p_enum->Chunk = p_chunk;
+        p_enum->ChunkSize = msg.Len;
+    }
+    if( (msg.Len > 0) && (receive_extra_data(p_enum->Chunk,msg.Len) != 0) ) return(-1);
+
+    p_enum->Index = msg.ID.UID;
+    p_enum->ChunkLen = msg.Len;
+    p_enum->ChunkPos = 0;
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* get the next record from the daemon, ID, Extra, and Len (size of group members)
+   are provided in p_msg, the record is skipped by advancing ChunkPos by RecordLen */
+
+DLL_LOCAL int
+_next_enum_record(struct SNFS4Enum* p_enum, int type, struct SNFS4Message* p_msg,
+                  const char** p_name, const char** p_members)
+{
+    struct SNFS4EnumRecord  rec;
+    const char*             p_record;
+
+    while( p_enum->ChunkPos >= p_enum->ChunkLen ){
+        if( p_enum->Index == 0 ) return(-1);   /* no more data */
+        if( _receive_enum_chunk(p_enum,type) != 0 ) return(-1);
+    }
+
+    p_record = p_enum->Chunk + p_enum->ChunkPos;
+    *p_members = NULL;
+
+    if( p_enum->Legacy ){
+        if( p_enum->ChunkPos + sizeof(struct SNFS4Message) > p_enum->ChunkLen ) return(-1);
+        memcpy(p_msg,p_record,sizeof(struct SNFS4Message));
+        p_msg->Name[MAX_NAME] = '\0';
+        *p_name = p_msg->Name;
+
+        if( p_msg->Len > 0 ){
+            if( p_enum->ChunkPos + sizeof(struct SNFS4Message) + p_msg->Len > p_enum->ChunkLen ) return(-1);
+            *p_members = p_record + sizeof(struct SNFS4Message);
+        }
+        p_enum->RecordLen = sizeof(struct SNFS4Message) + p_msg->Len;
+        return(0);
+    }
+
+    if( p_enum->ChunkPos + sizeof(rec) > p_enum->ChunkLen ) return(-1);
+    memcpy(&rec,p_record,sizeof(rec));
+    if( (rec.NameLen == 0) ||
+        (p_enum->ChunkPos + sizeof(rec) + rec.NameLen + rec.DataLen > p_enum->ChunkLen) ) return(-1);
+    *p_name = p_record + sizeof(rec);
+    if( (*p_name)[rec.NameLen - 1] != '\0' ) return(-1);
+
+    memset(p_msg,0,sizeof(struct SNFS4Message));
+    p_msg->ID.UID = rec.ID;
+    p_msg->Extra.UID = rec.Extra;
+    p_msg->Len = rec.DataLen;
+    if( rec.DataLen > 0 ) *p_members = *p_name + rec.NameLen;
+
+    p_enum->RecordLen = sizeof(rec) + rec.NameLen + rec.DataLen;
+    return(0);
+}
 
 /* -------------------------------------------------------------------------- */
 
@@ -47,8 +260,8 @@ _setup_item(char **buffer, size_t *buflen,char** dest, const char* source, int *
         return(NSS_STATUS_TRYAGAIN);
     }
 
-    /* copy data and shift in the buffer */
-    strcpy(*buffer,source);
+    /* copy data and shift in the buffer, the source can be already in the buffer */
+    memmove(*buffer,source,len);
     (*dest) = (*buffer);
     (*buffer) += len;
     (*buflen) -= len;
@@ -61,7 +274,10 @@ _setup_item(char **buffer, size_t *buflen,char** dest, const char* source, int *
 DLL_EXPORT NSS_STATUS
 _nss_metanfs4_setpwent(void)
 {
-    _nss_metanfs4_udx = 1;
+    struct SNFS4EnumState* p_state = _get_enum_state();
+    if( p_state == NULL ) return(NSS_STATUS_UNAVAIL);
+
+    _start_enum(&p_state->Users,0);
     return(NSS_STATUS_SUCCESS);
 }
 
@@ -70,15 +286,38 @@ _nss_metanfs4_setpwent(void)
 DLL_EXPORT NSS_STATUS
 _nss_metanfs4_getpwent_r(struct passwd *result, char *buffer, size_t buflen, int *errnop)
 {     
-    NSS_STATUS          ret;
-    struct SNFS4Message msg;
+    NSS_STATUS              ret;
+    struct SNFS4Message     msg;
+    struct SNFS4EnumState*  p_state;
+    struct SNFS4Enum*       p_enum;
+    const char*             p_name;
+    const char*             p_members;
+    unsigned int            next;
 
-    memset(&msg,0,sizeof(msg));
-    msg.Type = MSG_ENUM_NAME;
-    msg.ID.UID = _nss_metanfs4_udx;
+    *errnop = ENOENT;
+
+    p_state = _get_enum_state();
+    if( p_state == NULL ) return(NSS_STATUS_UNAVAIL);
+    p_enum = &p_state->Users;
+
+    /* setpwent was called by another thread */
+    if( p_enum->Started == 0 ) _start_enum(p_enum,0);
+
+    if( p_enum->Snapshot != NULL ){
+        if( p_enum->Index == 0 ) return(NSS_STATUS_NOTFOUND);
+        next = snapshot_enum_user(p_enum->Snapshot,p_enum->Index,&msg,&p_name);
+        if( next == 0 ){
+            p_enum->Index = 0;
+            return(NSS_STATUS_NOTFOUND);
+        }
+        ret = _setup_passwd(p_name,msg.ID.UID,msg.Extra.GID,result,buffer,buflen,errnop);
+        if( ret == NSS_STATUS_SUCCESS ) p_enum->Index = next;
+        return(ret);
+    }
 
-    ret = _nss_metanfs4_getpasswd(&msg,result,buffer,buflen,errnop);
-    if( ret == NSS_STATUS_SUCCESS )  _nss_metanfs4_udx++;
+    if( _next_enum_record(p_enum,MSG_ENUM_USERS,&msg,&p_name,&p_members) != 0 ) return(NSS_STATUS_NOTFOUND);
+    ret = _setup_passwd(p_name,msg.ID.UID,msg.Extra.GID,result,buffer,buflen,errnop);
+    if( ret == NSS_STATUS_SUCCESS ) p_enum->ChunkPos += p_enum->RecordLen;
 
     return(ret);
 }
@@ -88,7 +327,8 @@ _nss_metanfs4_getpwent_r(struct passwd *result, char *buffer, size_t buflen, int
 DLL_EXPORT NSS_STATUS
 _nss_metanfs4_endpwent(void)
 {  
-    _nss_metanfs4_udx = 0;
+    struct SNFS4EnumState* p_state = _get_enum_state();
+    if( p_state != NULL ) _end_enum(&p_state->Users);
     return(NSS_STATUS_SUCCESS);
 }
 
@@ -97,7 +337,10 @@ _nss_metanfs4_endpwent(void)
 DLL_EXPORT NSS_STATUS
 _nss_metanfs4_setgrent(void)
 {  
-    _nss_metanfs4_gdx = 1;
+    struct SNFS4EnumState* p_state = _get_enum_state();
+    if( p_state == NULL ) return(NSS_STATUS_UNAVAIL);
+
+    _start_enum(&p_state->Groups,1);
     return(NSS_STATUS_SUCCESS);
 }
 
@@ -106,15 +349,38 @@ _nss_metanfs4_setgrent(void)
 DLL_EXPORT NSS_STATUS
 _nss_metanfs4_getgrent_r(struct group *result, char *buffer, size_t buflen, int *errnop)
 {
-    NSS_STATUS          ret;
-    struct SNFS4Message msg;
+    NSS_STATUS              ret;
+    struct SNFS4Message     msg;
+    struct SNFS4EnumState*  p_state;
+    struct SNFS4Enum*       p_enum;
+    const char*             p_name;
+    const char*             p_members;
+    unsigned int            next;
 
-    memset(&msg,0,sizeof(msg));
-    msg.Type = MSG_ENUM_GROUP;
-    msg.ID.GID = _nss_metanfs4_gdx;
+    *errnop = ENOENT;
+
+    p_state = _get_enum_state();
+    if( p_state == NULL ) return(NSS_STATUS_UNAVAIL);
+    p_enum = &p_state->Groups;
+
+    /* setgrent was called by another thread */
+    if( p_enum->Started == 0 ) _start_enum(p_enum,1);
+
+    if( p_enum->Snapshot != NULL ){
+        if( p_enum->Index == 0 ) return(NSS_STATUS_NOTFOUND);
+        next = snapshot_enum_group(p_enum->Snapshot,p_enum->Index,&msg,&p_name,&p_members);
+        if( next == 0 ){
+            p_enum->Index = 0;
+            return(NSS_STATUS_NOTFOUND);
+        }
+        ret = _setup_group(p_name,msg.ID.GID,msg.Extra.GID,p_members,msg.Len,result,buffer,buflen,errnop);
+        if( ret == NSS_STATUS_SUCCESS ) p_enum->Index = next;
+        return(ret);
+    }
 
-    ret = _nss_metanfs4_getgroup(&msg,result,buffer,buflen,errnop);
-    if( ret == NSS_STATUS_SUCCESS )  _nss_metanfs4_gdx++;
+    if( _next_enum_record(p_enum,MSG_ENUM_GROUPS,&msg,&p_name,&p_members) != 0 ) return(NSS_STATUS_NOTFOUND);
+    ret = _setup_group(p_name,msg.ID.GID,msg.Extra.GID,p_members,msg.Len,result,buffer,buflen,errnop);
+    if( ret == NSS_STATUS_SUCCESS ) p_enum->ChunkPos += p_enum->RecordLen;
 
     return(ret);
 }
@@ -124,7 +390,8 @@ _nss_metanfs4_getgrent_r(struct group *result, char *buffer, size_t buflen, int
 DLL_EXPORT NSS_STATUS
 _nss_metanfs4_endgrent(void)
 {   
-    _nss_metanfs4_gdx = 0;
+    struct SNFS4EnumState* p_state = _get_enum_state();
+    if( p_state != NULL ) _end_enum(&p_state->Groups);
     return(NSS_STATUS_SUCCESS);
 }
 
@@ -134,7 +401,12 @@ DLL_EXPORT NSS_STATUS
 _nss_metanfs4_getpwnam_r(const char *name, struct passwd *result,
                      char *buffer, size_t buflen, int *errnop)
 {
-    struct SNFS4Message msg;
+    struct SNFS4Message                 msg;
+    struct SNFS4Header                  header;
+    struct SNFS4Snapshot*               p_snap;
+    const char*                         p_name;
+    NSS_STATUS                          ret = NSS_STATUS_NOTFOUND;
+    int                                 sret;
 
     *errnop = ENOENT;
 
@@ -145,11 +417,19 @@ _nss_metanfs4_getpwnam_r(const char *name, struct passwd *result,
         return(NSS_STATUS_NOTFOUND);
     }
 
-    memset(&msg,0,sizeof(msg));
-    msg.Type = MSG_NAME_TO_ID;
-    strncpy(msg.Name,name,MAX_NAME);
+    /* try the snapshot first */
+    p_snap = snapshot_acquire();
+    if( p_snap != NULL ){
+        sret = snapshot_user_by_name(p_snap,name,&msg,&p_name);
+        if( sret == SNAPSHOT_FOUND ) ret = _setup_passwd(p_name,msg.ID.UID,msg.Extra.GID,result,buffer,buflen,errnop);
+        snapshot_release(p_snap);
+        if( sret == SNAPSHOT_FOUND ) return(ret);
+    }
+
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_NAME_TO_ID;
 
-    return(_nss_metanfs4_getpasswd(&msg,result,buffer,buflen,errnop));
+    return(_nss_metanfs4_getpasswd(&header,name,result,buffer,buflen,errnop));
 }
 
 /* -------------------------------------------------------------------------- */
@@ -158,15 +438,33 @@ DLL_EXPORT NSS_STATUS
 _nss_metanfs4_getpwuid_r(uid_t uid, struct passwd *result, char *buffer,
                      size_t buflen, int *errnop)
 {  
-    struct SNFS4Message msg;
+    struct SNFS4Message                 msg;
+    struct SNFS4Header                  header;
+    struct SNFS4Snapshot*               p_snap;
+    const char*                         p_name;
+    NSS_STATUS                          ret = NSS_STATUS_NOTFOUND;
+    int                                 sret;
 
     *errnop = ENOENT;
 
-    memset(&msg,0,sizeof(msg));
-    msg.Type = MSG_ID_TO_NAME;
-    msg.ID.UID = uid;
+    /* ids out of the range of the daemon, e.g. orphan local ids, are rejected
+       without any request */
+    if( is_foreign_uid(uid) ) return(NSS_STATUS_NOTFOUND);
+
+    /* try the snapshot first */
+    p_snap = snapshot_acquire();
+    if( p_snap != NULL ){
+        sret = snapshot_user_by_id(p_snap,uid,&msg,&p_name);
+        if( sret == SNAPSHOT_FOUND ) ret = _setup_passwd(p_name,msg.ID.UID,msg.Extra.GID,result,buffer,buflen,errnop);
+        snapshot_release(p_snap);
+        if( sret != SNAPSHOT_UNAVAIL ) return(ret);
+    }
+
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_ID_TO_NAME;
+    header.ID = uid;
 
-    return(_nss_metanfs4_getpasswd(&msg,result,buffer,buflen,errnop));
+    return(_nss_metanfs4_getpasswd(&header,NULL,result,buffer,buflen,errnop));
 }
 
 /* -------------------------------------------------------------------------- */
@@ -174,7 +472,13 @@ _nss_metanfs4_getpwuid_r(uid_t uid, struct passwd *result, char *buffer,
 DLL_EXPORT NSS_STATUS
 _nss_metanfs4_getgrnam_r(const char *name, struct group *result, char *buffer, size_t buflen, int *errnop)
 {
-    struct SNFS4Message msg;
+    struct SNFS4Message                 msg;
+    struct SNFS4Header                  header;
+    struct SNFS4Snapshot*               p_snap;
+    const char*                         p_name;
+    const char*                         p_members;
+    NSS_STATUS                          ret = NSS_STATUS_NOTFOUND;
+    int                                 sret;
 
     *errnop = ENOENT;
 
@@ -185,11 +489,19 @@ _nss_metanfs4_getgrnam_r(const char *name, struct group *result, char *buffer, s
         return(NSS_STATUS_NOTFOUND);
     }
 
-    memset(&msg,0,sizeof(msg));
-    msg.Type = MSG_GROUP_TO_ID;
-    strncpy(msg.Name,name,MAX_NAME);
+    /* try the snapshot first */
+    p_snap = snapshot_acquire();
+    if( p_snap != NULL ){
+        sret = snapshot_group_by_name(p_snap,name,&msg,&p_name,&p_members);
+        if( sret == SNAPSHOT_FOUND ) ret = _setup_group(p_name,msg.ID.GID,msg.Extra.GID,p_members,msg.Len,result,buffer,buflen,errnop);
+        snapshot_release(p_snap);
+        if( sret == SNAPSHOT_FOUND ) return(ret);
+    }
+
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_GROUP_TO_ID;
 
-    return(_nss_metanfs4_getgroup(&msg,result,buffer,buflen,errnop));
+    return(_nss_metanfs4_getgroup(&header,name,result,buffer,buflen,errnop));
 }
 
 /* -------------------------------------------------------------------------- */
@@ -197,35 +509,162 @@ _nss_metanfs4_getgrnam_r(const char *name, struct group *result, char *buffer, s
 DLL_EXPORT NSS_STATUS
 _nss_metanfs4_getgrgid_r(gid_t gid, struct group *result, char *buffer, size_t buflen, int *errnop)
 {
-    struct SNFS4Message msg;
+    struct SNFS4Message                 msg;
+    struct SNFS4Header                  header;
+    struct SNFS4Snapshot*               p_snap;
+    const char*                         p_name;
+    const char*                         p_members;
+    NSS_STATUS                          ret = NSS_STATUS_NOTFOUND;
+    int                                 sret;
 
-    memset(&msg,0,sizeof(msg));
-    msg.Type = MSG_ID_TO_GROUP;
-    msg.ID.GID = gid;
+    *errnop = ENOENT;
+
+    /* ids out of the range of the daemon, e.g. orphan local ids, are rejected
+       without any request */
+    if( is_foreign_gid(gid) ) return(NSS_STATUS_NOTFOUND);
+
+    /* try the snapshot first */
+    p_snap = snapshot_acquire();
+    if( p_snap != NULL ){
+        sret = snapshot_group_by_id(p_snap,gid,&msg,&p_name,&p_members);
+        if( sret == SNAPSHOT_FOUND ) ret = _setup_group(p_name,msg.ID.GID,msg.Extra.GID,p_members,msg.Len,result,buffer,buflen,errnop);
+        snapshot_release(p_snap);
+        if( sret != SNAPSHOT_UNAVAIL ) return(ret);
+    }
+
+    memset(&header,0,sizeof(header));
+    header.Type = MSG_ID_TO_GROUP;
+    header.ID = gid;
+
+    return(_nss_metanfs4_getgroup(&header,NULL,result,buffer,buflen,errnop));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT NSS_STATUS
+_nss_metanfs4_initgroups_dyn(const char *user, gid_t group, long int *start,
+                     long int *size, gid_t **groupsp, long int limit, int *errnop)
+{
+    struct SNFS4Header  header;
+    char*               p_buffer;
+    char*               p_newbuffer;
+    size_t              buflen;
+    const char*         p_gids;
+    gid_t               gid;
+    gid_t*              p_newgroups;
+    long int            newsize;
+    size_t              numofgids;
+    size_t              i;
+    int                 ret;
+
+    *errnop = ENOENT;
+
+    if( user == NULL ) return(NSS_STATUS_NOTFOUND);
+
+    buflen = MAX_BUFFER;
+    p_buffer = (char*)malloc(buflen);
+    if( p_buffer == NULL ){
+        *errnop = ENOMEM;
+        return(NSS_STATUS_TRYAGAIN);
+    }
+
+    do {
+        memset(&header,0,sizeof(header));
+        header.Type = MSG_USER_TO_GROUPS;
+        ret = exchange_message_cached(&header,user,p_buffer,buflen);
+        if( (ret != -ERANGE) || (header.MaxLen <= buflen) ) break;
+
+        /* the user is in many groups */
+        buflen = header.MaxLen;
+        p_newbuffer = (char*)realloc(p_buffer,buflen);
+        if( p_newbuffer == NULL ){
+            free(p_buffer);
+            *errnop = ENOMEM;
+            return(NSS_STATUS_TRYAGAIN);
+        }
+        p_buffer = p_newbuffer;
+    } while( 1 );
+
+    numofgids = header.ID;
+    if( (ret != 0) || (header.Type != MSG_USER_TO_GROUPS) ||
+        (numofgids == 0) || (header.DataLen != numofgids*sizeof(gid_t)) ){
+        free(p_buffer);
+        return(NSS_STATUS_NOTFOUND);
+    }
+
+    /* gids follow the name, thus they are not aligned */
+    p_gids = p_buffer + header.NameLen;
+
+    for(i=0; i < numofgids; i++){
+        memcpy(&gid,p_gids + i*sizeof(gid_t),sizeof(gid_t));
+
+        /* the primary group is already in the list */
+        if( gid == group ) continue;
+
+        /* enlarge the list if necessary */
+        if( *start == *size ){
+            if( (limit > 0) && (*size >= limit) ) break;
+            newsize = 2 * (*size);
+            if( newsize < 1 ) newsize = 1;
+            if( (limit > 0) && (newsize > limit) ) newsize = limit;
+            p_newgroups = (gid_t*)realloc(*groupsp,newsize*sizeof(gid_t));
+            if( p_newgroups == NULL ){
+                free(p_buffer);
+                *errnop = ENOMEM;
+                return(NSS_STATUS_TRYAGAIN);
+            }
+            *groupsp = p_newgroups;
+            *size = newsize;
+        }
+
+        (*groupsp)[(*start)++] = gid;
+    }
+
+    free(p_buffer);
 
-    return(_nss_metanfs4_getgroup(&msg,result,buffer,buflen,errnop));
+    *errnop = 0;
+    return(NSS_STATUS_SUCCESS);
 }
 
 /* -------------------------------------------------------------------------- */
 
 DLL_LOCAL  NSS_STATUS
-_nss_metanfs4_getpasswd(struct SNFS4Message* p_msg, struct passwd *result, char *buffer,
+_nss_metanfs4_getpasswd(struct SNFS4Header* p_header, const char* name, struct passwd *result, char *buffer,
                      size_t buflen, int *errnop)
 {
-    NSS_STATUS  ret;
+    uint32_t    type = p_header->Type;
+    int         ret;
 
     *errnop = ENOENT;
 
-    if( exchange_data(p_msg) != 0 ) return(NSS_STATUS_NOTFOUND);
-    if( p_msg->ID.UID == 0 ) return(NSS_STATUS_NOTFOUND);
+    /* the response is received directly into the buffer of the caller */
+    ret = exchange_message_cached(p_header,name,buffer,buflen);
+    if( ret == -ERANGE ){
+        *errnop = ERANGE;
+        return(NSS_STATUS_TRYAGAIN);
+    }
+    if( ret != 0 ) return(NSS_STATUS_NOTFOUND);
+    if( (p_header->Type != type) || (p_header->ID == 0) || (p_header->NameLen == 0) ) return(NSS_STATUS_NOTFOUND);
+
+    /* the name is at the beginning of the buffer */
+    return(_setup_passwd(buffer,p_header->ID,p_header->Extra,result,buffer,buflen,errnop));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL  NSS_STATUS
+_setup_passwd(const char* name, uid_t uid, gid_t gid, struct passwd *result, char *buffer,
+                     size_t buflen, int *errnop)
+{
+    NSS_STATUS  ret;
 
     /* fill the structure */
-    ret = _setup_item(&buffer,&buflen,&(result->pw_name),p_msg->Name,errnop);
+    ret = _setup_item(&buffer,&buflen,&(result->pw_name),name,errnop);
     if( ret != NSS_STATUS_SUCCESS ) return(ret);
     ret = _setup_item(&buffer,&buflen,&(result->pw_passwd),"x",errnop);
     if( ret != NSS_STATUS_SUCCESS ) return(ret);
-    result->pw_uid = p_msg->ID.UID;
-    result->pw_gid = p_msg->Extra.GID;
+    result->pw_uid = uid;
+    result->pw_gid = gid;
     ret = _setup_item(&buffer,&buflen,&(result->pw_gecos),result->pw_name,errnop);
     if( ret != NSS_STATUS_SUCCESS ) return(ret);
     ret = _setup_item(&buffer,&buflen,&(result->pw_dir),"/dev/null",errnop);
@@ -240,95 +679,62 @@ _nss_metanfs4_getpasswd(struct SNFS4Message* p_msg, struct passwd *result, char
 /* -------------------------------------------------------------------------- */
 
 DLL_LOCAL NSS_STATUS
-_nss_metanfs4_getgroup(struct SNFS4Message* p_msg, struct group *result, char *buffer, size_t buflen, int *errnop)
+_nss_metanfs4_getgroup(struct SNFS4Header* p_header, const char* name, struct group *result, char *buffer,
+                       size_t buflen, int *errnop)
 {
-    NSS_STATUS          ret;
-    struct sockaddr_un  address;
-    socklen_t           addrlen;
-    size_t              numofmems;
-    size_t              memlen;
-    size_t              len;
-    char*               p_member;
-    int                 type,i;
-    int                 clisckt;
+    uint32_t    type = p_header->Type;
+    int         ret;
 
     *errnop = ENOENT;
-    if( p_msg == NULL ) return(NSS_STATUS_NOTFOUND);
-
-    clisckt = socket(AF_UNIX,SOCK_SEQPACKET,0);
-    if( clisckt == -1 ) return(NSS_STATUS_NOTFOUND);
-
-    memset(&address, 0, sizeof(struct sockaddr_un));
 
-    address.sun_family = AF_UNIX;
-    strncpy(address.sun_path,SERVERNAME,UNIX_PATH_MAX);
-
-    addrlen = offsetof(struct sockaddr_un, sun_path) + strlen(address.sun_path) + 1;
-
-    if( connect(clisckt,(struct sockaddr *) &address, addrlen) == -1 ){
-        close(clisckt);
-        return(NSS_STATUS_NOTFOUND);
+    /* the response is received directly into the buffer of the caller */
+    ret = exchange_message_cached(p_header,name,buffer,buflen);
+    if( ret == -ERANGE ){
+        *errnop = ERANGE;
+        return(NSS_STATUS_TRYAGAIN);
     }
+    if( ret != 0 ) return(NSS_STATUS_NOTFOUND);
+    if( (p_header->Type != type) || (p_header->ID == 0) || (p_header->NameLen == 0) ) return(NSS_STATUS_NOTFOUND);
 
-    type = p_msg->Type;
-
-    if( write(clisckt,p_msg,sizeof(struct SNFS4Message)) != sizeof(struct SNFS4Message) ){
-        close(clisckt);
-        return(NSS_STATUS_NOTFOUND);
-    }
+    /* the name is at the beginning of the buffer followed by members */
+    return(_setup_group(buffer,p_header->ID,p_header->Extra,buffer + p_header->NameLen,p_header->DataLen,
+                        result,buffer,buflen,errnop));
+}
 
-    memset(p_msg,0,sizeof(struct SNFS4Message));
+/* -------------------------------------------------------------------------- */
 
-    if( read(clisckt,p_msg,sizeof(struct SNFS4Message)) != sizeof(struct SNFS4Message) ){
-        close(clisckt);
-        return(NSS_STATUS_NOTFOUND);
-    }
+DLL_LOCAL NSS_STATUS
+_setup_group(const char* name, gid_t gid, size_t numofmems, const char* p_members, size_t memlen,
+             struct group *result, char *buffer, size_t buflen, int *errnop)
+{
+    NSS_STATUS          ret;
+    size_t              len;
+    char*               p_member;
+    int                 i;
 
-    /* ensure \0 termination of the string */
-    p_msg->Name[MAX_NAME] = '\0';
+    /* fill the structure, members are placed before gr_passwd as they can be already in the buffer */
+    ret = _setup_item(&buffer,&buflen,&(result->gr_name),name,errnop);
+    if( ret != NSS_STATUS_SUCCESS ) return(ret);
+    result->gr_gid = gid;
 
-    if( p_msg->Type != type){
-        close(clisckt);
-        return(NSS_STATUS_NOTFOUND);
+    /* zero terminated names */
+    if( memlen > buflen ) {
+        *errnop = ERANGE;
+        return(NSS_STATUS_TRYAGAIN);
     }
+    if( memlen > 0 ) memmove(buffer,p_members,memlen);
 
-    if( p_msg->ID.GID == 0 ){
-        close(clisckt);
-        return(NSS_STATUS_NOTFOUND);
-    }
+    p_member = buffer;
+    buffer += memlen;
+    buflen -= memlen;
 
-    /* fill the structure */
-    ret = _setup_item(&buffer,&buflen,&(result->gr_name),p_msg->Name,errnop);
-    if( ret != NSS_STATUS_SUCCESS ){
-        close(clisckt);
-        return(ret);
-    }
     ret = _setup_item(&buffer,&buflen,&(result->gr_passwd),"x",errnop);
-    if( ret != NSS_STATUS_SUCCESS ){
-        close(clisckt);
-        return(ret);
-    }
-    result->gr_gid = p_msg->ID.GID;
-
-    /* read members */
-    memlen = p_msg->Len; /* zero terminated names */
-    numofmems = p_msg->Extra.GID; /* number of mebers */
-
-    p_member = buffer;
+    if( ret != NSS_STATUS_SUCCESS ) return(ret);
 
-    if( memlen + sizeof(char*)*(numofmems+1) > buflen ) {
+    if( sizeof(char*)*(numofmems+1) > buflen ) {
         *errnop = ERANGE;
-        close(clisckt);
         return(NSS_STATUS_TRYAGAIN);
     }
-    if( read(clisckt,buffer,memlen) != memlen ){
-        close(clisckt);
-        return(NSS_STATUS_NOTFOUND);
-    }
-    close(clisckt);
-
-    buffer += memlen;
-    buflen -= memlen;
 
     result->gr_mem = (char**)buffer;
 
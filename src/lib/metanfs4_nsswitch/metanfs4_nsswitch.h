@@ -49,10 +49,27 @@ NSS_STATUS
 _nss_metanfs4_getgrgid_r(gid_t gid, struct group *result, char *buffer, size_t buflen, int *errnop);
 
 /* ------------ */
+
+NSS_STATUS
+_nss_metanfs4_initgroups_dyn(const char *user, gid_t group, long int *start,
+                     long int *size, gid_t **groupsp, long int limit, int *errnop);
+
+/* ------------ */
+
+/* the response is received directly into the buffer of the caller */
 NSS_STATUS
-_nss_metanfs4_getpasswd(struct SNFS4Message* p_msg, struct passwd *result, char *buffer,
+_nss_metanfs4_getpasswd(struct SNFS4Header* p_header, const char* name, struct passwd *result, char *buffer,
                      size_t buflen, int *errnop);
 NSS_STATUS
-_nss_metanfs4_getgroup(struct SNFS4Message* p_msg, struct group *result, char *buffer, size_t buflen, int *errnop);
+_nss_metanfs4_getgroup(struct SNFS4Header* p_header, const char* name, struct group *result, char *buffer,
+                       size_t buflen, int *errnop);
+
+/* fill the result, name and members can be already in the buffer */
+NSS_STATUS
+_setup_passwd(const char* name, uid_t uid, gid_t gid, struct passwd *result, char *buffer,
+              size_t buflen, int *errnop);
+NSS_STATUS
+_setup_group(const char* name, gid_t gid, size_t numofmems, const char* p_members, size_t memlen,
+             struct group *result, char *buffer, size_t buflen, int *errnop);
 
 #endif
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <pthread.h>
+#include <common.h>
+#include <metanfs4_snapshot.h>
+
+/* -------------------------------------------------------------------------- */
+/*
+    The snapshot is replaced only when the generation in the shared state
+    changes. The current snapshot holds one reference, other references
+    are held by lookups and enumerations in progress.
+*/
+
+DLL_LOCAL pthread_mutex_t           _metanfs4_snap_lock     = PTHREAD_MUTEX_INITIALIZER;
+DLL_LOCAL struct SNFS4Snapshot*     _metanfs4_snap          = NULL;
+DLL_LOCAL uint64_t                  _metanfs4_snap_tried    = 0;
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int snapshot_validate(const char* p_data, size_t size)
+{
+    const struct SNFS4SnapshotHeader* p_snap = (const struct SNFS4SnapshotHeader*)p_data;
+
+    /* snapshots of older daemons do not record the data generation */
+    if( size < SNAPSHOT_HEADER_V1 ) return(-1);
+    if( p_snap->Magic != SNAPSHOT_MAGIC ) return(-1);
+    if( (p_snap->Version != 1) && (p_snap->Version != SNAPSHOT_VERSION) ) return(-1);
+    if( (p_snap->Version == SNAPSHOT_VERSION) && (size < sizeof(struct SNFS4SnapshotHeader)) ) return(-1);
+    if( p_snap->Size != size ) return(-1);
+
+    /* tables must be within the snapshot */
+    if( p_snap->UserTable + (uint64_t)p_snap->NumOfUsers*sizeof(uint32_t) > size ) return(-1);
+    if( p_snap->GroupTable + (uint64_t)p_snap->NumOfGroups*sizeof(struct SNFS4SnapshotGroup) > size ) return(-1);
+    if( p_snap->UserHash + (uint64_t)p_snap->UserHashSize*sizeof(uint32_t) > size ) return(-1);
+    if( p_snap->GroupHash + (uint64_t)p_snap->GroupHashSize*sizeof(uint32_t) > size ) return(-1);
+    if( p_snap->Strings + p_snap->StringsSize > size ) return(-1);
+    if( (p_snap->UserHashSize & (p_snap->UserHashSize - 1)) != 0 ) return(-1);
+    if( (p_snap->GroupHashSize & (p_snap->GroupHashSize - 1)) != 0 ) return(-1);
+
+    /* strings must be terminated */
+    if( p_snap->StringsSize == 0 ) return(-1);
+    if( p_data[p_snap->Strings + p_snap->StringsSize - 1] != '\0' ) return(-1);
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* _metanfs4_snap_lock must be locked */
+
+DLL_LOCAL
+void snapshot_unref(struct SNFS4Snapshot* p_snap)
+{
+    p_snap->RefCount--;
+    if( p_snap->RefCount > 0 ) return;
+
+    munmap((void*)p_snap->Header,p_snap->Size);
+    free(p_snap);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* _metanfs4_snap_lock must be locked */
+
+DLL_LOCAL
+void snapshot_remap(uint64_t gen)
+{
+    struct SNFS4Snapshot*   p_snap;
+    struct stat             my_stat;
+    void*                   p_data;
+    int                     fd;
+
+    /* it failed for this generation */
+    if( _metanfs4_snap_tried == gen ) return;
+    _metanfs4_snap_tried = gen;
+
+    /* drop the old snapshot, it stays mapped until it is released by all users */
+    if( _metanfs4_snap != NULL ){
+        snapshot_unref(_metanfs4_snap);
+        _metanfs4_snap = NULL;
+    }
+
+    fd = open(SNAPSHOTNAME,O_RDONLY | O_CLOEXEC);
+    if( fd < 0 ) return;
+
+    if( (fstat(fd,&my_stat) != 0) || (my_stat.st_size <= 0) ){
+        close(fd);
+        return;
+    }
+    p_data = mmap(NULL,my_stat.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if( p_data == MAP_FAILED ) return;
+
+    if( snapshot_validate((const char*)p_data,my_stat.st_size) != 0 ){
+        munmap(p_data,my_stat.st_size);
+        return;
+    }
+
+    p_snap = (struct SNFS4Snapshot*)malloc(sizeof(struct SNFS4Snapshot));
+    if( p_snap == NULL ){
+        munmap(p_data,my_stat.st_size);
+        return;
+    }
+    p_snap->Header = (const struct SNFS4SnapshotHeader*)p_data;
+    p_snap->Size = my_stat.st_size;
+    p_snap->RefCount = 1;  /* reference of the current snapshot */
+    _metanfs4_snap = p_snap;
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+struct SNFS4Snapshot* snapshot_acquire(void)
+{
+    const struct SNFS4State*    p_state;
+    struct SNFS4Snapshot*       p_snap;
+    uint64_t                    gen;
+
+    p_state = map_state();
+    if( p_state == NULL ) return(NULL);
+    if( p_state->Magic != SNAPSHOT_MAGIC ) return(NULL);
+
+    gen = __atomic_load_n(&p_state->Generation,__ATOMIC_ACQUIRE);
+    if( gen == 0 ) return(NULL);    /* the daemon does not publish snapshot */
+
+    pthread_mutex_lock(&_metanfs4_snap_lock);
+
+    /* newer snapshot was published */
+    if( (_metanfs4_snap == NULL) || (_metanfs4_snap->Header->Generation < gen) ){
+        snapshot_remap(gen);
+    }
+
+    p_snap = _metanfs4_snap;
+    if( p_snap != NULL ) p_snap->RefCount++;
+
+    pthread_mutex_unlock(&_metanfs4_snap_lock);
+
+    return(p_snap);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+void snapshot_release(struct SNFS4Snapshot* p_snap)
+{
+    if( p_snap == NULL ) return;
+
+    pthread_mutex_lock(&_metanfs4_snap_lock);
+    snapshot_unref(p_snap);
+    pthread_mutex_unlock(&_metanfs4_snap_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int snapshot_is_current(const struct SNFS4Snapshot* p_snapshot)
+{
+    const struct SNFS4SnapshotHeader*   p_snap = p_snapshot->Header;
+    unsigned int                        instance;
+    unsigned int                        generation;
+
+    /* older daemons, which do not publish the generation, are not checked */
+    if( p_snap->Version < 2 ) return(1);
+    if( get_data_generation(&instance,&generation) != 0 ) return(1);
+
+    return( (p_snap->DataInstance == instance) && (p_snap->DataGeneration == generation) );
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+const char* snapshot_string(const struct SNFS4SnapshotHeader* p_snap, uint32_t offset)
+{
+    if( (offset == 0) || (offset >= p_snap->StringsSize) ) return(NULL);
+    return((const char*)p_snap + p_snap->Strings + offset);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+const char* snapshot_user_name(const struct SNFS4SnapshotHeader* p_snap, uint32_t id)
+{
+    const uint32_t* p_users;
+
+    if( id >= p_snap->NumOfUsers ) return(NULL);
+    p_users = (const uint32_t*)((const char*)p_snap + p_snap->UserTable);
+    return(snapshot_string(p_snap,p_users[id]));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+const struct SNFS4SnapshotGroup* snapshot_group(const struct SNFS4SnapshotHeader* p_snap, uint32_t id)
+{
+    const struct SNFS4SnapshotGroup* p_groups;
+
+    if( id >= p_snap->NumOfGroups ) return(NULL);
+    p_groups = (const struct SNFS4SnapshotGroup*)((const char*)p_snap + p_snap->GroupTable);
+    if( p_groups[id].Name == 0 ) return(NULL);
+    return(&p_groups[id]);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int snapshot_user_by_id(const struct SNFS4Snapshot* p_snapshot, uid_t uid, struct SNFS4Message* p_msg,
+                        const char** p_fullname)
+{
+    const struct SNFS4SnapshotHeader*   p_snap = p_snapshot->Header;
+    const char*                         p_name;
+
+    /* ids are never reused, thus ids within the table are authoritative */
+    if( uid <= p_snap->BaseID ) return(SNAPSHOT_NOTFOUND);
+    if( uid - p_snap->BaseID >= p_snap->NumOfUsers ) return(SNAPSHOT_UNAVAIL);
+
+    p_name = snapshot_user_name(p_snap,uid - p_snap->BaseID);
+    if( p_name == NULL ) return(SNAPSHOT_NOTFOUND);
+
+    memset(p_msg,0,sizeof(struct SNFS4Message));
+    p_msg->Type = MSG_ID_TO_NAME;
+    p_msg->ID.UID = uid;
+    p_msg->Extra.GID = p_snap->PrimaryGroupID;
+    strncpy(p_msg->Name,p_name,MAX_NAME);
+    *p_fullname = p_name;
+
+    return(SNAPSHOT_FOUND);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int snapshot_user_by_name(const struct SNFS4Snapshot* p_snapshot, const char* name, struct SNFS4Message* p_msg,
+                          const char** p_fullname)
+{
+    const struct SNFS4SnapshotHeader*   p_snap = p_snapshot->Header;
+    const uint32_t*                     p_hash;
+    const char*                         p_name;
+    uint32_t                            slot;
+    uint32_t                            mask;
+
+    if( p_snap->UserHashSize == 0 ) return(SNAPSHOT_UNAVAIL);
+
+    p_hash = (const uint32_t*)((const char*)p_snap + p_snap->UserHash);
+    mask = p_snap->UserHashSize - 1;
+    slot = snapshot_hash(name) & mask;
+
+    while( p_hash[slot] != 0 ){
+        p_name = snapshot_user_name(p_snap,p_hash[slot]);
+        if( (p_name != NULL) && (strcmp(p_name,name) == 0) ){
+            memset(p_msg,0,sizeof(struct SNFS4Message));
+            p_msg->Type = MSG_NAME_TO_ID;
+            p_msg->ID.UID = p_hash[slot] + p_snap->BaseID;
+            p_msg->Extra.GID = p_snap->PrimaryGroupID;
+            strncpy(p_msg->Name,p_name,MAX_NAME);
+            *p_fullname = p_name;
+            return(SNAPSHOT_FOUND);
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    /* the name can be registered after the snapshot was published */
+    return(SNAPSHOT_UNAVAIL);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int snapshot_setup_group(const struct SNFS4SnapshotHeader* p_snap, uint32_t id, int type,
+                         struct SNFS4Message* p_msg, const char** p_fullname, const char** p_members)
+{
+    const struct SNFS4SnapshotGroup*    p_grp;
+    const char*                         p_name;
+
+    p_grp = snapshot_group(p_snap,id);
+    if( p_grp == NULL ) return(SNAPSHOT_NOTFOUND);
+    p_name = snapshot_string(p_snap,p_grp->Name);
+    if( p_name == NULL ) return(SNAPSHOT_NOTFOUND);
+
+    memset(p_msg,0,sizeof(struct SNFS4Message));
+    p_msg->Type = type;
+    p_msg->ID.GID = id + p_snap->BaseID;
+    strncpy(p_msg->Name,p_name,MAX_NAME);
+    *p_fullname = p_name;
+
+    *p_members = NULL;
+    if( (p_grp->NumOfMembers > 0) && (p_grp->Members + (uint64_t)p_grp->MembersLen <= p_snap->StringsSize) ){
+        p_msg->Extra.GID = p_grp->NumOfMembers;
+        p_msg->Len = p_grp->MembersLen;
+        *p_members = (const char*)p_snap + p_snap->Strings + p_grp->Members;
+    }
+
+    return(SNAPSHOT_FOUND);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int snapshot_group_by_id(const struct SNFS4Snapshot* p_snapshot, gid_t gid, struct SNFS4Message* p_msg,
+                         const char** p_fullname, const char** p_members)
+{
+    const struct SNFS4SnapshotHeader* p_snap = p_snapshot->Header;
+
+    if( gid <= p_snap->BaseID ) return(SNAPSHOT_NOTFOUND);
+    if( gid - p_snap->BaseID >= p_snap->NumOfGroups ) return(SNAPSHOT_UNAVAIL);
+
+    /* members can be changed by a reload of the group file */
+    if( snapshot_is_current(p_snapshot) == 0 ) return(SNAPSHOT_UNAVAIL);
+
+    return(snapshot_setup_group(p_snap,gid - p_snap->BaseID,MSG_ID_TO_GROUP,p_msg,p_fullname,p_members));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int snapshot_group_by_name(const struct SNFS4Snapshot* p_snapshot, const char* name, struct SNFS4Message* p_msg,
+                           const char** p_fullname, const char** p_members)
+{
+    const struct SNFS4SnapshotHeader*   p_snap = p_snapshot->Header;
+    const uint32_t*                     p_hash;
+    const struct SNFS4SnapshotGroup*    p_grp;
+    const char*                         p_name;
+    uint32_t                            slot;
+    uint32_t                            mask;
+
+    if( p_snap->GroupHashSize == 0 ) return(SNAPSHOT_UNAVAIL);
+    if( snapshot_is_current(p_snapshot) == 0 ) return(SNAPSHOT_UNAVAIL);
+
+    p_hash = (const uint32_t*)((const char*)p_snap + p_snap->GroupHash);
+    mask = p_snap->GroupHashSize - 1;
+    slot = snapshot_hash(name) & mask;
+
+    while( p_hash[slot] != 0 ){
+        p_grp = snapshot_group(p_snap,p_hash[slot]);
+        if( p_grp != NULL ){
+            p_name = snapshot_string(p_snap,p_grp->Name);
+            if( (p_name != NULL) && (strcmp(p_name,name) == 0) ){
+                return(snapshot_setup_group(p_snap,p_hash[slot],MSG_GROUP_TO_ID,p_msg,p_fullname,p_members));
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    /* the name can be registered after the snapshot was published */
+    return(SNAPSHOT_UNAVAIL);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+unsigned int snapshot_enum_user(const struct SNFS4Snapshot* p_snapshot, unsigned int index, struct SNFS4Message* p_msg,
+                                const char** p_fullname)
+{
+    const struct SNFS4SnapshotHeader*   p_snap = p_snapshot->Header;
+    const char*                         p_name;
+
+    if( index < 1 ) index = 1;
+
+    while( index < p_snap->NumOfUsers ){
+        p_name = snapshot_user_name(p_snap,index);
+        if( p_name != NULL ){
+            memset(p_msg,0,sizeof(struct SNFS4Message));
+            p_msg->Type = MSG_ENUM_NAME;
+            p_msg->ID.UID = index + p_snap->BaseID;
+            p_msg->Extra.GID = p_snap->PrimaryGroupID;
+            strncpy(p_msg->Name,p_name,MAX_NAME);
+            *p_fullname = p_name;
+            return(index + 1);
+        }
+        index++;
+    }
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+unsigned int snapshot_enum_group(const struct SNFS4Snapshot* p_snapshot, unsigned int index, struct SNFS4Message* p_msg,
+                                 const char** p_fullname, const char** p_members)
+{
+    const struct SNFS4SnapshotHeader* p_snap = p_snapshot->Header;
+
+    if( index < 1 ) index = 1;
+
+    while( index < p_snap->NumOfGroups ){
+        if( snapshot_setup_group(p_snap,index,MSG_ENUM_GROUP,p_msg,p_fullname,p_members) == SNAPSHOT_FOUND ){
+            return(index + 1);
+        }
+        index++;
+    }
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,68 @@
+#ifndef METANFS4_NSSWITCH_SNAPSHOT_H
+#define METANFS4_NSSWITCH_SNAPSHOT_H
+
+#include <snapshot.h>
+
+/* read access to the snapshot published by the daemon */
+
+#define SNAPSHOT_FOUND      0
+#define SNAPSHOT_NOTFOUND   1       /* the record does not exist */
+#define SNAPSHOT_UNAVAIL    2       /* the record is not in the snapshot, ask the daemon */
+
+/* ------------ */
+
+/* mapped snapshot, it is unmapped when the last reference is released */
+struct SNFS4Snapshot {
+    const struct SNFS4SnapshotHeader*   Header;
+    size_t                              Size;
+    int                                 RefCount;
+};
+
+/* get the current snapshot, it returns NULL if it is not available
+   otherwise the snapshot must be released by snapshot_release(),
+   the snapshot can be kept as long as necessary (e.g. during enumeration) */
+struct SNFS4Snapshot*
+snapshot_acquire(void);
+
+void
+snapshot_release(struct SNFS4Snapshot* p_snap);
+
+/* it returns 1 if no newer data than the snapshot are published by the daemon,
+   users are never changed, thus only groups of older snapshots are not used */
+int
+snapshot_is_current(const struct SNFS4Snapshot* p_snap);
+
+/* ------------ */
+
+/* lookups fill p_msg in the same way as the daemon, the full name (p_msg->Name
+   can be truncated) is returned in p_fullname */
+int
+snapshot_user_by_id(const struct SNFS4Snapshot* p_snap, uid_t uid, struct SNFS4Message* p_msg,
+                    const char** p_fullname);
+
+int
+snapshot_user_by_name(const struct SNFS4Snapshot* p_snap, const char* name, struct SNFS4Message* p_msg,
+                      const char** p_fullname);
+
+/* the full name and members are returned in p_fullname and p_members,
+   they are valid until the snapshot is released */
+int
+snapshot_group_by_id(const struct SNFS4Snapshot* p_snap, gid_t gid, struct SNFS4Message* p_msg,
+                     const char** p_fullname, const char** p_members);
+
+int
+snapshot_group_by_name(const struct SNFS4Snapshot* p_snap, const char* name, struct SNFS4Message* p_msg,
+                       const char** p_fullname, const char** p_members);
+
+/* enumeration, index is id without BaseID, p_msg is filled by the first item
+   with id >= index, it returns the index following the item or 0 if there
+   is no such item */
+unsigned int
+snapshot_enum_user(const struct SNFS4Snapshot* p_snap, unsigned int index, struct SNFS4Message* p_msg,
+                   const char** p_fullname);
+
+unsigned int
+snapshot_enum_group(const struct SNFS4Snapshot* p_snap, unsigned int index, struct SNFS4Message* p_msg,
+                    const char** p_fullname, const char** p_members);
+
+#endif
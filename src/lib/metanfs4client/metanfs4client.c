@@ -0,0 +1,876 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <common.h>
+#include <snapshot.h>
+#include <metanfs4client.h>
+
+/* -------------------------------------------------------------------------- */
+/*
+    Requests are kept in three FIFO lists: submitted requests not sent yet,
+    requests in flight, and requests completed without any response. Requests
+    in flight are matched to responses by tags of the connection, which are
+    unique unlike tags of the caller. The daemon processes requests of one
+    connection concurrently and answers them as they are finished, thus the
+    matching request is not necessarily the first one. Daemons supporting
+    only protocol v2 do not return tags, they answer in order and the first
+    request in flight is then always the matching one.
+*/
+
+#define DEFAULT_IN_FLIGHT   256
+#define INITIAL_BUFFER      (sizeof(struct SNFS4TaggedHeader) + MAX_NAME_V2 + 1 + MAX_BUFFER)
+
+struct SNFS4Request {
+    uint64_t                Tag;            /* tag of the caller */
+    uint64_t                WireTag;        /* tag on the connection */
+    int                     Type;           /* METANFS4_* */
+    uint32_t                ID;
+    char*                   Name;           /* NULL - no name */
+    int                     Status;         /* requests completed without any response */
+    struct SNFS4Request*    Next;
+};
+
+struct SNFS4RequestList {
+    struct SNFS4Request*    First;
+    struct SNFS4Request*    Last;
+};
+
+struct SNFS4Client {
+    int                     Socket;         /* -1 - not connected */
+    int                     Version;        /* protocol version used on the connection */
+    size_t                  MaxInFlight;
+    size_t                  NumOfInFlight;
+    size_t                  NumOfPending;   /* submitted and not returned requests */
+    uint64_t                NextTag;
+    struct SNFS4RequestList Queued;
+    struct SNFS4RequestList InFlight;
+    struct SNFS4RequestList Done;
+    struct SNFS4Request*    Returned;       /* request of the last completion */
+    char*                   Buffer;         /* the last response */
+    size_t                  BufferSize;
+    char*                   BatchNames;     /* names of the last batch */
+    size_t                  BatchNamesSize;
+    int                     LegacyBatch;    /* the daemon supports only MSG_LOOKUP_BATCH */
+};
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+void append_request(struct SNFS4RequestList* p_list,struct SNFS4Request* p_req)
+{
+    p_req->Next = NULL;
+    if( p_list->Last != NULL ){
+        p_list->Last->Next = p_req;
+    } else {
+        p_list->First = p_req;
+    }
+    p_list->Last = p_req;
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+struct SNFS4Request* remove_request(struct SNFS4RequestList* p_list,int tagged,uint64_t tag)
+{
+    struct SNFS4Request*    p_prev = NULL;
+    struct SNFS4Request*    p_req = p_list->First;
+
+    /* the first request if tags are not used */
+    while( (p_req != NULL) && tagged && (p_req->WireTag != tag) ){
+        p_prev = p_req;
+        p_req = p_req->Next;
+    }
+    if( p_req == NULL ) return(NULL);
+
+    if( p_prev != NULL ){
+        p_prev->Next = p_req->Next;
+    } else {
+        p_list->First = p_req->Next;
+    }
+    if( p_list->Last == p_req ) p_list->Last = p_prev;
+    p_req->Next = NULL;
+
+    return(p_req);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+void free_requests(struct SNFS4Request* p_req)
+{
+    struct SNFS4Request* p_next;
+
+    while( p_req != NULL ){
+        p_next = p_req->Next;
+        free(p_req->Name);
+        free(p_req);
+        p_req = p_next;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* all requests of the list are completed with the status */
+
+DLL_LOCAL
+void fail_requests(struct SNFS4Client* p_client,struct SNFS4RequestList* p_list,int status)
+{
+    struct SNFS4Request* p_req;
+
+    while( (p_req = remove_request(p_list,0,0)) != NULL ){
+        p_req->Status = status;
+        append_request(&p_client->Done,p_req);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int get_message_type(int type)
+{
+    switch(type){
+        case METANFS4_GETPWUID:
+            return(MSG_ID_TO_NAME);
+        case METANFS4_GETPWNAM:
+            return(MSG_NAME_TO_ID);
+        case METANFS4_GETGRGID:
+            return(MSG_ID_TO_GROUP);
+        case METANFS4_GETGRNAM:
+            return(MSG_GROUP_TO_ID);
+    }
+    return(MSG_INVALID);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int connect_client(struct SNFS4Client* p_client)
+{
+    int socket_fd;
+    int version;
+
+    socket_fd = connect_socket();
+    if( socket_fd < 0 ) return(-1);
+
+    version = negotiate_version(socket_fd);
+    if( version < 2 ){
+        close(socket_fd);
+        errno = (version == 1) ? EPROTONOSUPPORT : ECONNRESET;
+        return(-1);
+    }
+
+    p_client->Socket = socket_fd;
+    p_client->Version = version;
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* the connection is closed, requests in flight are completed with EIO */
+
+DLL_LOCAL
+void fail_connection(struct SNFS4Client* p_client)
+{
+    if( p_client->Socket >= 0 ) close(p_client->Socket);
+    p_client->Socket = -1;
+    fail_requests(p_client,&p_client->InFlight,EIO);
+    p_client->NumOfInFlight = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* it returns 0, -EAGAIN if the socket is full, and -1 on failure */
+
+DLL_LOCAL
+int send_request(struct SNFS4Client* p_client,struct SNFS4Request* p_req)
+{
+    struct SNFS4TaggedHeader    tagged;
+    struct SNFS4Header*         p_header = &tagged.Header;
+    struct msghdr               msg;
+    struct iovec                iov[2];
+    ssize_t                     slen;
+
+    memset(&tagged,0,sizeof(tagged));
+    p_header->Magic = (p_client->Version >= 3) ? PROTOCOL_MAGIC_TAGGED : PROTOCOL_MAGIC;
+    p_header->Type = get_message_type(p_req->Type);
+    p_header->ID = p_req->ID;
+    p_header->NameLen = (p_req->Name != NULL) ? strlen(p_req->Name) + 1 : 0;
+    p_header->MaxLen = p_client->BufferSize - sizeof(struct SNFS4TaggedHeader);
+    tagged.Tag = p_req->WireTag;
+
+    iov[0].iov_base = &tagged;
+    iov[0].iov_len = (p_client->Version >= 3) ? sizeof(tagged) : sizeof(struct SNFS4Header);
+    iov[1].iov_base = p_req->Name;
+    iov[1].iov_len = p_header->NameLen;
+
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    slen = sendmsg(p_client->Socket,&msg,MSG_DONTWAIT | MSG_NOSIGNAL);
+    if( slen < 0 ){
+        if( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ) return(-EAGAIN);
+        return(-1);
+    }
+    if( (size_t)slen != iov[0].iov_len + iov[1].iov_len ) return(-1);
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* receive one response, it returns 1 - p_comp is filled, 0 - no response
+   is available, and -1 on failure of the connection */
+
+DLL_LOCAL
+int receive_response(struct SNFS4Client* p_client,struct SNFS4Completion* p_comp)
+{
+    struct SNFS4TaggedHeader    tagged;
+    struct SNFS4Header*         p_header = &tagged.Header;
+    struct SNFS4Request*        p_req;
+    ssize_t                     rlen;
+    size_t                      hlen;
+    size_t                      size;
+    char*                       p_buffer;
+    const char*                 p_payload;
+
+    while( (p_client->Socket >= 0) && (p_client->NumOfInFlight > 0) ){
+        rlen = recv(p_client->Socket,p_client->Buffer,p_client->BufferSize,MSG_DONTWAIT | MSG_TRUNC);
+        if( rlen < 0 ){
+            if( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ) return(0);
+            return(-1);
+        }
+        if( ((size_t)rlen < sizeof(struct SNFS4Header)) || ((size_t)rlen > p_client->BufferSize) ) return(-1);
+
+        memset(&tagged,0,sizeof(tagged));
+        memcpy(p_header,p_client->Buffer,sizeof(struct SNFS4Header));
+        hlen = sizeof(struct SNFS4Header);
+        if( p_header->Magic == PROTOCOL_MAGIC_TAGGED ){
+            hlen = sizeof(tagged);
+            if( (size_t)rlen < hlen ) return(-1);
+            memcpy(&tagged.Tag,p_client->Buffer + sizeof(struct SNFS4Header),sizeof(tagged.Tag));
+        } else if( p_header->Magic != PROTOCOL_MAGIC ){
+            return(-1);
+        }
+
+        p_req = remove_request(&p_client->InFlight,p_header->Magic == PROTOCOL_MAGIC_TAGGED,tagged.Tag);
+        if( p_req == NULL ) return(-1);
+        p_client->NumOfInFlight--;
+
+        if( p_header->Status == ERANGE ){
+            if( (size_t)rlen != hlen ){
+                append_request(&p_client->InFlight,p_req);
+                return(-1);
+            }
+            /* the response is larger than the buffer, the request is sent again,
+               the buffer can be already enlarged by previous response */
+            size = sizeof(struct SNFS4TaggedHeader) + p_header->MaxLen;
+            if( size > p_client->BufferSize ){
+                p_buffer = (char*)realloc(p_client->Buffer,size);
+                if( p_buffer == NULL ){
+                    p_req->Status = ENOMEM;
+                    append_request(&p_client->Done,p_req);
+                    continue;
+                }
+                p_client->Buffer = p_buffer;
+                p_client->BufferSize = size;
+            }
+            append_request(&p_client->Queued,p_req);
+            continue;
+        }
+
+        p_payload = p_client->Buffer + hlen;
+        if( ((size_t)rlen != hlen + p_header->NameLen + p_header->DataLen) ||
+            ((p_header->NameLen > 0) && (p_payload[p_header->NameLen-1] != '\0')) ){
+            /* it is failed together with other requests in flight */
+            append_request(&p_client->InFlight,p_req);
+            return(-1);
+        }
+
+        memset(p_comp,0,sizeof(struct SNFS4Completion));
+        p_comp->Tag = p_req->Tag;
+        p_comp->Type = p_req->Type;
+        p_client->Returned = p_req;
+
+        /* the response of other type means the account is not known */
+        if( ((int)p_header->Type != get_message_type(p_req->Type)) || (p_header->ID == 0) || (p_header->NameLen == 0) ){
+            p_comp->Status = ENOENT;
+            p_comp->ID = p_req->ID;
+            p_comp->Name = p_req->Name;
+            return(1);
+        }
+
+        p_comp->ID = p_header->ID;
+        p_comp->Name = p_payload;
+        if( (p_req->Type == METANFS4_GETGRGID) || (p_req->Type == METANFS4_GETGRNAM) ){
+            p_comp->GID = p_header->ID;
+            p_comp->NumOfMembers = p_header->Extra;
+            if( p_header->DataLen > 0 ) p_comp->Members = p_payload + p_header->NameLen;
+        } else {
+            p_comp->GID = p_header->Extra;
+        }
+        return(1);
+    }
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_LOCAL
+int submit_request(struct SNFS4Client* p_client,uint64_t tag,int type,uint32_t id,const char* name,int foreign)
+{
+    struct SNFS4Request* p_req;
+
+    if( (name != NULL) && (strlen(name) > MAX_NAME_V2) ) return(-EINVAL);
+
+    p_req = (struct SNFS4Request*)calloc(1,sizeof(struct SNFS4Request));
+    if( p_req == NULL ) return(-ENOMEM);
+
+    p_req->Tag = tag;
+    p_req->WireTag = p_client->NextTag++;
+    p_req->Type = type;
+    p_req->ID = id;
+    if( name != NULL ){
+        p_req->Name = strdup(name);
+        if( p_req->Name == NULL ){
+            free(p_req);
+            return(-ENOMEM);
+        }
+    }
+
+    /* ids out of the range of the daemon are completed immediately */
+    if( foreign ){
+        p_req->Status = ENOENT;
+        append_request(&p_client->Done,p_req);
+    } else {
+        append_request(&p_client->Queued,p_req);
+    }
+    p_client->NumOfPending++;
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* one batch round trip, the connection must not have requests in flight, the response
+   data are left in the buffer after the header, it returns 0 or -1 on failure of the connection */
+
+DLL_LOCAL
+int send_batch(struct SNFS4Client* p_client,struct SNFS4Header* p_header,const char* p_data)
+{
+    struct SNFS4Header  request = *p_header;
+    struct msghdr       msg;
+    struct iovec        iov[2];
+    ssize_t             len;
+    size_t              size;
+    char*               p_buffer;
+
+    do {
+        request.MaxLen = p_client->BufferSize - sizeof(struct SNFS4Header);
+
+        iov[0].iov_base = &request;
+        iov[0].iov_len = sizeof(request);
+        iov[1].iov_base = (void*)p_data;
+        iov[1].iov_len = request.DataLen;
+
+        memset(&msg,0,sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+
+        do {
+            len = sendmsg(p_client->Socket,&msg,MSG_NOSIGNAL);
+        } while( (len < 0) && (errno == EINTR) );
+        if( (len < 0) || ((size_t)len != sizeof(request) + request.DataLen) ) return(-1);
+
+        do {
+            len = recv(p_client->Socket,p_client->Buffer,p_client->BufferSize,MSG_TRUNC);
+        } while( (len < 0) && (errno == EINTR) );
+        if( ((size_t)len < sizeof(struct SNFS4Header)) || ((size_t)len > p_client->BufferSize) ) return(-1);
+
+        memcpy(p_header,p_client->Buffer,sizeof(struct SNFS4Header));
+        if( p_header->Magic != PROTOCOL_MAGIC ) return(-1);
+        if( p_header->Status != ERANGE ) break;
+
+        /* full names do not fit into the buffer, the batch is sent again */
+        if( (size_t)len != sizeof(struct SNFS4Header) ) return(-1);
+        size = sizeof(struct SNFS4TaggedHeader) + p_header->MaxLen;
+        if( size <= p_client->BufferSize ) return(-1);
+        p_buffer = (char*)realloc(p_client->Buffer,size);
+        if( p_buffer == NULL ) return(-1);
+        p_client->Buffer = p_buffer;
+        p_client->BufferSize = size;
+    } while( 1 );
+
+    if( ((size_t)len != sizeof(struct SNFS4Header) + p_header->NameLen + p_header->DataLen) || (p_header->NameLen != 0) ) return(-1);
+
+    return(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* the batch is sent again over a new connection if the daemon closed the idle one,
+   lookups can be repeated safely */
+
+DLL_LOCAL
+int exchange_batch(struct SNFS4Client* p_client,struct SNFS4Header* p_header,const char* p_data)
+{
+    struct SNFS4Header  request = *p_header;
+    int                 attempt;
+
+    for(attempt = 0; attempt < 2; attempt++){
+        if( (p_client->Socket < 0) && (connect_client(p_client) != 0) ) return(-1);
+        *p_header = request;
+        if( send_batch(p_client,p_header,p_data) == 0 ) return(0);
+        fail_connection(p_client);
+    }
+
+    return(-1);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* records of the next chunk are built from items starting at *p_next, up to MAX_BATCH
+   items and MAX_BATCH_DATA bytes, SNFS4Message records (legacy) cannot carry longer
+   names than MAX_NAME, such items are not sent, it returns the number of records */
+
+DLL_LOCAL
+size_t build_batch(struct SNFS4BatchItem* p_items,size_t count,size_t* p_next,int legacy,
+                   char* p_data,size_t* p_len,size_t* p_index)
+{
+    struct SNFS4BatchItem*  p_item;
+    struct SNFS4BatchRecord record;
+    struct SNFS4Message     message;
+    const char*             p_name;
+    size_t                  name_len;
+    size_t                  rec_len;
+    size_t                  chunk = 0;
+    size_t                  i;
+
+    *p_len = 0;
+    for(i = *p_next; (i < count) && (chunk < MAX_BATCH); i++){
+        p_item = &p_items[i];
+
+        /* ids out of the range of the daemon are not sent */
+        if( (p_item->Type == METANFS4_GETPWUID) && is_foreign_uid(p_item->ID) ) continue;
+        if( (p_item->Type == METANFS4_GETGRGID) && is_foreign_gid(p_item->ID) ) continue;
+
+        p_name = NULL;
+        name_len = 0;
+        if( (p_item->Type == METANFS4_GETPWNAM) || (p_item->Type == METANFS4_GETGRNAM) ){
+            p_name = p_item->Name;
+            name_len = strlen(p_name) + 1;
+        }
+
+        if( legacy ){
+            if( name_len > MAX_NAME + 1 ) continue;
+            rec_len = sizeof(message);
+        } else {
+            rec_len = sizeof(record) + name_len;
+        }
+        if( *p_len + rec_len > MAX_BATCH_DATA ) break;
+
+        if( legacy ){
+            memset(&message,0,sizeof(message));
+            message.Type = get_message_type(p_item->Type);
+            message.ID.UID = p_name != NULL ? 0 : p_item->ID;
+            if( p_name != NULL ) memcpy(message.Name,p_name,name_len);
+            memcpy(p_data + *p_len,&message,sizeof(message));
+        } else {
+            memset(&record,0,sizeof(record));
+            record.Type = get_message_type(p_item->Type);
+            record.ID = p_name != NULL ? 0 : p_item->ID;
+            record.NameLen = name_len;
+            memcpy(p_data + *p_len,&record,sizeof(record));
+            if( name_len > 0 ) memcpy(p_data + *p_len + sizeof(record),p_name,name_len);
+        }
+        *p_len += rec_len;
+        p_index[chunk++] = i;
+    }
+
+    *p_next = i;
+    return(chunk);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* the resolved item is updated, its name is stored at the offset of BatchNames,
+   it returns 0 or -1 if the name cannot be stored */
+
+DLL_LOCAL
+int set_batch_item(struct SNFS4Client* p_client,struct SNFS4BatchItem* p_item,size_t* p_offset,size_t* p_names_len,
+                   uint32_t type,uint32_t id,uint32_t extra,const char* p_name,size_t name_len)
+{
+    char*   p_buffer;
+    size_t  size;
+
+    /* unresolved items have MSG_INVALID type */
+    if( ((int)type != get_message_type(p_item->Type)) || (id == 0) || (name_len <= 1) ) return(0);
+
+    if( *p_names_len + name_len > p_client->BatchNamesSize ){
+        size = 2*p_client->BatchNamesSize;
+        if( size < *p_names_len + name_len ) size = *p_names_len + name_len;
+        p_buffer = (char*)realloc(p_client->BatchNames,size);
+        if( p_buffer == NULL ) return(-1);
+        p_client->BatchNames = p_buffer;
+        p_client->BatchNamesSize = size;
+    }
+
+    memcpy(p_client->BatchNames + *p_names_len,p_name,name_len - 1);
+    p_client->BatchNames[*p_names_len + name_len - 1] = '\0';
+    *p_offset = *p_names_len;
+    *p_names_len += name_len;
+
+    p_item->Status = 0;
+    p_item->ID = id;
+    if( (p_item->Type == METANFS4_GETGRGID) || (p_item->Type == METANFS4_GETGRNAM) ){
+        p_item->GID = id;
+    } else {
+        p_item->GID = extra;
+    }
+
+    return(0);
+}
+
+/* -----------------------------------------------------------------------------
+// #############################################################################
+// -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+struct SNFS4Client* metanfs4_client_open(size_t max_in_flight)
+{
+    struct SNFS4Client* p_client;
+    int                 error;
+
+    p_client = (struct SNFS4Client*)calloc(1,sizeof(struct SNFS4Client));
+    if( p_client == NULL ) return(NULL);
+
+    p_client->Socket = -1;
+    p_client->MaxInFlight = (max_in_flight > 0) ? max_in_flight : DEFAULT_IN_FLIGHT;
+    p_client->NextTag = 1;
+    p_client->BufferSize = INITIAL_BUFFER;
+    p_client->Buffer = (char*)malloc(p_client->BufferSize);
+
+    if( (p_client->Buffer == NULL) || (connect_client(p_client) != 0) ){
+        error = (p_client->Buffer == NULL) ? ENOMEM : errno;
+        free(p_client->Buffer);
+        free(p_client);
+        errno = error;
+        return(NULL);
+    }
+
+    return(p_client);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+void metanfs4_client_close(struct SNFS4Client* p_client)
+{
+    if( p_client == NULL ) return;
+
+    if( p_client->Socket >= 0 ) close(p_client->Socket);
+    free_requests(p_client->Queued.First);
+    free_requests(p_client->InFlight.First);
+    free_requests(p_client->Done.First);
+    free_requests(p_client->Returned);
+    free(p_client->Buffer);
+    free(p_client->BatchNames);
+    free(p_client);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+int metanfs4_client_fd(const struct SNFS4Client* p_client)
+{
+    return(p_client->Socket);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+short metanfs4_client_events(const struct SNFS4Client* p_client)
+{
+    short events = 0;
+
+    if( p_client->NumOfInFlight > 0 ) events |= POLLIN;
+
+    /* requests are not sent only if the socket is full */
+    if( (p_client->Queued.First != NULL) && (p_client->NumOfInFlight < p_client->MaxInFlight) ) events |= POLLOUT;
+
+    return(events);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+int metanfs4_client_getpwuid(struct SNFS4Client* p_client,uint64_t tag,uid_t uid)
+{
+    return(submit_request(p_client,tag,METANFS4_GETPWUID,uid,NULL,is_foreign_uid(uid)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+int metanfs4_client_getpwnam(struct SNFS4Client* p_client,uint64_t tag,const char* name)
+{
+    if( name == NULL ) return(-EINVAL);
+    return(submit_request(p_client,tag,METANFS4_GETPWNAM,0,name,0));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+int metanfs4_client_getgrgid(struct SNFS4Client* p_client,uint64_t tag,gid_t gid)
+{
+    return(submit_request(p_client,tag,METANFS4_GETGRGID,gid,NULL,is_foreign_gid(gid)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+int metanfs4_client_getgrnam(struct SNFS4Client* p_client,uint64_t tag,const char* name)
+{
+    if( name == NULL ) return(-EINVAL);
+    return(submit_request(p_client,tag,METANFS4_GETGRNAM,0,name,0));
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+int metanfs4_client_flush(struct SNFS4Client* p_client)
+{
+    struct SNFS4Request*    p_req;
+    int                     ret = 0;
+    int                     sret;
+    int                     reconnected = 0;
+
+    while( (p_client->Queued.First != NULL) && (p_client->NumOfInFlight < p_client->MaxInFlight) ){
+        if( p_client->Socket < 0 ){
+            /* the daemon was restarted or it closed the idle connection */
+            if( connect_client(p_client) != 0 ){
+                fail_requests(p_client,&p_client->Queued,EIO);
+                return(-EIO);
+            }
+        }
+
+        sret = send_request(p_client,p_client->Queued.First);
+        if( sret == -EAGAIN ) break;
+        if( (sret != 0) && (p_client->NumOfInFlight == 0) && (reconnected == 0) ){
+            /* the connection was closed while idle, the request is sent again */
+            fail_connection(p_client);
+            reconnected = 1;
+            continue;
+        }
+
+        p_req = remove_request(&p_client->Queued,0,0);
+        if( sret != 0 ){
+            /* the request is failed as well, thus the loop always ends */
+            fail_connection(p_client);
+            p_req->Status = EIO;
+            append_request(&p_client->Done,p_req);
+            ret = -EIO;
+            continue;
+        }
+
+        append_request(&p_client->InFlight,p_req);
+        p_client->NumOfInFlight++;
+    }
+
+    return(ret);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+int metanfs4_client_next(struct SNFS4Client* p_client,struct SNFS4Completion* p_comp)
+{
+    struct SNFS4Request*    p_req;
+    int                     ret;
+
+    /* data of the last completion are released */
+    free_requests(p_client->Returned);
+    p_client->Returned = NULL;
+
+    metanfs4_client_flush(p_client);
+
+    ret = 0;
+    if( p_client->Done.First == NULL ){
+        ret = receive_response(p_client,p_comp);
+        if( ret < 0 ){
+            /* queued requests are sent over a new connection immediately,
+               thus the caller has a descriptor to poll while they are pending */
+            fail_connection(p_client);
+            metanfs4_client_flush(p_client);
+        }
+    }
+
+    if( ret <= 0 ){
+        /* requests completed without response */
+        p_req = remove_request(&p_client->Done,0,0);
+        if( p_req == NULL ) return(0);
+
+        memset(p_comp,0,sizeof(struct SNFS4Completion));
+        p_comp->Tag = p_req->Tag;
+        p_comp->Type = p_req->Type;
+        p_comp->Status = p_req->Status;
+        p_comp->ID = p_req->ID;
+        p_comp->Name = p_req->Name;
+        p_client->Returned = p_req;
+    }
+
+    p_client->NumOfPending--;
+    return(1);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+int metanfs4_client_wait(struct SNFS4Client* p_client,int timeout)
+{
+    struct pollfd   pfd;
+    int             ret;
+
+    metanfs4_client_flush(p_client);
+    if( p_client->Done.First != NULL ) return(1);
+    if( (p_client->Socket < 0) || (p_client->NumOfInFlight == 0) ) return(0);
+
+    pfd.fd = p_client->Socket;
+    pfd.events = metanfs4_client_events(p_client);
+    pfd.revents = 0;
+
+    ret = poll(&pfd,1,timeout);
+    if( ret < 0 ) return( errno == EINTR ? 0 : -1 );
+
+    return( ret > 0 ? 1 : 0 );
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+size_t metanfs4_client_pending(const struct SNFS4Client* p_client)
+{
+    return(p_client->NumOfPending);
+}
+
+/* -------------------------------------------------------------------------- */
+
+DLL_EXPORT
+int metanfs4_client_lookup_batch(struct SNFS4Client* p_client,struct SNFS4BatchItem* p_items,size_t count)
+{
+    struct SNFS4Header      header;
+    struct SNFS4BatchRecord record;
+    struct SNFS4Message     message;
+    char                    data[MAX_BATCH_DATA];
+    size_t                  index[MAX_BATCH];
+    size_t*                 p_offsets;
+    struct SNFS4BatchItem*  p_item;
+    const char*             p_resp;
+    size_t                  resp_len;
+    size_t                  len;
+    size_t                  pos;
+    size_t                  next;
+    size_t                  first;
+    size_t                  chunk;
+    size_t                  i;
+    size_t                  names_len = 0;
+    int                     legacy;
+    int                     ret = 0;
+
+    if( (p_items == NULL) && (count > 0) ) return(-EINVAL);
+
+    /* responses of the batch cannot be mixed with responses of other requests */
+    if( (p_client->Queued.First != NULL) || (p_client->NumOfInFlight > 0) ) return(-EBUSY);
+
+    for(i=0; i < count; i++){
+        p_item = &p_items[i];
+        if( get_message_type(p_item->Type) == MSG_INVALID ) return(-EINVAL);
+        if( (p_item->Type == METANFS4_GETPWNAM) || (p_item->Type == METANFS4_GETGRNAM) ){
+            if( (p_item->Name == NULL) || (strlen(p_item->Name) > MAX_NAME_V2) ) return(-EINVAL);
+        }
+    }
+    for(i=0; i < count; i++){
+        p_items[i].Status = ENOENT;
+        p_items[i].GID = 0;
+    }
+
+    /* names are stored at offsets, BatchNames can be moved by realloc */
+    p_offsets = (size_t*)malloc((count > 0 ? count : 1)*sizeof(size_t));
+    if( p_offsets == NULL ) return(-ENOMEM);
+
+    next = 0;
+    while( (ret >= 0) && (next < count) ){
+        first = next;
+        legacy = p_client->LegacyBatch;
+        chunk = build_batch(p_items,count,&next,legacy,data,&len,index);
+        if( chunk == 0 ) continue;
+
+        memset(&header,0,sizeof(header));
+        header.Magic = PROTOCOL_MAGIC;
+        header.Type = legacy ? MSG_LOOKUP_BATCH : MSG_LOOKUP_BATCH_V2;
+        header.ID = chunk;
+        header.DataLen = len;
+        if( exchange_batch(p_client,&header,data) != 0 ){
+            ret = -EIO;
+            break;
+        }
+
+        if( (legacy == 0) && (header.Type == MSG_INVALID) && (header.DataLen == 0) ){
+            /* older daemon, the chunk is sent again with SNFS4Message records */
+            p_client->LegacyBatch = 1;
+            next = first;
+            continue;
+        }
+
+        p_resp = p_client->Buffer + sizeof(struct SNFS4Header);
+        resp_len = header.DataLen;
+        if( (header.Type != (legacy ? MSG_LOOKUP_BATCH : MSG_LOOKUP_BATCH_V2)) || (header.ID != chunk)
+            || (legacy && (resp_len != chunk*sizeof(message))) ){
+            ret = -EIO;
+            break;
+        }
+
+        pos = 0;
+        for(i=0; (ret >= 0) && (i < chunk); i++){
+            p_item = &p_items[index[i]];
+            if( legacy ){
+                memcpy(&message,p_resp + pos,sizeof(message));
+                pos += sizeof(message);
+                message.Name[MAX_NAME] = '\0';
+                if( set_batch_item(p_client,p_item,&p_offsets[index[i]],&names_len,message.Type,message.ID.UID,
+                                   message.Extra.UID,message.Name,strlen(message.Name) + 1) != 0 ) ret = -ENOMEM;
+            } else {
+                if( pos + sizeof(record) > resp_len ){
+                    ret = -EIO;
+                    break;
+                }
+                memcpy(&record,p_resp + pos,sizeof(record));
+                pos += sizeof(record);
+                if( (pos + record.NameLen > resp_len) || ((record.NameLen > 0) && (p_resp[pos + record.NameLen - 1] != '\0')) ){
+                    ret = -EIO;
+                    break;
+                }
+                if( set_batch_item(p_client,p_item,&p_offsets[index[i]],&names_len,record.Type,record.ID,
+                                   record.Extra,p_resp + pos,record.NameLen) != 0 ) ret = -ENOMEM;
+                pos += record.NameLen;
+            }
+            if( (ret >= 0) && (p_item->Status == 0) ) ret++;
+        }
+    }
+
+    /* names of found items */
+    for(i=0; i < count; i++){
+        if( p_items[i].Status == 0 ) p_items[i].Name = p_client->BatchNames + p_offsets[i];
+    }
+    free(p_offsets);
+
+    return(ret);
+}
+
+/* -------------------------------------------------------------------------- */
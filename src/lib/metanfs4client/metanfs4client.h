@@ -0,0 +1,133 @@
+#ifndef METANFS4_CLIENT_H
+#define METANFS4_CLIENT_H
+/*
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+// =============================================================================
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* -------------------------------------------------------------------------- */
+/*
+    Asynchronous client of the metanfs4d daemon. Lookups have the same meaning
+    as in the nsswitch module, i.e. only users and groups of the daemon are
+    resolved. Requests are tagged by the caller and many of them can be in
+    flight over one connection. Completions are delivered in any order, e.g.
+    ids, which certainly do not belong to the daemon, are completed without
+    contacting the daemon.
+
+    The client is not thread-safe, each thread should use its own client.
+    Typical loop:
+
+        submit requests ...
+        while( metanfs4_client_pending(p_client) > 0 ){
+            poll() on metanfs4_client_fd() for metanfs4_client_events()
+            while( metanfs4_client_next(p_client,&comp) > 0 ) use comp
+        }
+*/
+
+struct SNFS4Client;
+
+/* request types */
+#define METANFS4_GETPWUID   1
+#define METANFS4_GETPWNAM   2
+#define METANFS4_GETGRGID   3
+#define METANFS4_GETGRNAM   4
+
+/* completed request, Name and Members are valid until the next call of metanfs4_client_next() */
+struct SNFS4Completion {
+    uint64_t        Tag;            /* tag of the request */
+    int             Type;           /* type of the request */
+    int             Status;         /* 0 - found, ENOENT - not found, EIO - connection to the daemon failed, */
+                                    /* ENOMEM - the response cannot be received */
+    uint32_t        ID;             /* uid or gid, the requested id if not found */
+    uint32_t        GID;            /* primary group of the user */
+    const char*     Name;           /* user or group name, the requested name if not found (can be NULL) */
+    uint32_t        NumOfMembers;   /* group members */
+    const char*     Members;        /* \0 terminated names */
+};
+
+/* connect to the daemon, max_in_flight limits the number of requests sent but not
+   completed (0 - default), it returns NULL and sets errno on failure,
+   EPROTONOSUPPORT - the daemon does not support pipelined requests */
+struct SNFS4Client* metanfs4_client_open(size_t max_in_flight);
+
+/* close the connection, not completed requests are discarded */
+void metanfs4_client_close(struct SNFS4Client* p_client);
+
+/* file descriptor to be polled and requested events (POLLIN, POLLOUT), the connection
+   is restored immediately after a failure if requests are queued, thus the descriptor
+   can be changed by metanfs4_client_next(), metanfs4_client_flush(), and
+   metanfs4_client_wait() and it has to be obtained again before each poll,
+   it is -1 only if no request waits for the daemon */
+int metanfs4_client_fd(const struct SNFS4Client* p_client);
+short metanfs4_client_events(const struct SNFS4Client* p_client);
+
+/* submit requests, they are sent by metanfs4_client_next() or metanfs4_client_flush(),
+   the tag is any value chosen by the caller, it returns 0 or -ENOMEM, -EINVAL */
+int metanfs4_client_getpwuid(struct SNFS4Client* p_client,uint64_t tag,uid_t uid);
+int metanfs4_client_getpwnam(struct SNFS4Client* p_client,uint64_t tag,const char* name);
+int metanfs4_client_getgrgid(struct SNFS4Client* p_client,uint64_t tag,gid_t gid);
+int metanfs4_client_getgrnam(struct SNFS4Client* p_client,uint64_t tag,const char* name);
+
+/* send submitted requests as far as the connection allows, it never blocks,
+   it returns 0 or -EIO if the connection failed (not completed requests are
+   then completed with EIO) */
+int metanfs4_client_flush(struct SNFS4Client* p_client);
+
+/* get one completed request without blocking, submitted requests are sent,
+   it returns 1 - p_comp is filled, 0 - no completion is available now */
+int metanfs4_client_next(struct SNFS4Client* p_client,struct SNFS4Completion* p_comp);
+
+/* block until the connection is ready or the timeout (ms, -1 - infinite) expires, it returns
+   1 - metanfs4_client_next() should be called, 0 - timeout or nothing to wait for, -1 - failure */
+int metanfs4_client_wait(struct SNFS4Client* p_client,int timeout);
+
+/* number of submitted requests, which were not returned by metanfs4_client_next() yet */
+size_t metanfs4_client_pending(const struct SNFS4Client* p_client);
+
+/* item of metanfs4_client_lookup_batch(), Type and ID or Name are set by the caller */
+struct SNFS4BatchItem {
+    int             Type;           /* METANFS4_GETPWUID, METANFS4_GETPWNAM, METANFS4_GETGRGID, METANFS4_GETGRNAM */
+    int             Status;         /* 0 - found, ENOENT - not found */
+    uint32_t        ID;             /* uid or gid, the requested id if not found */
+    uint32_t        GID;            /* primary group of the user */
+    const char*     Name;           /* user or group name, the requested name if not found, names of found */
+                                    /* items are valid until the next batch or metanfs4_client_close() */
+};
+
+/* resolve many users and groups in as few round trips as possible and wait for the result,
+   group members are not provided, requests submitted before must be completed first,
+   it returns the number of found items or -EBUSY, -EINVAL, -ENOMEM, -EIO */
+int metanfs4_client_lookup_batch(struct SNFS4Client* p_client,struct SNFS4BatchItem* p_items,size_t count);
+
+/* -------------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef MetaNFS4ClientH
+#define MetaNFS4ClientH
+// =============================================================================
+// MetaNFS4 - user/id mapper for NFS4 mounts with the krb5 security type
+// -----------------------------------------------------------------------------
+//    Copyright (C) 2016 Petr Kulhanek, kulhanek@chemi.muni.cz
+//
+//     This program is free software; you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation; either version 2 of the License, or
+//     (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License along
+//     with this program; if not, write to the Free Software Foundation, Inc.,
+//     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+// =============================================================================
+
+#include <string>
+#include <metanfs4client.h>
+
+//------------------------------------------------------------------------------
+
+// thin wrapper of the asynchronous client, see metanfs4client.h
+
+class CMetaNFS4Client {
+public:
+    CMetaNFS4Client(void) : Client(NULL) {}
+    ~CMetaNFS4Client(void) { Close(); }
+
+    // connect to the daemon, errno is set on failure
+    bool Open(size_t max_in_flight = 0)
+    {
+        Close();
+        Client = metanfs4_client_open(max_in_flight);
+        return(Client != NULL);
+    }
+
+    void Close(void)
+    {
+        metanfs4_client_close(Client);
+        Client = NULL;
+    }
+
+    bool IsOpened(void) const { return(Client != NULL); }
+
+    // descriptor and events for poll(), the descriptor can be changed by reconnection
+    int GetFD(void) const { return(metanfs4_client_fd(Client)); }
+    short GetEvents(void) const { return(metanfs4_client_events(Client)); }
+
+    // submit requests
+    int GetPwUID(uint64_t tag,uid_t uid) { return(metanfs4_client_getpwuid(Client,tag,uid)); }
+    int GetPwNam(uint64_t tag,const std::string& name) { return(metanfs4_client_getpwnam(Client,tag,name.c_str())); }
+    int GetGrGID(uint64_t tag,gid_t gid) { return(metanfs4_client_getgrgid(Client,tag,gid)); }
+    int GetGrNam(uint64_t tag,const std::string& name) { return(metanfs4_client_getgrnam(Client,tag,name.c_str())); }
+
+    // send requests, get completions
+    int Flush(void) { return(metanfs4_client_flush(Client)); }
+    bool Next(struct SNFS4Completion& comp) { return(metanfs4_client_next(Client,&comp) > 0); }
+    int Wait(int timeout = -1) { return(metanfs4_client_wait(Client,timeout)); }
+    size_t GetNumOfPending(void) const { return(metanfs4_client_pending(Client)); }
+
+    // synchronous batch of lookups
+    int LookupBatch(struct SNFS4BatchItem* p_items,size_t count) { return(metanfs4_client_lookup_batch(Client,p_items,count)); }
+
+private:
+    // the connection cannot be copied
+    CMetaNFS4Client(const CMetaNFS4Client&);
+    CMetaNFS4Client& operator = (const CMetaNFS4Client&);
+
+    struct SNFS4Client* Client;
+};
+
+//------------------------------------------------------------------------------
+
+#endif